@@ -0,0 +1,427 @@
+/*-----------------------------------------------------------------------------
+ * A benchmark for slvs.dll. We generate synthetic sketches of a given size
+ * through the Slvs_System API, solve them, and report the time, the number
+ * of Newton iterations, the peak memory and the result, one line per case,
+ * as comma-separated values.
+ *
+ * Usage: bench [-r repeats] [case size]...
+ * where case is chain, rects, cloud or over; with no cases, we run a
+ * default set of them. The time is the fastest of the repeats. The peak
+ * memory is for the whole process so far, so to measure that for a single
+ * case, run it by itself.
+ *
+ * The solver makes each constraint's equation handles from its own handle
+ * shifted up by 16 bits, so a system can't have more than 65535
+ * constraints. That caps the size of each case; see MaxSize().
+ *---------------------------------------------------------------------------*/
+#ifdef HAVE_CONFIG_H
+#   include <config.h>
+#endif
+#ifdef WIN32
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/time.h>
+#   include <sys/resource.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef HAVE_STDINT_H
+#   include <stdint.h>
+#endif
+
+#include <slvs.h>
+
+#ifndef M_PI
+#   define M_PI 3.14159265358979323846
+#endif
+
+static Slvs_System sys;
+static int maxParams, maxEntities, maxConstraints;
+
+static void *CheckRealloc(void *p, size_t n)
+{
+    void *r = realloc(p, n);
+    if(!r) {
+        printf("out of memory!\n");
+        exit(-1);
+    }
+    return r;
+}
+
+/*-----------------------------------------------------------------------------
+ * Empty the system, and make sure that it has room for the given number of
+ * params, entities and constraints.
+ *---------------------------------------------------------------------------*/
+static void Reset(int params, int entities, int constraints)
+{
+    if(params > maxParams) {
+        sys.param = CheckRealloc(sys.param, params*sizeof(sys.param[0]));
+        maxParams = params;
+    }
+    if(entities > maxEntities) {
+        sys.entity = CheckRealloc(sys.entity, entities*sizeof(sys.entity[0]));
+        maxEntities = entities;
+    }
+    if(constraints > maxConstraints) {
+        sys.constraint = CheckRealloc(sys.constraint,
+                                      constraints*sizeof(sys.constraint[0]));
+        sys.failed = CheckRealloc(sys.failed,
+                                  constraints*sizeof(sys.failed[0]));
+        maxConstraints = constraints;
+    }
+    sys.params = sys.entities = sys.constraints = 0;
+    memset(sys.dragged, 0, sizeof(sys.dragged));
+    sys.faileds = maxConstraints;
+    sys.calculateFaileds = 0;
+    sys.dof = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * A pseudo-random number in [0, 1), the same on every platform so that the
+ * cases are too.
+ *---------------------------------------------------------------------------*/
+static uint32_t Seed;
+static double Random(void)
+{
+    Seed = Seed*1103515245 + 12345;
+    return ((Seed >> 8) & 0xffff)/65536.0;
+}
+
+/*-----------------------------------------------------------------------------
+ * A workplane along the xy plane, in group 1, with handle 200; its origin is
+ * point 101.
+ *---------------------------------------------------------------------------*/
+static void Workplane(void)
+{
+    Slvs_hGroup g = 1;
+    double qw, qx, qy, qz;
+
+    sys.param[sys.params++] = Slvs_MakeParam(1, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(2, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(3, g, 0.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint3d(101, g, 1, 2, 3);
+    Slvs_MakeQuaternion(1, 0, 0,
+                        0, 1, 0, &qw, &qx, &qy, &qz);
+    sys.param[sys.params++] = Slvs_MakeParam(4, g, qw);
+    sys.param[sys.params++] = Slvs_MakeParam(5, g, qx);
+    sys.param[sys.params++] = Slvs_MakeParam(6, g, qy);
+    sys.param[sys.params++] = Slvs_MakeParam(7, g, qz);
+    sys.entity[sys.entities++] = Slvs_MakeNormal3d(102, g, 4, 5, 6, 7);
+    sys.entity[sys.entities++] = Slvs_MakeWorkplane(200, g, 101, 102);
+}
+
+/*-----------------------------------------------------------------------------
+ * A zigzag chain of n segments in the workplane, each with its own two
+ * points, joined end to start by coincident constraints. Every segment has a
+ * length, and an angle to the one before; the first starts at the origin
+ * and is horizontal. So it's fully constrained, and it's all one system.
+ *---------------------------------------------------------------------------*/
+static Slvs_hGroup Chain(int n)
+{
+    Slvs_hGroup g = 2;
+    Slvs_hParam hp = 1000;
+    Slvs_hEntity he = 1000, prevPt = 101, prevLine = 0;
+    Slvs_hConstraint hc = 1;
+    double x = 0, y = 0;
+    int i, k;
+
+    Reset(7 + 4*n, 3 + 3*n, 3*n);
+    Workplane();
+    for(i = 0; i < n; i++) {
+        /* The segments go alternately up and down at 30 degrees, so that
+         * each is at 60 degrees to the last, plus a little noise. */
+        double theta = (i == 0) ? 0 : ((i % 2) ? 30 : -30)*M_PI/180;
+        double px[2], py[2];
+        Slvs_hEntity pt[2], line;
+        px[0] = x;
+        py[0] = y;
+        x += 10*cos(theta);
+        y += 10*sin(theta);
+        px[1] = x;
+        py[1] = y;
+        for(k = 0; k < 2; k++) {
+            sys.param[sys.params++] = Slvs_MakeParam(hp,   g,
+                                            px[k] + 0.5*(Random() - 0.5));
+            sys.param[sys.params++] = Slvs_MakeParam(hp+1, g,
+                                            py[k] + 0.5*(Random() - 0.5));
+            pt[k] = he;
+            sys.entity[sys.entities++] = Slvs_MakePoint2d(he++, g, 200,
+                                                          hp, hp+1);
+            hp += 2;
+        }
+        line = he;
+        sys.entity[sys.entities++] = Slvs_MakeLineSegment(he++, g, 200,
+                                                          pt[0], pt[1]);
+
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_POINTS_COINCIDENT, 200, 0, prevPt, pt[0], 0, 0);
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_PT_PT_DISTANCE, 200, 10.0, pt[0], pt[1], 0, 0);
+        if(prevLine) {
+            sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                hc++, g, SLVS_C_ANGLE, 200, 60.0, 0, 0, prevLine, line);
+        } else {
+            sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                hc++, g, SLVS_C_HORIZONTAL, 200, 0, 0, 0, line, 0);
+        }
+        prevPt = pt[1];
+        prevLine = line;
+    }
+    return g;
+}
+
+/*-----------------------------------------------------------------------------
+ * A grid of n rectangles in the workplane, each made of four segments with
+ * separate endpoints joined by coincident constraints, and dimensioned but
+ * not located; so each is an independent subsystem with two degrees of
+ * freedom. If over, then the middle rectangle gets an extra dimension that
+ * disagrees with the others, and we ask which constraints are to blame.
+ *---------------------------------------------------------------------------*/
+static Slvs_hGroup Rects(int n, int over)
+{
+    Slvs_hGroup g = 2;
+    Slvs_hParam hp = 1000;
+    Slvs_hEntity he = 1000;
+    Slvs_hConstraint hc = 1;
+    int i, k;
+
+    Reset(7 + 16*n, 3 + 12*n, 10*n + 1);
+    Workplane();
+    for(i = 0; i < n; i++) {
+        double ox = (i % 32)*50.0, oy = (i / 32)*50.0;
+        /* The corners, counterclockwise from the origin; segment k goes
+         * from corner k to corner k+1. */
+        static const double cx[4] = { 0, 20, 20, 0 },
+                            cy[4] = { 0, 0, 10, 10 };
+        Slvs_hEntity pt[8], line[4];
+        for(k = 0; k < 8; k++) {
+            int c = ((k + 1)/2) % 4;
+            sys.param[sys.params++] = Slvs_MakeParam(hp,   g,
+                                        ox + cx[c] + 2*(Random() - 0.5));
+            sys.param[sys.params++] = Slvs_MakeParam(hp+1, g,
+                                        oy + cy[c] + 2*(Random() - 0.5));
+            pt[k] = he;
+            sys.entity[sys.entities++] = Slvs_MakePoint2d(he++, g, 200,
+                                                          hp, hp+1);
+            hp += 2;
+        }
+        for(k = 0; k < 4; k++) {
+            line[k] = he;
+            sys.entity[sys.entities++] = Slvs_MakeLineSegment(he++, g, 200,
+                                                    pt[2*k], pt[2*k+1]);
+            sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                hc++, g, SLVS_C_POINTS_COINCIDENT, 200, 0,
+                pt[2*k+1], pt[(2*k+2) % 8], 0, 0);
+        }
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_HORIZONTAL, 200, 0, 0, 0, line[0], 0);
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_HORIZONTAL, 200, 0, 0, 0, line[2], 0);
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_VERTICAL, 200, 0, 0, 0, line[1], 0);
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_VERTICAL, 200, 0, 0, 0, line[3], 0);
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_PT_PT_DISTANCE, 200, 20.0, pt[0], pt[1], 0, 0);
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+            hc++, g, SLVS_C_PT_PT_DISTANCE, 200, 10.0, pt[2], pt[3], 0, 0);
+        if(over && i == n/2) {
+            sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                hc++, g, SLVS_C_PT_PT_DISTANCE, 200, 11.0, pt[6], pt[7], 0, 0);
+        }
+    }
+    if(over) sys.calculateFaileds = 1;
+    return g;
+}
+
+/*-----------------------------------------------------------------------------
+ * A cloud of n points in 3d, each at given distances from the two points
+ * before it, with the first point dragged. That's one big system, with many
+ * degrees of freedom.
+ *---------------------------------------------------------------------------*/
+static Slvs_hGroup Cloud(int n)
+{
+    Slvs_hGroup g = 1;
+    Slvs_hParam hp = 1;
+    Slvs_hEntity he = 1000;
+    Slvs_hConstraint hc = 1;
+    int i, k;
+
+    Reset(3*n, n, 2*n);
+    for(i = 0; i < n; i++) {
+        for(k = 0; k < 3; k++) {
+            sys.param[sys.params++] = Slvs_MakeParam(hp + k, g, 100*Random());
+        }
+        sys.entity[sys.entities++] = Slvs_MakePoint3d(he, g, hp, hp+1, hp+2);
+        hp += 3;
+        if(i >= 1) {
+            sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                hc++, g, SLVS_C_PT_PT_DISTANCE, SLVS_FREE_IN_3D, 30.0,
+                he, he-1, 0, 0);
+        }
+        if(i >= 2) {
+            sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                hc++, g, SLVS_C_PT_PT_DISTANCE, SLVS_FREE_IN_3D, 40.0,
+                he, he-2, 0, 0);
+        }
+        he++;
+    }
+    sys.dragged[0] = 1;
+    sys.dragged[1] = 2;
+    sys.dragged[2] = 3;
+    return g;
+}
+
+static Slvs_hGroup Generate(const char *name, int n)
+{
+    Seed = 1;
+    if(strcmp(name, "chain") == 0) return Chain(n);
+    if(strcmp(name, "rects") == 0) return Rects(n, 0);
+    if(strcmp(name, "cloud") == 0) return Cloud(n);
+    if(strcmp(name, "over") == 0)  return Rects(n, 1);
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * The largest size of each case whose constraint handles still fit in 16
+ * bits; or 0 if there's no such case.
+ *---------------------------------------------------------------------------*/
+static int MaxSize(const char *name)
+{
+    if(strcmp(name, "chain") == 0) return 65535/3;
+    if(strcmp(name, "rects") == 0) return 65535/10;
+    if(strcmp(name, "cloud") == 0) return (65535 + 3)/2;
+    if(strcmp(name, "over") == 0)  return (65535 - 1)/10;
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * The wall-clock time in milliseconds, and the peak memory use of the
+ * process in kilobytes.
+ *---------------------------------------------------------------------------*/
+static double Milliseconds(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart*1000.0/(double)f.QuadPart;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec*1000.0 + tv.tv_usec/1000.0;
+#endif
+}
+
+static long PeakKilobytes(void)
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return -1;
+    }
+    return (long)(pmc.PeakWorkingSetSize/1024);
+#else
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) != 0) return -1;
+#   ifdef __APPLE__
+    /* in bytes here, but kilobytes everywhere else */
+    return ru.ru_maxrss/1024;
+#   else
+    return ru.ru_maxrss;
+#   endif
+#endif
+}
+
+static const char *ResultName(int result)
+{
+    switch(result) {
+        case SLVS_RESULT_OKAY:              return "okay";
+        case SLVS_RESULT_INCONSISTENT:      return "inconsistent";
+        case SLVS_RESULT_DIDNT_CONVERGE:    return "didnt_converge";
+        case SLVS_RESULT_TOO_MANY_UNKNOWNS: return "too_many_unknowns";
+        default:                            return "unknown";
+    }
+}
+
+static void Run(const char *name, int n, int repeats)
+{
+    double best = 0;
+    int i;
+
+    for(i = 0; i < repeats; i++) {
+        Slvs_hGroup g = Generate(name, n);
+        double t0 = Milliseconds();
+        Slvs_Solve(&sys, g);
+        double t = Milliseconds() - t0;
+        if(i == 0 || t < best) best = t;
+    }
+    printf("%s,%d,%d,%d,%s,%d,%d,%d,%.3f,%ld\n",
+        name, n, sys.params, sys.constraints, ResultName(sys.result),
+        sys.dof, sys.result == SLVS_RESULT_INCONSISTENT ? sys.faileds : 0,
+        Slvs_GetIterations(), best, PeakKilobytes());
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        int         n;
+    } Defaults[] = {
+        { "chain",  100 },
+        { "chain",  1000 },
+        { "rects",  100 },
+        { "rects",  1000 },
+        { "cloud",  100 },
+        { "cloud",  1000 },
+        { "over",   10 },
+        { "over",   100 },
+    };
+    int i, first, repeats = 1;
+
+    memset(&sys, 0, sizeof(sys));
+
+    first = 1;
+    if(first + 1 < argc && strcmp(argv[first], "-r") == 0) {
+        repeats = atoi(argv[first+1]);
+        if(repeats < 1) repeats = 1;
+        first += 2;
+    }
+    if((argc - first) % 2 != 0) {
+        fprintf(stderr, "usage: %s [-r repeats] [case size]...\n"
+                        "  where case is chain, rects, cloud or over,\n"
+                        "  and size is at most %d, %d, %d or %d\n",
+                        argv[0], MaxSize("chain"), MaxSize("rects"),
+                        MaxSize("cloud"), MaxSize("over"));
+        return 1;
+    }
+    for(i = first; i < argc; i += 2) {
+        if(!MaxSize(argv[i]) || atoi(argv[i+1]) < 1) {
+            fprintf(stderr, "bad case: %s %s\n", argv[i], argv[i+1]);
+            return 1;
+        }
+        if(atoi(argv[i+1]) > MaxSize(argv[i])) {
+            fprintf(stderr, "too big: %s %s; at most %d, since the solver "
+                            "takes at most 65535 constraints\n",
+                            argv[i], argv[i+1], MaxSize(argv[i]));
+            return 1;
+        }
+    }
+
+    printf("case,size,params,constraints,result,dof,faileds,"
+           "iterations,ms,peak_kb\n");
+    if(first == argc) {
+        for(i = 0; i < (int)(sizeof(Defaults)/sizeof(Defaults[0])); i++) {
+            Run(Defaults[i].name, Defaults[i].n, repeats);
+        }
+    } else {
+        for(i = first; i < argc; i += 2) {
+            Run(argv[i], atoi(argv[i+1]), repeats);
+        }
+    }
+    return 0;
+}
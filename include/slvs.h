@@ -194,6 +194,26 @@ typedef struct {
 
 DLL void Slvs_Solve(Slvs_System *sys, Slvs_hGroup hg);
 
+/* The number of Newton iterations that the last call to Slvs_Solve() took,
+ * summed over the independent subsystems that it split the problem into.
+ * That's not needed to use the solver, but it's useful for benchmarking. */
+DLL int Slvs_GetIterations(void);
+
+/* Slvs_Solve() keeps its state in a single context for the whole process,
+ * so only one thread can use it at a time. To solve on several threads at
+ * once, give each its own context, and solve in that instead. A context
+ * may be used by any thread, but by only one thread at a time. It also
+ * keeps some work from one solve to the next, so it's best to solve
+ * successive versions of the same sketch (e.g. while dragging) in the same
+ * context. */
+typedef struct Slvs_Context Slvs_Context;
+
+DLL Slvs_Context *Slvs_CreateContext(void);
+DLL void Slvs_SolveInContext(Slvs_Context *ctx, Slvs_System *sys,
+                             Slvs_hGroup hg);
+DLL int Slvs_GetIterationsInContext(Slvs_Context *ctx);
+DLL void Slvs_DestroyContext(Slvs_Context *ctx);
+
 
 /* Our base coordinate system has basis vectors
  *     (1, 0, 0)  (0, 1, 0)  (0, 0, 1)
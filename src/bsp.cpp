@@ -8,8 +8,8 @@
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
 
-SBsp2 *SBsp2::Alloc(void) { return (SBsp2 *)AllocTemporary(sizeof(SBsp2)); }
-SBsp3 *SBsp3::Alloc(void) { return (SBsp3 *)AllocTemporary(sizeof(SBsp3)); }
+SBsp2 *SBsp2::Alloc(void) { return (SBsp2 *)AllocTemporaryNode(sizeof(SBsp2)); }
+SBsp3 *SBsp3::Alloc(void) { return (SBsp3 *)AllocTemporaryNode(sizeof(SBsp3)); }
 
 SBsp3 *SBsp3::FromMesh(SMesh *m) {
     SBsp3 *bsp3 = NULL;
@@ -29,7 +29,7 @@ SBsp3 *SBsp3::FromMesh(SMesh *m) {
     }
 
     for(i = 0; i < mc.l.n; i++) {
-        bsp3 = bsp3->Insert(&(mc.l.elem[i]), NULL);
+        bsp3 = bsp3->Insert(&(mc.l.elem[i]));
     }
 
     mc.Clear();
@@ -45,57 +45,17 @@ Vector SBsp3::IntersectionWith(Vector a, Vector b) {
     return (a.ScaledBy(db/dab)).Plus(b.ScaledBy(-da/dab));
 }
 
-void SBsp3::InsertInPlane(bool pos2, STriangle *tr, SMesh *m) {
-    Vector tc = ((tr->a).Plus(tr->b).Plus(tr->c)).ScaledBy(1.0/3);
-
-    bool onFace = false;
-    bool sameNormal = false;
-    double maxNormalMag = -1;
-
-    Vector lln, trn = tr->Normal();
-
-    SBsp3 *ll = this;
-    while(ll) {
-        if((ll->tri).ContainsPoint(tc)) {
-            onFace = true;
-            // If the mesh contains almost-zero-area triangles, and we're
-            // just on the edge of one of those, then don't trust its normal.
-            lln = (ll->tri).Normal();
-            if(lln.Magnitude() > maxNormalMag) {
-                sameNormal = trn.Dot(lln) > 0;
-                maxNormalMag = lln.Magnitude();
-            }
-        }
-        ll = ll->more;
-    }
-
-    if(m->flipNormal && ((!pos2 && !onFace) ||
-                                   (onFace && !sameNormal && m->keepCoplanar)))
-    {
-        m->AddTriangle(tr->meta, tr->c, tr->b, tr->a);
-    } else if(!(m->flipNormal) && ((pos2 && !onFace) ||
-                                   (onFace && sameNormal && m->keepCoplanar)))
-    {
-        m->AddTriangle(tr->meta, tr->a, tr->b, tr->c);
-    } else {
-        m->atLeastOneDiscarded = true;
-    }
-}
-
-void SBsp3::InsertHow(int how, STriangle *tr, SMesh *instead) {
+void SBsp3::InsertHow(int how, STriangle *tr) {
     switch(how) {
         case POS:
-            if(instead && !pos) goto alt;
-            pos = pos->Insert(tr, instead);
+            pos = pos->Insert(tr);
             break;
 
         case NEG:
-            if(instead && !neg) goto alt;
-            neg = neg->Insert(tr, instead);
+            neg = neg->Insert(tr);
             break;
 
         case COPLANAR: {
-            if(instead) goto alt;
             SBsp3 *m = Alloc();
             m->n = n;
             m->d = d;
@@ -106,40 +66,20 @@ void SBsp3::InsertHow(int how, STriangle *tr, SMesh *instead) {
         }
         default: oops();
     }
-    return;
-
-alt:
-    if(how == POS && !(instead->flipNormal)) {
-        instead->AddTriangle(tr->meta, tr->a, tr->b, tr->c);
-    } else if(how == NEG && instead->flipNormal) {
-        instead->AddTriangle(tr->meta, tr->c, tr->b, tr->a);
-    } else if(how == COPLANAR) {
-        if(edges) {
-            edges->InsertTriangle(tr, instead, this);
-        } else {
-            // I suppose this actually is allowed to happen, if the coplanar
-            // face is the leaf, and all of its neighbors are earlier in tree?
-            InsertInPlane(false, tr, instead);
-        }
-    } else {
-        instead->atLeastOneDiscarded = true;
-    }
 }
 
-void SBsp3::InsertConvexHow(int how, STriMeta meta, Vector *vertex, int n,
-                            SMesh *instead)
-{
+void SBsp3::InsertConvexHow(int how, STriMeta meta, Vector *vertex, int n) {
     switch(how) {
         case POS:
             if(pos) {
-                pos = pos->InsertConvex(meta, vertex, n, instead);
+                pos = pos->InsertConvex(meta, vertex, n);
                 return;
             }
             break;
 
         case NEG:
             if(neg) {
-                neg = neg->InsertConvex(meta, vertex, n, instead);
+                neg = neg->InsertConvex(meta, vertex, n);
                 return;
             }
             break;
@@ -150,13 +90,11 @@ void SBsp3::InsertConvexHow(int how, STriMeta meta, Vector *vertex, int n,
     for(i = 0; i < n - 2; i++) {
         STriangle tr = STriangle::From(meta,
                                        vertex[0], vertex[i+1], vertex[i+2]);
-        InsertHow(how, &tr, instead);
+        InsertHow(how, &tr);
     }
 }
 
-SBsp3 *SBsp3::InsertConvex(STriMeta meta, Vector *vertex, int cnt,
-                           SMesh *instead)
-{
+SBsp3 *SBsp3::InsertConvex(STriMeta meta, Vector *vertex, int cnt) {
     Vector e01 = (vertex[1]).Minus(vertex[0]);
     Vector e12 = (vertex[2]).Minus(vertex[1]);
     Vector out = e01.Cross(e12);
@@ -190,18 +128,16 @@ SBsp3 *SBsp3::InsertConvex(STriMeta meta, Vector *vertex, int cnt,
     if(onc != 2 && onc != 1 && onc != 0) goto triangulate;
 
     if(onc == 2) {
-        if(!instead) {
-            SEdge se = SEdge::From(on[0], on[1]);
-            edges = edges->InsertEdge(&se, n, out);
-        }
+        SEdge se = SEdge::From(on[0], on[1]);
+        edges = edges->InsertEdge(&se, n, out);
     }
 
     if(posc == 0) {
-        InsertConvexHow(NEG, meta, vertex, cnt, instead);
+        InsertConvexHow(NEG, meta, vertex, cnt);
         return this;
     }
     if(negc == 0) {
-        InsertConvexHow(POS, meta, vertex, cnt, instead);
+        InsertConvexHow(POS, meta, vertex, cnt);
         return this;
     }
 
@@ -236,23 +172,21 @@ SBsp3 *SBsp3::InsertConvex(STriMeta meta, Vector *vertex, int cnt,
     }
     if(npos > cnt + 1 || nneg > cnt + 1) oops();
 
-    if(!instead) {
-        if(inters == 2) {
-            SEdge se = SEdge::From(inter[0], inter[1]);
-            edges = edges->InsertEdge(&se, n, out);
-        } else if(inters == 1 && onc == 1) {
-            SEdge se = SEdge::From(inter[0], on[0]);
-            edges = edges->InsertEdge(&se, n, out);
-        } else if(inters == 0 && onc == 2) {
-            // We already handled this on-plane existing edge
-        } else {
-            goto triangulate;
-        }
+    if(inters == 2) {
+        SEdge se = SEdge::From(inter[0], inter[1]);
+        edges = edges->InsertEdge(&se, n, out);
+    } else if(inters == 1 && onc == 1) {
+        SEdge se = SEdge::From(inter[0], on[0]);
+        edges = edges->InsertEdge(&se, n, out);
+    } else if(inters == 0 && onc == 2) {
+        // We already handled this on-plane existing edge
+    } else {
+        goto triangulate;
     }
     if(nneg < 3 || npos < 3) goto triangulate; // XXX
 
-    InsertConvexHow(NEG, meta, vneg, nneg, instead);
-    InsertConvexHow(POS, meta, vpos, npos, instead);
+    InsertConvexHow(NEG, meta, vneg, nneg);
+    InsertConvexHow(POS, meta, vpos, npos);
     return this;
 
 triangulate:
@@ -261,22 +195,13 @@ triangulate:
     for(i = 0; i < cnt - 2; i++) {
         STriangle tr = STriangle::From(meta,
                                        vertex[0], vertex[i+1], vertex[i+2]);
-        r = r->Insert(&tr, instead);
+        r = r->Insert(&tr);
     }
     return r;
 }
 
-SBsp3 *SBsp3::Insert(STriangle *tr, SMesh *instead) {
+SBsp3 *SBsp3::Insert(STriangle *tr) {
     if(!this) {
-        if(instead) {
-            if(instead->flipNormal) {
-                instead->atLeastOneDiscarded = true;
-            } else {
-                instead->AddTriangle(tr->meta, tr->a, tr->b, tr->c);
-            }
-            return NULL;
-        }
-
         // Brand new node; so allocate for it, and fill us in.
         SBsp3 *r = Alloc();
         r->n = (tr->Normal()).WithMagnitude(1);
@@ -306,7 +231,7 @@ SBsp3 *SBsp3::Insert(STriangle *tr, SMesh *instead) {
 
     // All vertices in-plane
     if(inc == 3) {
-        InsertHow(COPLANAR, tr, instead);
+        InsertHow(COPLANAR, tr);
         return this;
     }
 
@@ -318,16 +243,14 @@ SBsp3 *SBsp3::Insert(STriangle *tr, SMesh *instead) {
             else if(!isOn[1]) { a = tr->c; b = tr->a; }
             else if(!isOn[2]) { a = tr->a; b = tr->b; }
             else oops();
-            if(!instead) {
-                SEdge se = SEdge::From(a, b);
-                edges = edges->InsertEdge(&se, n, tr->Normal());
-            }
+            SEdge se = SEdge::From(a, b);
+            edges = edges->InsertEdge(&se, n, tr->Normal());
         }
 
         if(posc > 0) {
-            InsertHow(POS, tr, instead);
+            InsertHow(POS, tr);
         } else {
-            InsertHow(NEG, tr, instead);
+            InsertHow(NEG, tr);
         }
         return this;
     }
@@ -348,17 +271,15 @@ SBsp3 *SBsp3::Insert(STriangle *tr, SMesh *instead) {
         STriangle ctri = STriangle::From(tr->meta, c, a, bPc);
 
         if(bpos) {
-            InsertHow(POS, &btri, instead);
-            InsertHow(NEG, &ctri, instead);
+            InsertHow(POS, &btri);
+            InsertHow(NEG, &ctri);
         } else {
-            InsertHow(POS, &ctri, instead);
-            InsertHow(NEG, &btri, instead);
+            InsertHow(POS, &ctri);
+            InsertHow(NEG, &btri);
         }
 
-        if(!instead) {
-            SEdge se = SEdge::From(a, bPc);
-            edges = edges->InsertEdge(&se, n, tr->Normal());
-        }
+        SEdge se = SEdge::From(a, bPc);
+        edges = edges->InsertEdge(&se, n, tr->Normal());
 
         return this;
     }
@@ -384,16 +305,14 @@ SBsp3 *SBsp3::Insert(STriangle *tr, SMesh *instead) {
     Vector quad[4] = { aPb, b, c, cPa };
 
     if(posc == 2 && negc == 1) {
-        InsertConvexHow(POS, tr->meta, quad, 4, instead);
-        InsertHow(NEG, &alone, instead);
+        InsertConvexHow(POS, tr->meta, quad, 4);
+        InsertHow(NEG, &alone);
     } else {
-        InsertConvexHow(NEG, tr->meta, quad, 4, instead);
-        InsertHow(POS, &alone, instead);
-    }
-    if(!instead) {
-        SEdge se = SEdge::From(aPb, cPa);
-        edges = edges->InsertEdge(&se, n, alone.Normal());
+        InsertConvexHow(NEG, tr->meta, quad, 4);
+        InsertHow(POS, &alone);
     }
+    SEdge se = SEdge::From(aPb, cPa);
+    edges = edges->InsertEdge(&se, n, alone.Normal());
 
     return this;
 }
@@ -545,122 +464,6 @@ SBsp2 *SBsp2::InsertEdge(SEdge *nedge, Vector nnp, Vector out) {
     oops();
 }
 
-void SBsp2::InsertTriangleHow(int how, STriangle *tr, SMesh *m, SBsp3 *bsp3) {
-    switch(how) {
-        case POS:
-            if(pos) {
-                pos->InsertTriangle(tr, m, bsp3);
-            } else {
-                bsp3->InsertInPlane(true, tr, m);
-            }
-            break;
-
-        case NEG:
-            if(neg) {
-                neg->InsertTriangle(tr, m, bsp3);
-            } else {
-                bsp3->InsertInPlane(false, tr, m);
-            }
-            break;
-
-        default: oops();
-    }
-}
-
-void SBsp2::InsertTriangle(STriangle *tr, SMesh *m, SBsp3 *bsp3) {
-    double dt[3] = { (tr->a).Dot(no), (tr->b).Dot(no), (tr->c).Dot(no) };
-
-    bool isPos[3], isNeg[3], isOn[3];
-    int inc = 0, posc = 0, negc = 0;
-    ZERO(&isPos); ZERO(&isNeg); ZERO(&isOn);
-    for(int i = 0; i < 3; i++) {
-        if(fabs(dt[i] - d) < LENGTH_EPS) {
-            isOn[i] = true;
-            inc++;
-        } else if(dt[i] > d) {
-            isPos[i] = true;
-            posc++;
-        } else {
-            isNeg[i] = true;
-            negc++;
-        }
-    }
-
-    if(inc == 3) {
-        // All vertices on-line; so it's a degenerate triangle, to ignore.
-        return;
-    }
-
-    // No split required
-    if(posc == 0 || negc == 0) {
-        if(posc > 0) {
-            InsertTriangleHow(POS, tr, m, bsp3);
-        } else {
-            InsertTriangleHow(NEG, tr, m, bsp3);
-        }
-        return;
-    }
-
-    // The polygon must be split into two pieces, one above, one below.
-    Vector a, b, c;
-
-    if(posc == 1 && negc == 1 && inc == 1) {
-        bool bpos;
-        // Standardize so that a is on the plane
-        if       (isOn[0]) { a = tr->a; b = tr->b; c = tr->c; bpos = isPos[1];
-        } else if(isOn[1]) { a = tr->b; b = tr->c; c = tr->a; bpos = isPos[2];
-        } else if(isOn[2]) { a = tr->c; b = tr->a; c = tr->b; bpos = isPos[0];
-        } else oops();
-
-        Vector bPc = IntersectionWith(b, c);
-        STriangle btri = STriangle::From(tr->meta, a, b, bPc);
-        STriangle ctri = STriangle::From(tr->meta, c, a, bPc);
-
-        if(bpos) {
-            InsertTriangleHow(POS, &btri, m, bsp3);
-            InsertTriangleHow(NEG, &ctri, m, bsp3);
-        } else {
-            InsertTriangleHow(POS, &ctri, m, bsp3);
-            InsertTriangleHow(NEG, &btri, m, bsp3);
-        }
-
-        return;
-    }
-
-    if(posc == 2 && negc == 1) {
-        // Standardize so that a is on one side, and b and c are on the other.
-        if       (isNeg[0]) {   a = tr->a; b = tr->b; c = tr->c;
-        } else if(isNeg[1]) {   a = tr->b; b = tr->c; c = tr->a;
-        } else if(isNeg[2]) {   a = tr->c; b = tr->a; c = tr->b;
-        } else oops();
-
-    } else if(posc == 1 && negc == 2) {
-        if       (isPos[0]) {   a = tr->a; b = tr->b; c = tr->c;
-        } else if(isPos[1]) {   a = tr->b; b = tr->c; c = tr->a;
-        } else if(isPos[2]) {   a = tr->c; b = tr->a; c = tr->b;
-        } else oops();
-    } else oops();
-
-    Vector aPb = IntersectionWith(a, b);
-    Vector cPa = IntersectionWith(c, a);
-
-    STriangle alone = STriangle::From(tr->meta, a,   aPb, cPa);
-    STriangle quad1 = STriangle::From(tr->meta, aPb, b,   c  );
-    STriangle quad2 = STriangle::From(tr->meta, aPb, c,   cPa);
-
-    if(posc == 2 && negc == 1) {
-        InsertTriangleHow(POS, &quad1, m, bsp3);
-        InsertTriangleHow(POS, &quad2, m, bsp3);
-        InsertTriangleHow(NEG, &alone, m, bsp3);
-    } else {
-        InsertTriangleHow(NEG, &quad1, m, bsp3);
-        InsertTriangleHow(NEG, &quad2, m, bsp3);
-        InsertTriangleHow(POS, &alone, m, bsp3);
-    }
-
-    return;
-}
-
 void SBsp2::DebugDraw(Vector n, double d) {
     if(!this) return;
 
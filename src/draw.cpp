@@ -743,7 +743,11 @@ nogrid:;
     // And the naked edges, if the user did Analyze -> Show Naked Edges.
     ssglLineWidth(Style::Width(Style::DRAW_ERROR));
     ssglColorRGB(Style::Color(Style::DRAW_ERROR));
-    ssglDrawEdges(&(SS.nakedEdges), true);
+    {
+        // A Boolean on the worker thread might be adding to these.
+        std::lock_guard<std::mutex> l(SShell::failedLock);
+        ssglDrawEdges(&(SS.nakedEdges), true);
+    }
 
     // Then redraw whatever the mouse is hovering over, highlighted.
     glDisable(GL_DEPTH_TEST);
@@ -830,5 +834,8 @@ nogrid:;
     if(SS.showToolbar) {
         ToolbarDraw();
     }
+
+    // If the solid model is still being regenerated, then say so.
+    SS.DrawGenerateStatus();
 }
 
@@ -213,6 +213,15 @@ public:
         // and elemsAllocated is untouched, same as in RemoveTagged
     }
 
+    // Set the length of the list; any new elements are uninitialized.
+    void Resize(int newn) {
+        if(newn > elemsAllocated) {
+            elemsAllocated = newn;
+            elem = (T *)MemRealloc(elem, (size_t)elemsAllocated*sizeof(elem[0]));
+        }
+        n = newn;
+    }
+
     void Reverse(void) {
         int i;
         for(i = 0; i < (n/2); i++) {
@@ -397,6 +406,46 @@ public:
     void Solve(void);
 };
 
+// The LDL' factorization of a sparse symmetric positive (semi-)definite
+// matrix. The caller writes the nonzero structure, calls Analyze() once to
+// choose a fill-reducing ordering and the structure of L, and then may
+// call Factor() and Solve() many times as the numerical values change.
+class SparseLdl {
+public:
+    int             n;
+
+    // The matrix, with both triangles stored by columns: the entries of
+    // column j are at Ai[Ap[j]..Ap[j+1]-1] and Ax[Ap[j]..Ap[j+1]-1].
+    List<int>       Ap;
+    List<int>       Ai;
+    List<double>    Ax;
+
+    // Row/column k of the permuted matrix is row/column perm[k] of the
+    // original, and permInv is the inverse.
+    List<int>       perm;
+    List<int>       permInv;
+
+    // The unit lower triangular L (without its diagonal), by columns, and
+    // the diagonal D, both in the permuted order.
+    List<int>       parent;
+    List<int>       Lp;
+    List<int>       Li;
+    List<double>    Lx;
+    List<double>    D;
+
+    // Workspace for Factor()
+    List<int>       Lnz;
+    List<int>       flag;
+    List<int>       pattern;
+    List<double>    y;
+
+    void Analyze(void);
+    int Factor(double zeroTol);
+    void Solve(double *x);
+    void NullVector(int k, double *x);
+    void Clear(void);
+};
+
 #define RGBi(r, g, b) RgbaColor::From((r), (g), (b))
 #define RGBf(r, g, b) RgbaColor::FromFloat((float)(r), (float)(g), (float)(b))
 
@@ -10,6 +10,7 @@
 #include <png.h>
 
 void SolveSpaceUI::ExportSectionTo(const char *filename) {
+    FinishGenerate();
     Vector gn = (SS.GW.projRight).Cross(SS.GW.projUp);
     gn = gn.WithMagnitude(1);
 
@@ -110,6 +111,7 @@ void SolveSpaceUI::ExportSectionTo(const char *filename) {
 }
 
 void SolveSpaceUI::ExportViewOrWireframeTo(const char *filename, bool wireframe) {
+    FinishGenerate();
     int i;
     SEdgeList edges;
     ZERO(&edges);
@@ -217,6 +219,189 @@ void SolveSpaceUI::ExportWireframeCurves(SEdgeList *sel, SBezierList *sbl,
     sblss.Clear();
 }
 
+//-----------------------------------------------------------------------------
+// Hidden line removal. Everything's been projected by now, so x and y are in
+// the export plane and larger z is closer to the viewer. We clip each edge in
+// 2d against the front-facing triangles that might cover it, and where one
+// does, compare the edge's depth (interpolated along it) against the
+// triangle's plane, and hide the part that's behind. What's left is a list
+// of visible spans, as parameters from 0 to 1 along the edge.
+//-----------------------------------------------------------------------------
+typedef struct {
+    double  t0, t1;
+} HlrSpan;
+
+typedef struct {
+    // The front-facing triangles, and their bounding boxes. Each box extends
+    // back to behind everything, since a triangle hides whatever's behind it;
+    // so the boxes that an edge passes through are the triangles that might
+    // hide some of it.
+    SMesh           tris;
+    SBvh            bvh;
+    SEdgeList       *sel;
+    // For each edge, its visible parts
+    List<SEdgeList> out;
+} HlrJob;
+
+// Shrink the interval from t0 to t1 to the part where the linear function,
+// that's ga at 0 and gb at 1, is negative.
+static bool HlrClip(double ga, double gb, double *t0, double *t1) {
+    if(ga >= 0 && gb >= 0) return false;
+    if(ga < 0 && gb < 0) return *t0 < *t1;
+
+    double t = ga/(ga - gb);
+    if(ga < 0) {
+        *t1 = min(*t1, t);
+    } else {
+        *t0 = max(*t0, t);
+    }
+    return *t0 < *t1;
+}
+
+// The part of the edge from a to b that the triangle hides: where it's behind
+// the triangle's plane, and within the triangle in projection. A point on
+// the triangle's boundary counts as hidden.
+static bool HlrHiddenBy(STriangle *tr, Vector a, Vector b,
+                        double *t0, double *t1)
+{
+    *t0 = 0;
+    *t1 = 1;
+
+    Vector tn = tr->Normal().WithMagnitude(1);
+    double td = tn.Dot(tr->a);
+    if(!HlrClip(tn.Dot(a) - td + LENGTH_EPS, tn.Dot(b) - td + LENGTH_EPS,
+                t0, t1))
+    {
+        return false;
+    }
+
+    Point2d v[3] = { (tr->a).ProjectXy(),
+                     (tr->b).ProjectXy(),
+                     (tr->c).ProjectXy() };
+    Point2d ap = a.ProjectXy(), bp = b.ProjectXy();
+    int i;
+    for(i = 0; i < 3; i++) {
+        // Outwards, since the triangle is front-facing and so counter-
+        // clockwise.
+        Point2d p = v[i], q = v[WRAP(i+1, 3)];
+        Point2d n = (q.Minus(p)).Normal().WithMagnitude(1);
+        double d = n.Dot(p);
+        if(!HlrClip(n.Dot(ap) - d - LENGTH_EPS, n.Dot(bp) - d - LENGTH_EPS,
+                    t0, t1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void HlrHide(List<HlrSpan> *vis, double h0, double h1, double eps) {
+    List<HlrSpan> nv;
+    ZERO(&nv);
+    int i;
+    for(i = 0; i < vis->n; i++) {
+        HlrSpan sp = vis->elem[i];
+        if(sp.t1 <= h0 || sp.t0 >= h1) {
+            nv.Add(&sp);
+            continue;
+        }
+        HlrSpan before = { sp.t0, h0 }, after = { h1, sp.t1 };
+        if(before.t1 - before.t0 > eps) nv.Add(&before);
+        if(after.t1 - after.t0 > eps) nv.Add(&after);
+    }
+    vis->Clear();
+    *vis = nv;
+}
+
+static void HlrEdge(void *data, int i) {
+    HlrJob *job = (HlrJob *)data;
+    SEdge *se = &(job->sel->l.elem[i]);
+    SEdgeList *out = &(job->out.elem[i]);
+
+    Vector a = se->a, b = se->b, ab = b.Minus(a);
+    double len = ab.Magnitude();
+    if(se->auxA == Style::CONSTRAINT || len < LENGTH_EPS) {
+        out->AddEdge(a, b, se->auxA);
+        return;
+    }
+
+    List<HlrSpan> vis;
+    ZERO(&vis);
+    HlrSpan all = { 0, 1 };
+    vis.Add(&all);
+
+    List<int> near;
+    ZERO(&near);
+    job->bvh.FindAlongLine(a, b, true, &near);
+    int j;
+    for(j = 0; j < near.n && vis.n > 0; j++) {
+        double h0, h1;
+        if(!HlrHiddenBy(&(job->tris.l.elem[near.elem[j]]), a, b, &h0, &h1)) {
+            continue;
+        }
+        HlrHide(&vis, h0, h1, LENGTH_EPS/len);
+    }
+    near.Clear();
+
+    for(j = 0; j < vis.n; j++) {
+        HlrSpan *sp = &(vis.elem[j]);
+        Vector pa = (sp->t0 == 0) ? a : a.Plus(ab.ScaledBy(sp->t0)),
+               pb = (sp->t1 == 1) ? b : a.Plus(ab.ScaledBy(sp->t1));
+        out->AddEdge(pa, pb, se->auxA);
+    }
+    vis.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Add the visible parts of the edges in sel to hlrd, hidden by the projected
+// mesh smp. The edges are independent, so we do them on many threads.
+// Constraints are always on top, so they're never hidden.
+//-----------------------------------------------------------------------------
+static void RemoveHiddenLines(SEdgeList *sel, SMesh *smp, SEdgeList *hlrd) {
+    HlrJob job;
+    ZERO(&job);
+    job.sel = sel;
+
+    double zmin = VERY_POSITIVE;
+    int i;
+    for(i = 0; i < smp->l.n; i++) {
+        STriangle *tr = &(smp->l.elem[i]);
+        if((tr->Normal().WithMagnitude(1)).z <= LENGTH_EPS) continue;
+        job.tris.AddTriangle(tr);
+        zmin = min(zmin, min((tr->a).z, min((tr->b).z, (tr->c).z)));
+    }
+    for(i = 0; i < sel->l.n; i++) {
+        zmin = min(zmin, min(sel->l.elem[i].a.z, sel->l.elem[i].b.z));
+    }
+    for(i = 0; i < job.tris.l.n; i++) {
+        STriangle *tr = &(job.tris.l.elem[i]);
+        Vector tmax = tr->a, tmin = tr->a;
+        (tr->b).MakeMaxMin(&tmax, &tmin);
+        (tr->c).MakeMaxMin(&tmax, &tmin);
+        tmin.z = zmin - 1;
+        job.bvh.AddBox(tmax, tmin);
+    }
+    job.bvh.Build();
+
+    job.out.Resize(sel->l.n);
+    memset(job.out.elem, 0, sel->l.n*sizeof(job.out.elem[0]));
+    ParallelFor(sel->l.n, HlrEdge, &job);
+
+    for(i = 0; i < sel->l.n; i++) {
+        SEdgeList *out = &(job.out.elem[i]);
+        int j;
+        for(j = 0; j < out->l.n; j++) {
+            SEdge *se = &(out->l.elem[j]);
+            hlrd->AddEdge(se->a, se->b, se->auxA);
+        }
+        out->Clear();
+    }
+
+    job.out.Clear();
+    job.bvh.Clear();
+    job.tris.Clear();
+}
+
 void SolveSpaceUI::ExportLinesAndMesh(SEdgeList *sel, SBezierList *sbl, SMesh *sm,
                                     Vector u, Vector v, Vector n,
                                         Vector origin, double cameraTan,
@@ -319,34 +504,7 @@ void SolveSpaceUI::ExportLinesAndMesh(SEdgeList *sel, SBezierList *sbl, SMesh *s
                         false, NULL, NULL);
         }
 
-        root->ClearTags();
-        int cnt = 1234;
-
-        SEdge *se;
-        for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
-            if(se->auxA == Style::CONSTRAINT) {
-                // Constraints should not get hidden line removed; they're
-                // always on top.
-                hlrd.AddEdge(se->a, se->b, se->auxA);
-                continue;
-            }
-
-            SEdgeList out;
-            ZERO(&out);
-            // Split the original edge against the mesh
-            out.AddEdge(se->a, se->b, se->auxA);
-            root->OcclusionTestLine(*se, &out, cnt);
-            // the occlusion test splits unnecessarily; so fix those
-            out.MergeCollinearSegments(se->a, se->b);
-            cnt++;
-            // And add the results to our output
-            SEdge *sen;
-            for(sen = out.l.First(); sen; sen = out.l.NextAfter(sen)) {
-                hlrd.AddEdge(sen->a, sen->b, sen->auxA);
-            }
-            out.Clear();
-        }
-
+        RemoveHiddenLines(sel, &smp, &hlrd);
         sel = &hlrd;
     }
 
@@ -574,6 +732,7 @@ void VectorFileWriter::BezierAsNonrationalCubic(SBezier *sb, int depth) {
 // Export a triangle mesh, in the requested format.
 //-----------------------------------------------------------------------------
 void SolveSpaceUI::ExportMeshTo(const char *filename) {
+    FinishGenerate();
     SMesh *m = &(SK.GetGroup(SS.GW.activeGroup)->displayMesh);
     if(m->IsEmpty()) {
         Error("Active group mesh is empty; nothing to export.");
@@ -642,34 +801,30 @@ void SolveSpaceUI::ExportMeshAsStlTo(FILE *f, SMesh *sm) {
 // identical vertices to the same identifier, so do that first.
 //-----------------------------------------------------------------------------
 void SolveSpaceUI::ExportMeshAsObjTo(FILE *f, SMesh *sm) {
-    SPointList spl;
-    ZERO(&spl);
-    STriangle *tr;
-    for(tr = sm->l.First(); tr; tr = sm->l.NextAfter(tr)) {
-        spl.IncrementTagFor(tr->a);
-        spl.IncrementTagFor(tr->b);
-        spl.IncrementTagFor(tr->c);
-    }
+    SIndexedMesh im;
+    ZERO(&im);
+    im.MakeFromMesh(sm);
 
     // Output all the vertices.
-    SPoint *sp;
-    for(sp = spl.l.First(); sp; sp = spl.l.NextAfter(sp)) {
+    Vector *p;
+    for(p = im.vertex.First(); p; p = im.vertex.NextAfter(p)) {
         fprintf(f, "v %.10f %.10f %.10f\r\n",
-                        sp->p.x / SS.exportScale,
-                        sp->p.y / SS.exportScale,
-                        sp->p.z / SS.exportScale);
+                        p->x / SS.exportScale,
+                        p->y / SS.exportScale,
+                        p->z / SS.exportScale);
     }
 
     // And now all the triangular faces, in terms of those vertices. The
     // file format counts from 1, not 0.
-    for(tr = sm->l.First(); tr; tr = sm->l.NextAfter(tr)) {
+    SIndexedTriangle *it;
+    for(it = im.tri.First(); it; it = im.tri.NextAfter(it)) {
         fprintf(f, "f %d %d %d\r\n",
-                        spl.IndexForPoint(tr->a) + 1,
-                        spl.IndexForPoint(tr->b) + 1,
-                        spl.IndexForPoint(tr->c) + 1);
+                        (int)it->v[0] + 1,
+                        (int)it->v[1] + 1,
+                        (int)it->v[2] + 1);
     }
 
-    spl.Clear();
+    im.Clear();
 }
 
 //-----------------------------------------------------------------------------
@@ -678,8 +833,8 @@ void SolveSpaceUI::ExportMeshAsObjTo(FILE *f, SMesh *sm) {
 void SolveSpaceUI::ExportMeshAsThreeJsTo(FILE *f, const char * filename, SMesh *sm,
                                          SEdgeList *sel)
 {
-    SPointList spl;
-    ZERO(&spl);
+    SIndexedMesh im;
+    ZERO(&im);
     STriangle *tr;
     SEdge *e;
     Vector bndl, bndh;
@@ -945,32 +1100,29 @@ void SolveSpaceUI::ExportMeshAsThreeJsTo(FILE *f, const char * filename, SMesh *
     fprintf(f, "    ],\n"
                "    a: %f\n", SS.ambientIntensity);
 
-    for(tr = sm->l.First(); tr; tr = sm->l.NextAfter(tr)) {
-        spl.IncrementTagFor(tr->a);
-        spl.IncrementTagFor(tr->b);
-        spl.IncrementTagFor(tr->c);
-    }
+    im.MakeFromMesh(sm);
 
     // Output all the vertices.
-    SPoint *sp;
+    Vector *p;
     fputs("  },\n"
           "  points: [\n", f);
-    for(sp = spl.l.First(); sp; sp = spl.l.NextAfter(sp)) {
+    for(p = im.vertex.First(); p; p = im.vertex.NextAfter(p)) {
         fprintf(f, "    [%f, %f, %f],\n",
-                        sp->p.x / SS.exportScale,
-                        sp->p.y / SS.exportScale,
-                        sp->p.z / SS.exportScale);
+                        p->x / SS.exportScale,
+                        p->y / SS.exportScale,
+                        p->z / SS.exportScale);
     }
 
     fputs("  ],\n"
           "  faces: [\n", f);
     // And now all the triangular faces, in terms of those vertices.
     // This time we count from zero.
-    for(tr = sm->l.First(); tr; tr = sm->l.NextAfter(tr)) {
+    SIndexedTriangle *it;
+    for(it = im.tri.First(); it; it = im.tri.NextAfter(it)) {
         fprintf(f, "    [%d, %d, %d],\n",
-                    spl.IndexForPoint(tr->a),
-                    spl.IndexForPoint(tr->b),
-                    spl.IndexForPoint(tr->c));
+                    (int)it->v[0],
+                    (int)it->v[1],
+                    (int)it->v[2]);
     }
 
     fputs("  ],\n"
@@ -1005,7 +1157,7 @@ void SolveSpaceUI::ExportMeshAsThreeJsTo(FILE *f, const char * filename, SMesh *
     }
 
     fputs("  ]\n};\n", f);
-    spl.Clear();
+    im.Clear();
 }
 
 //-----------------------------------------------------------------------------
@@ -1013,6 +1165,7 @@ void SolveSpaceUI::ExportMeshAsThreeJsTo(FILE *f, const char * filename, SMesh *
 // rendering the view in the usual way and then copying the pixels.
 //-----------------------------------------------------------------------------
 void SolveSpaceUI::ExportAsPngTo(const char *filename) {
+    FinishGenerate();
     int w = (int)SS.GW.width, h = (int)SS.GW.height;
     // No guarantee that the back buffer contains anything valid right now,
     // so repaint the scene. And hide the toolbar too.
@@ -297,6 +297,7 @@ void StepFileWriter::WriteFooter(void) {
 }
 
 void StepFileWriter::ExportSurfacesTo(char *file) {
+    SS.FinishGenerate();
     Group *g = SK.GetGroup(SS.GW.activeGroup);
     SShell *shell = &(g->runningShell);
 
@@ -220,7 +220,7 @@ Expr *Expr::From(hParam p) {
 
 Expr *Expr::From(double v) {
     // Statically allocate common constants.
-    // Note: this is only valid because AllocExpr() uses AllocTemporary(),
+    // Note: this is only valid because AllocExpr() uses the temporary heap,
     // and Expr* is never explicitly freed.
 
     if(v == 0.0) {
@@ -412,6 +412,21 @@ uint64_t Expr::ParamsUsed(void) {
     return r;
 }
 
+void Expr::ParamsUsedList(List<hParam> *list) {
+    if(op == PARAM || op == PARAM_PTR) {
+        hParam hp = (op == PARAM) ? x.parh : x.parp->h;
+        for(int i = 0; i < list->n; i++) {
+            if(list->elem[i].v == hp.v) return;
+        }
+        list->Add(&hp);
+        return;
+    }
+
+    int c = Children();
+    if(c >= 1)          a->ParamsUsedList(list);
+    if(c >= 2)          b->ParamsUsedList(list);
+}
+
 bool Expr::DependsOn(hParam p) {
     if(op == PARAM)     return (x.parh.v    == p.v);
     if(op == PARAM_PTR) return (x.parp->h.v == p.v);
@@ -493,15 +508,22 @@ Expr *Expr::FoldConstants(void) {
     return n;
 }
 
-void Expr::Substitute(hParam oldh, hParam newh) {
+//-----------------------------------------------------------------------------
+// Replace every param that's been solved by substitution with the param that
+// replaced it.
+//-----------------------------------------------------------------------------
+void Expr::Substitute(ParamList *pl) {
     if(op == PARAM_PTR) oops();
 
-    if(op == PARAM && x.parh.v == oldh.v) {
-        x.parh = newh;
+    if(op == PARAM) {
+        Param *p = pl->FindByIdNoOops(x.parh);
+        if(p && p->tag == System::VAR_SUBSTITUTED) {
+            x.parh = p->substd;
+        }
     }
     int c = Children();
-    if(c >= 1) a->Substitute(oldh, newh);
-    if(c >= 2) b->Substitute(oldh, newh);
+    if(c >= 1) a->Substitute(pl);
+    if(c >= 2) b->Substitute(pl);
 }
 
 //-----------------------------------------------------------------------------
@@ -543,6 +565,274 @@ hParam Expr::ReferencedParams(ParamList *pl) {
 }
 
 
+//-----------------------------------------------------------------------------
+// Compile expressions to a tape of instructions. Each node of the tree turns
+// into one instruction, unless an identical instruction (same op, on the
+// same operand registers) is already on the tape, in which case we reuse
+// that one's register; so, working from the leaves up, any repeated
+// subexpression gets found.
+//-----------------------------------------------------------------------------
+uint32_t ExprTape::HashInstr(Instr *in) {
+    uint32_t h = (uint32_t)in->op;
+    switch(in->op) {
+        case Expr::PARAM:
+            h = h*31 + in->x.parh.v;
+            break;
+
+        case Expr::PARAM_PTR: {
+            uint64_t u = (uint64_t)(uintptr_t)in->x.parp;
+            h = h*31 + (uint32_t)(u ^ (u >> 32));
+            break;
+        }
+        case Expr::CONSTANT: {
+            uint64_t u;
+            memcpy(&u, &(in->x.v), sizeof(u));
+            h = h*31 + (uint32_t)(u ^ (u >> 32));
+            break;
+        }
+        default:
+            h = h*31 + (uint32_t)in->a;
+            h = h*31 + (uint32_t)in->b;
+            break;
+    }
+    return h*2654435761u;
+}
+
+bool ExprTape::SameInstr(Instr *p, Instr *q) {
+    if(p->op != q->op) return false;
+    switch(p->op) {
+        case Expr::PARAM:       return p->x.parh.v == q->x.parh.v;
+        case Expr::PARAM_PTR:   return p->x.parp == q->x.parp;
+        case Expr::CONSTANT:    return memcmp(&(p->x.v), &(q->x.v),
+                                              sizeof(p->x.v)) == 0;
+        default:                return p->a == q->a && p->b == q->b;
+    }
+}
+
+int ExprTape::Intern(Instr *in) {
+    if(instr.n >= hashHead.n/2) {
+        // Grow the table, and rebuild the chains.
+        int i, size = max(64, hashHead.n*2);
+        hashHead.Resize(size);
+        for(i = 0; i < size; i++) {
+            hashHead.elem[i] = -1;
+        }
+        for(i = 0; i < instr.n; i++) {
+            int *head = &(hashHead.elem[HashInstr(&(instr.elem[i])) & (size-1)]);
+            hashNext.elem[i] = *head;
+            *head = i;
+        }
+    }
+
+    int *head = &(hashHead.elem[HashInstr(in) & (hashHead.n-1)]);
+    int i;
+    for(i = *head; i >= 0; i = hashNext.elem[i]) {
+        if(SameInstr(&(instr.elem[i]), in)) return i;
+    }
+
+    i = instr.n;
+    instr.Add(in);
+    hashNext.Add(head);
+    *head = i;
+
+    // Constants get written once, now, and Eval() never touches them.
+    double v = (in->op == Expr::CONSTANT) ? in->x.v : 0;
+    reg.Add(&v);
+    return i;
+}
+
+int ExprTape::Add(Expr *e) {
+    Instr in;
+    memset(&in, 0, sizeof(in));
+    in.op = e->op;
+    switch(e->op) {
+        case Expr::PARAM:       in.x.parh = e->x.parh; break;
+        case Expr::PARAM_PTR:   in.x.parp = e->x.parp; break;
+        case Expr::CONSTANT:    in.x.v = e->x.v; break;
+
+        case Expr::PLUS:
+        case Expr::TIMES:
+            in.a = Add(e->a);
+            in.b = Add(e->b);
+            // These commute, so put the operands in a canonical order to
+            // find more common subexpressions; the result is bit-for-bit
+            // the same either way.
+            if(in.a > in.b) swap(in.a, in.b);
+            break;
+
+        case Expr::MINUS:
+        case Expr::DIV:
+            in.a = Add(e->a);
+            in.b = Add(e->b);
+            break;
+
+        case Expr::NEGATE:
+        case Expr::SQRT:
+        case Expr::SQUARE:
+        case Expr::SIN:
+        case Expr::COS:
+        case Expr::ASIN:
+        case Expr::ACOS:
+            in.a = Add(e->a);
+            break;
+
+        default: oops();
+    }
+    return Intern(&in);
+}
+
+int ExprTape::AddRoot(Expr *e) {
+    int r = Add(e), i = root.n;
+    root.Add(&r);
+
+    // Find everything that this root depends on, by a search from the root.
+    // The operands of an instruction always come before it on the tape, so
+    // sorting those by position gives the order for the reverse sweep.
+    if(depStart.n == 0) depStart.Add(&(dep.n));
+    int n = instr.n, start = dep.n;
+    if(mark.n < n) {
+        int k = mark.n;
+        mark.Resize(n);
+        adj.Resize(n);
+        for(; k < n; k++) {
+            mark.elem[k] = -1;
+            adj.elem[k] = 0;
+        }
+    }
+    mark.elem[r] = i;
+    dep.Add(&r);
+    int next;
+    for(next = start; next < dep.n; next++) {
+        Instr *in = &(instr.elem[dep.elem[next]]);
+        int c;
+        switch(in->op) {
+            case Expr::PARAM:
+            case Expr::PARAM_PTR:
+            case Expr::CONSTANT:
+                c = 0;
+                break;
+
+            case Expr::PLUS:
+            case Expr::MINUS:
+            case Expr::TIMES:
+            case Expr::DIV:
+                c = 2;
+                break;
+
+            default:
+                c = 1;
+                break;
+        }
+        if(c >= 1 && mark.elem[in->a] != i) {
+            mark.elem[in->a] = i;
+            dep.Add(&(in->a));
+        }
+        if(c >= 2 && mark.elem[in->b] != i) {
+            mark.elem[in->b] = i;
+            dep.Add(&(in->b));
+        }
+    }
+    std::sort(dep.elem + start, dep.elem + dep.n);
+    depStart.Add(&(dep.n));
+    return i;
+}
+
+//-----------------------------------------------------------------------------
+// Reverse-mode differentiation of root i, at the point of the last Eval():
+// sweep its instructions from the root down to the leaves, accumulating the
+// partial of the root with respect to each register in adj[]. So a single
+// pass gives the partials with respect to every parameter used.
+//-----------------------------------------------------------------------------
+void ExprTape::Gradient(int i) {
+    double *r = reg.elem, *g = adj.elem;
+    int *d = &(dep.elem[depStart.elem[i]]),
+        *end = &(dep.elem[depStart.elem[i+1]]), *p;
+
+    for(p = d; p < end; p++) {
+        g[*p] = 0;
+    }
+    g[root.elem[i]] = 1;
+
+    for(p = end - 1; p >= d; p--) {
+        int j = *p;
+        Instr *in = &(instr.elem[j]);
+        double gj = g[j], ra;
+        switch(in->op) {
+            case Expr::PARAM:
+            case Expr::PARAM_PTR:
+            case Expr::CONSTANT:
+                break;
+
+            case Expr::PLUS:    g[in->a] += gj; g[in->b] += gj; break;
+            case Expr::MINUS:   g[in->a] += gj; g[in->b] -= gj; break;
+            case Expr::TIMES:
+                g[in->a] += gj*r[in->b];
+                g[in->b] += gj*r[in->a];
+                break;
+            case Expr::DIV:
+                g[in->a] += gj/r[in->b];
+                g[in->b] -= gj*r[in->a]/(r[in->b]*r[in->b]);
+                break;
+
+            case Expr::NEGATE:  g[in->a] -= gj; break;
+            case Expr::SQRT:    g[in->a] += gj*0.5/r[j]; break;
+            case Expr::SQUARE:  g[in->a] += gj*2*r[in->a]; break;
+            case Expr::SIN:     g[in->a] += gj*cos(r[in->a]); break;
+            case Expr::COS:     g[in->a] -= gj*sin(r[in->a]); break;
+            case Expr::ASIN:
+                ra = r[in->a];
+                g[in->a] += gj/sqrt(1 - ra*ra);
+                break;
+            case Expr::ACOS:
+                ra = r[in->a];
+                g[in->a] -= gj/sqrt(1 - ra*ra);
+                break;
+
+            default: oops();
+        }
+    }
+}
+
+void ExprTape::Eval(void) {
+    Instr *in = instr.elem;
+    double *r = reg.elem;
+    int i;
+    for(i = 0; i < instr.n; i++, in++) {
+        switch(in->op) {
+            case Expr::PARAM:       r[i] = SK.GetParam(in->x.parh)->val; break;
+            case Expr::PARAM_PTR:   r[i] = (in->x.parp)->val; break;
+            case Expr::CONSTANT:    break;
+
+            case Expr::PLUS:        r[i] = r[in->a] + r[in->b]; break;
+            case Expr::MINUS:       r[i] = r[in->a] - r[in->b]; break;
+            case Expr::TIMES:       r[i] = r[in->a] * r[in->b]; break;
+            case Expr::DIV:         r[i] = r[in->a] / r[in->b]; break;
+
+            case Expr::NEGATE:      r[i] = -r[in->a]; break;
+            case Expr::SQRT:        r[i] = sqrt(r[in->a]); break;
+            case Expr::SQUARE:      r[i] = r[in->a]*r[in->a]; break;
+            case Expr::SIN:         r[i] = sin(r[in->a]); break;
+            case Expr::COS:         r[i] = cos(r[in->a]); break;
+            case Expr::ACOS:        r[i] = acos(r[in->a]); break;
+            case Expr::ASIN:        r[i] = asin(r[in->a]); break;
+
+            default: oops();
+        }
+    }
+}
+
+void ExprTape::Clear(void) {
+    instr.Clear();
+    reg.Clear();
+    hashHead.Clear();
+    hashNext.Clear();
+    root.Clear();
+    depStart.Clear();
+    dep.Clear();
+    mark.Clear();
+    adj.Clear();
+}
+
 //-----------------------------------------------------------------------------
 // Routines to pretty-print an expression. Mostly for debugging.
 //-----------------------------------------------------------------------------
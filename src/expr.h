@@ -67,7 +67,7 @@ public:
     Expr(double v) : op(CONSTANT) { x.v = v; }
     
     static inline Expr *AllocExpr(void)
-        { return (Expr *)AllocTemporary(sizeof(Expr)); }
+        { return (Expr *)AllocTemporaryNode(sizeof(Expr)); }
 
     static Expr *From(hParam p);
     static Expr *From(double v);
@@ -89,10 +89,11 @@ public:
     Expr *PartialWrt(hParam p);
     double Eval(void);
     uint64_t ParamsUsed(void);
+    void ParamsUsedList(List<hParam> *list);
     bool DependsOn(hParam p);
     static bool Tol(double a, double b);
     Expr *FoldConstants(void);
-    void Substitute(hParam oldh, hParam newh);
+    void Substitute(ParamList *pl);
 
     static const hParam NO_PARAMS, MULTIPLE_PARAMS;
     hParam ReferencedParams(ParamList *pl);
@@ -135,6 +136,61 @@ public:
     static void Parse(void);
 };
 
+//-----------------------------------------------------------------------------
+// A set of expressions, compiled to a flat list of instructions so that they
+// can be evaluated over and over without walking the trees. A subexpression
+// that appears more than once (in one expression or across several) gets
+// computed only once.
+//-----------------------------------------------------------------------------
+class ExprTape {
+public:
+    typedef struct {
+        int     op;
+        // The registers that hold the operands, for PLUS through ACOS
+        int     a;
+        int     b;
+        union {
+            double  v;
+            hParam  parh;
+            Param  *parp;
+        }       x;
+    } Instr;
+
+    // Instruction i writes its result to reg[i], and reads only registers
+    // that are written before that.
+    List<Instr>     instr;
+    List<double>    reg;
+
+    // A hash table of the instructions, to find the common subexpressions
+    List<int>       hashHead;
+    List<int>       hashNext;
+
+    // The expressions that we'll differentiate. Root i is in register
+    // root[i], and depends on the instructions dep[depStart[i]] through
+    // dep[depStart[i+1]-1], in increasing order.
+    List<int>       root;
+    List<int>       depStart;
+    List<int>       dep;
+    List<int>       mark;
+    // After Gradient(i), the partial of root i with respect to each of
+    // those registers.
+    List<double>    adj;
+
+    // Returns the register that will hold the value of e.
+    int Add(Expr *e);
+    // Returns the index of the new root.
+    int AddRoot(Expr *e);
+    void Eval(void);
+    void Gradient(int i);
+    inline double Value(int r) { return reg.elem[r]; }
+    inline double RootValue(int i) { return reg.elem[root.elem[i]]; }
+    void Clear(void);
+
+    static uint32_t HashInstr(Instr *in);
+    static bool SameInstr(Instr *p, Instr *q);
+    int Intern(Instr *in);
+};
+
 class ExprVector {
 public:
     Expr *x, *y, *z;
@@ -17,6 +17,7 @@ static int StrStartsWith(const char *str, const char *start) {
 // references created, and so on), so anyone calling this must fix that later.
 //-----------------------------------------------------------------------------
 void SolveSpaceUI::ClearExisting(void) {
+    CancelGenerate();
     UndoClearStack(&redo);
     UndoClearStack(&undo);
 
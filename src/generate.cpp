@@ -7,6 +7,8 @@
 // Copyright 2008-2013 Jonathan Westhues.
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
+#include <thread>
+#include <condition_variable>
 
 void SolveSpaceUI::MarkGroupDirtyByEntity(hEntity he) {
     Entity *e = SK.GetEntity(he);
@@ -14,18 +16,125 @@ void SolveSpaceUI::MarkGroupDirtyByEntity(hEntity he) {
 }
 
 void SolveSpaceUI::MarkGroupDirty(hGroup hg) {
+    // Only this group; anything that depends on it gets marked dirty too
+    // when we regenerate, by MarkDependentGroupsDirty().
+    Group *g = SK.group.FindByIdNoOops(hg);
+    if(g) g->clean = false;
+    unsaved = true;
+}
+
+//-----------------------------------------------------------------------------
+// A group depends on the earlier groups that it uses as operands or that
+// define its workplane, and on the groups of any entities that its requests
+// and constraints refer to. Those edges always point back to an earlier
+// group, so they form a DAG that we can walk in group order.
+//-----------------------------------------------------------------------------
+typedef struct {
+    int     from;   // order of the group depended upon, or -1 if unknown
+    int     to;     // order of the dependent group
+} GroupDependency;
+
+static bool DependencyBefore(const GroupDependency &a,
+                             const GroupDependency &b)
+{
+    if(a.to != b.to) return a.to < b.to;
+    return a.from < b.from;
+}
+
+static void AddDependency(List<GroupDependency> *l, Group *g, hGroup hg) {
+    if(hg.v == 0 || hg.v == g->h.v) return;
+
+    GroupDependency gd;
+    gd.to = g->order;
+    Group *dg = SK.group.FindByIdNoOops(hg);
+    if(dg && dg->order < g->order) {
+        gd.from = dg->order;
+    } else {
+        // Not a valid dependency, so this will get pruned; but until then
+        // be conservative and assume that it's dirty.
+        gd.from = -1;
+    }
+    l->Add(&gd);
+}
+
+static void AddDependency(List<GroupDependency> *l, Group *g, hEntity he) {
+    if(he.v == Entity::NO_ENTITY.v) return;
+
+    hGroup hg;
+    if(he.isFromRequest()) {
+        Request *r = SK.request.FindByIdNoOops(he.request());
+        if(!r) {
+            GroupDependency gd = { -1, g->order };
+            l->Add(&gd);
+            return;
+        }
+        hg = r->group;
+    } else {
+        hg = he.group();
+    }
+    AddDependency(l, g, hg);
+}
+
+void SolveSpaceUI::MarkDependentGroupsDirty(void) {
     int i;
-    bool go = false;
+    List<GroupDependency> dep;
+    ZERO(&dep);
+
     for(i = 0; i < SK.group.n; i++) {
         Group *g = &(SK.group.elem[i]);
-        if(g->h.v == hg.v) {
-            go = true;
+        AddDependency(&dep, g, g->opA);
+        AddDependency(&dep, g, g->opB);
+        AddDependency(&dep, g, g->predef.origin);
+        AddDependency(&dep, g, g->predef.entityB);
+        AddDependency(&dep, g, g->predef.entityC);
+    }
+    for(i = 0; i < SK.request.n; i++) {
+        Request *r = &(SK.request.elem[i]);
+        Group *g = SK.group.FindByIdNoOops(r->group);
+        if(!g) continue;
+        AddDependency(&dep, g, r->workplane);
+    }
+    for(i = 0; i < SK.constraint.n; i++) {
+        Constraint *c = &(SK.constraint.elem[i]);
+        Group *g = SK.group.FindByIdNoOops(c->group);
+        if(!g) continue;
+        AddDependency(&dep, g, c->workplane);
+        AddDependency(&dep, g, c->ptA);
+        AddDependency(&dep, g, c->ptB);
+        AddDependency(&dep, g, c->entityA);
+        AddDependency(&dep, g, c->entityB);
+        AddDependency(&dep, g, c->entityC);
+        AddDependency(&dep, g, c->entityD);
+    }
+    std::sort(dep.elem, dep.elem + dep.n, DependencyBefore);
+
+    // Now walk the groups in order. A group must be solved again if it's
+    // dirty itself, or if anything it depends on is; and its mesh must be
+    // regenerated if it was solved, or if the running mesh that it merges
+    // into changed.
+    int j = 0;
+    for(i = 0; i < SK.group.n; i++) {
+        Group *g = &(SK.group.elem[i]);
+        for(; j < dep.n && dep.elem[j].to == i; j++) {
+            int from = dep.elem[j].from;
+            if(from < 0) {
+                g->clean = false;
+                continue;
+            }
+            Group *dg = &(SK.group.elem[from]);
+            if(!dg->clean || dg->solved.how != System::SOLVED_OKAY) {
+                g->clean = false;
+            }
         }
-        if(go) {
-            g->clean = false;
+
+        if(!g->clean) {
+            g->cleanMesh = false;
+        } else {
+            Group *pg = g->RunningMeshGroup();
+            if(pg && !pg->cleanMesh) g->cleanMesh = false;
         }
     }
-    unsaved = true;
+    dep.Clear();
 }
 
 bool SolveSpaceUI::PruneOrphans(void) {
@@ -141,43 +250,458 @@ bool SolveSpaceUI::PruneConstraints(hGroup hg) {
     return false;
 }
 
+//-----------------------------------------------------------------------------
+// The Booleans are the slow part of regenerating, so when we're interactive
+// they run on a worker thread, one group after another, with their own copies
+// of everything. We pick up each group's result as soon as it's done, so the
+// model appears progressively; and if the user changes something before
+// we're finished, then the rest gets abandoned, and the worker moves on to
+// the new batch as soon as its current Boolean is done.
+//-----------------------------------------------------------------------------
+class BooleanWorker {
+public:
+    std::mutex              lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+
+    // The batch that's waiting to start, and the batch that the worker is
+    // on (or has finished, until we've taken all of its results).
+    List<BooleanJob>        queued;
+    List<BooleanJob>        job;
+    bool                    running;
+    bool                    cancelled;
+    int                     done;
+    int                     published;
+
+    static void ClearJobs(List<BooleanJob> *l) {
+        int i;
+        for(i = 0; i < l->n; i++) {
+            l->elem[i].Clear();
+        }
+        l->Clear();
+    }
+
+    void Worker(void) {
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> l(lock);
+                while(queued.n == 0) wake.wait(l);
+                ClearJobs(&job);
+                job = queued;
+                ZERO(&queued);
+                running = true;
+                cancelled = false;
+                done = 0;
+                published = 0;
+            }
+            // The batch is ours now; nothing else touches the jobs that
+            // aren't done yet, or writes to the ones that are.
+            int i;
+            for(i = 0; i < job.n; i++) {
+                {
+                    std::unique_lock<std::mutex> l(lock);
+                    if(cancelled) break;
+                }
+                BooleanJob *bj = &(job.elem[i]);
+                if(bj->prev >= 0) {
+                    BooleanJob *pj = &(job.elem[bj->prev]);
+                    bj->Run(&(pj->runningShell), &(pj->runningMesh),
+                            &(bj->thisShell), &(bj->thisMesh));
+                } else {
+                    bj->Run(&(bj->prevShell), &(bj->prevMesh),
+                            &(bj->thisShell), &(bj->thisMesh));
+                }
+                FreeAllTemporary();
+                {
+                    std::unique_lock<std::mutex> l(lock);
+                    done = i + 1;
+                }
+            }
+            {
+                std::unique_lock<std::mutex> l(lock);
+                running = false;
+            }
+            idle.notify_all();
+        }
+    }
+
+    // Is this group's mesh already being regenerated?
+    bool Covers(hGroup hg) {
+        std::unique_lock<std::mutex> l(lock);
+        if(cancelled || (!running && queued.n == 0)) return false;
+        List<BooleanJob> *l2 = (queued.n > 0) ? &queued : &job;
+        int i;
+        for(i = 0; i < l2->n; i++) {
+            if(l2->elem[i].h.v == hg.v) return true;
+        }
+        return false;
+    }
+};
+static BooleanWorker *Worker = NULL;
+
+// If the Booleans take more than this long, then we return to the user, and
+// pick up the results from a timer instead.
+static const int GENERATE_WAIT_MS = 100;
+static const int GENERATE_POLL_MS = 50;
+
+static void StartGenerate(List<BooleanJob> *jobs) {
+    if(!Worker) {
+        Worker = new BooleanWorker;
+        ZERO(&(Worker->queued));
+        ZERO(&(Worker->job));
+        Worker->running = false;
+        Worker->cancelled = false;
+        Worker->done = 0;
+        Worker->published = 0;
+        std::thread(&BooleanWorker::Worker, Worker).detach();
+    }
+    {
+        std::unique_lock<std::mutex> l(Worker->lock);
+        BooleanWorker::ClearJobs(&(Worker->queued));
+        Worker->queued = *jobs;
+        ZERO(jobs);
+    }
+    Worker->wake.notify_one();
+}
+
+static bool WaitForGenerate(int64_t timeoutMs) {
+    if(!Worker) return true;
+
+    std::chrono::steady_clock::time_point until =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::unique_lock<std::mutex> l(Worker->lock);
+    while(Worker->running || Worker->queued.n > 0) {
+        if(timeoutMs < 0) {
+            Worker->idle.wait(l);
+        } else if(Worker->idle.wait_until(l, until) ==
+                  std::cv_status::timeout)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SolveSpaceUI::PublishGenerated(void) {
+    if(!Worker) return;
+
+    int from, to;
+    {
+        std::unique_lock<std::mutex> l(Worker->lock);
+        if(Worker->queued.n > 0) {
+            // Still finishing up a batch that we abandoned; so nothing
+            // to take yet, but check again soon.
+            SetTimerFor(GENERATE_POLL_MS);
+            return;
+        }
+        if(Worker->cancelled) return;
+        from = Worker->published;
+        to = Worker->done;
+    }
+
+    // Those jobs are finished, so the worker won't write to them again.
+    int i;
+    for(i = from; i < to; i++) {
+        BooleanJob *bj = &(Worker->job.elem[i]);
+        Group *g = SK.group.FindByIdNoOops(bj->h);
+        if(!g) continue;
+
+        g->TakeBooleanResult(bj, true);
+        g->cleanMesh = true;
+    }
+    if(to > from) {
+        InvalidateGraphics();
+        ScheduleShowTW();
+    }
+
+    bool finished;
+    {
+        std::unique_lock<std::mutex> l(Worker->lock);
+        Worker->published = to;
+        finished = (!Worker->running && to == Worker->job.n);
+        if(finished) BooleanWorker::ClearJobs(&(Worker->job));
+    }
+    if(!finished) SetTimerFor(GENERATE_POLL_MS);
+}
+
+void SolveSpaceUI::CancelGenerate(void) {
+    if(!Worker) return;
+
+    std::unique_lock<std::mutex> l(Worker->lock);
+    BooleanWorker::ClearJobs(&(Worker->queued));
+    Worker->cancelled = true;
+}
+
+void SolveSpaceUI::FinishGenerate(void) {
+    WaitForGenerate(-1);
+    PublishGenerated();
+
+    // The display items are usually made when we paint, but whoever wanted
+    // the finished model might want those too.
+    Group *g = SK.group.FindByIdNoOops(GW.activeGroup);
+    if(g) g->GenerateDisplayItems();
+}
+
+static void DrawStatusMessage(const char *msg) {
+    int w, h;
+    GetGraphicsWindowSize(&w, &h);
+    glViewport(0, 0, w, h);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glTranslated(-1, 1, 0);
+    glScaled(2.0/w, 2.0/h, 1.0);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+
+    double left = 80, top = -20, width = 240, height = 24;
+    glColor3d(0.9, 0.8, 0.8);
+    ssglAxisAlignedQuad(left, left+width, top, top-height);
+    ssglLineWidth(1);
+    glColor3d(0.0, 0.0, 0.0);
+    ssglAxisAlignedLineLoop(left, left+width, top, top-height);
+
+    ssglCreateBitmapFont();
+    glColor3d(0, 0, 0);
+    glPushMatrix();
+        glTranslated(left+8, top-20, 0);
+        glScaled(1, -1, 1);
+        ssglBitmapText(msg, Vector::From(0, 0, 0));
+    glPopMatrix();
+}
+
+void SolveSpaceUI::DrawGenerateStatus(void) {
+    if(!Worker) return;
+
+    int done, n;
+    {
+        std::unique_lock<std::mutex> l(Worker->lock);
+        if(Worker->cancelled || !Worker->running) return;
+        done = Worker->done;
+        n = Worker->job.n;
+    }
+    char msg[1024];
+    sprintf(msg, "generating solid model %d/%d", min(done + 1, n), n);
+    DrawStatusMessage(msg);
+}
+
 void SolveSpaceUI::GenerateAll(void) {
     int i;
     int firstDirty = INT_MAX, lastVisible = 0;
-    // Start from the first dirty group, and solve until the active group,
-    // since all groups after the active group are hidden.
     for(i = 0; i < SK.group.n; i++) {
         Group *g = &(SK.group.elem[i]);
         g->order = i;
-        if((!g->clean) || (g->solved.how != System::SOLVED_OKAY)) {
-            firstDirty = min(firstDirty, i);
-        }
         if(g->h.v == SS.GW.activeGroup.v) {
             lastVisible = i;
         }
     }
+    // Keep whatever the worker thread has finished since we last looked.
+    PublishGenerated();
+    MarkDependentGroupsDirty();
+    // Start from the first dirty group, and regenerate until the active
+    // group, since all groups after the active group are hidden. Within
+    // that range, only the dirty groups get solved.
+    bool needSolve = false, needMesh = false;
+    for(i = 0; i < SK.group.n; i++) {
+        Group *g = &(SK.group.elem[i]);
+        if((!g->clean) || (g->solved.how != System::SOLVED_OKAY)) {
+            firstDirty = min(firstDirty, i);
+            needSolve = true;
+        } else if(!g->cleanMesh) {
+            firstDirty = min(firstDirty, i);
+            if(i <= lastVisible && !(Worker && Worker->Covers(g->h))) {
+                needMesh = true;
+            }
+        }
+    }
     if(firstDirty == INT_MAX || lastVisible == 0) {
-        // All clean; so just regenerate the entities, and don't solve anything.
-        GenerateAll(-1, -1);
+        // All clean; so don't solve anything, and keep the entities of
+        // every group that's solved.
+        GenerateAll(-1, -1, false, true);
+    } else if(!needSolve && !needMesh) {
+        // Nothing's changed, but the worker thread's still busy with the
+        // Booleans from last time; so let it finish.
+        GenerateAll(-1, -1, false, true);
     } else {
-        SS.nakedEdges.Clear();
-        GenerateAll(firstDirty, lastVisible);
+        CancelGenerate();
+        {
+            std::lock_guard<std::mutex> l(SShell::failedLock);
+            SS.nakedEdges.Clear();
+        }
+        GenerateAll(firstDirty, lastVisible, false, true);
     }
 }
 
-void SolveSpaceUI::GenerateAll(int first, int last, bool andFindFree) {
+//-----------------------------------------------------------------------------
+// The params generated by a group all have handles within the range for one
+// of its requests, or for the group itself; and the param lists are sorted
+// by handle. So we can find the previous values for just that group's params
+// by walking the two lists together, without a search for each param.
+//-----------------------------------------------------------------------------
+static int FirstParamFrom(IdList<Param,hParam> *l, uint64_t v) {
+    int first = 0, last = l->n;
+    while(first < last) {
+        int mid = (first + last)/2;
+        if((uint64_t)l->elem[mid].h.v < v) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    return first;
+}
+
+static void UsePreviousParams(IdList<Param,hParam> *prev,
+                              uint64_t from, uint64_t to, bool markKnown)
+{
+    int i = FirstParamFrom(&(SK.param), from),
+        j = FirstParamFrom(prev, from);
+    for(; i < SK.param.n && (uint64_t)SK.param.elem[i].h.v < to; i++) {
+        Param *newp = &(SK.param.elem[i]);
+        while(j < prev->n && prev->elem[j].h.v < newp->h.v) j++;
+        if(j >= prev->n) break;
+
+        Param *prevp = &(prev->elem[j]);
+        if(prevp->h.v != newp->h.v) continue;
+
+        if(markKnown) {
+            newp->known = true;
+        } else if(!newp->known) {
+            newp->val = prevp->val;
+        }
+    }
+}
+
+static void UsePreviousParams(Group *g, IdList<Param,hParam> *prev,
+                              bool markKnown)
+{
+    int i;
+    for(i = 0; i < SK.request.n; i++) {
+        Request *r = &(SK.request.elem[i]);
+        if(r->group.v != g->h.v) continue;
+
+        uint64_t from = (uint64_t)r->h.param(0).v;
+        UsePreviousParams(prev, from, from + 0x10000, markKnown);
+    }
+    uint64_t from = (uint64_t)g->h.param(0).v;
+    UsePreviousParams(prev, from, from + 0x10000, markKnown);
+}
+
+//-----------------------------------------------------------------------------
+// When we regenerate only what changed, a group that's clean and solved keeps
+// its entities and params where they are, instead of generating them again;
+// nothing that they were made from has changed.
+//-----------------------------------------------------------------------------
+static bool KeepGroup(hGroup hg, bool dirtyOnly) {
+    if(!dirtyOnly) return false;
+    Group *g = SK.group.FindByIdNoOops(hg);
+    return g && g->clean && g->solved.how == System::SOLVED_OKAY;
+}
+
+static bool KeepParam(hParam hp, bool dirtyOnly) {
+    if(!hp.isFromRequest()) return KeepGroup(hp.group(), dirtyOnly);
+    Request *r = SK.request.FindByIdNoOops(hp.request());
+    return r && KeepGroup(r->group, dirtyOnly);
+}
+
+static void KeepCleanGroups(IdList<Param,hParam> *prev, bool dirtyOnly) {
+    if(!dirtyOnly) {
+        SK.param.MoveSelfInto(prev);
+        SK.entity.Clear();
+        return;
+    }
+
+    int i;
+    for(i = 0; i < SK.entity.n; i++) {
+        Entity *e = &(SK.entity.elem[i]);
+        e->tag = KeepGroup(e->group, dirtyOnly) ? 0 : 1;
+    }
+    SK.entity.RemoveTagged();
+
+    // The params that we don't keep become the numerical guesses for the
+    // ones that get generated again. Both lists stay sorted, so every Add()
+    // is at the end.
+    int dest = 0;
+    for(i = 0; i < SK.param.n; i++) {
+        Param *p = &(SK.param.elem[i]);
+        if(KeepParam(p->h, dirtyOnly)) {
+            p->known = true;
+            SK.param.elem[dest++] = *p;
+        } else {
+            prev->Add(p);
+        }
+    }
+    SK.param.n = dest;
+}
+
+//-----------------------------------------------------------------------------
+// Regenerate a group's solid model; right away, or else just the group's own
+// shell and mesh now, and the Boolean as a job for the worker thread, with
+// copies of everything that it needs.
+//-----------------------------------------------------------------------------
+static void GenerateShellAndMeshFor(Group *g, List<BooleanJob> *jobs) {
+    if(!jobs) {
+        g->GenerateShellAndMesh();
+        g->cleanMesh = true;
+        return;
+    }
+
+    g->GenerateThisShellAndMesh();
+
+    BooleanJob job;
+    ZERO(&job);
+    g->MakeBooleanJob(&job);
+    job.thisShell.MakeFromCopyOf(&(g->thisShell));
+    job.thisMesh.MakeFromCopyOf(&(g->thisMesh));
+    job.runningShell.MakeFromCopyOf(&(g->runningShell));
+    job.runningShell.booleanFailed = g->runningShell.booleanFailed;
+
+    Group *srcg = (g->type == Group::TRANSLATE || g->type == Group::ROTATE) ?
+        SK.GetGroup(g->opA) : g;
+    Group *prevg = srcg->RunningMeshGroup();
+    int i;
+    for(i = 0; i < jobs->n; i++) {
+        if(jobs->elem[i].h.v == prevg->h.v) job.prev = i;
+    }
+    if(job.prev < 0) {
+        job.prevShell.MakeFromCopyOf(&(prevg->runningShell));
+        job.prevMesh.MakeFromCopyOf(&(prevg->runningMesh));
+    }
+    jobs->Add(&job);
+}
+
+void SolveSpaceUI::GenerateAll(int first, int last, bool andFindFree,
+                               bool dirtyOnly)
+{
     int i, j;
 
+    if(first >= 0) {
+        // Anything that the worker thread has finished, we keep; but the
+        // rest is about to be out of date.
+        PublishGenerated();
+        CancelGenerate();
+    }
+
     // Remove any requests or constraints that refer to a nonexistent
     // group; can check those immediately, since we know what the list
     // of groups should be.
     while(PruneOrphans())
         ;
 
+    // If we're interactive, then the Booleans get queued up here for the
+    // worker thread, instead of done as we go.
+    List<BooleanJob> jobs;
+    ZERO(&jobs);
+
     // Don't lose our numerical guesses when we regenerate.
     IdList<Param,hParam> prev;
-    SK.param.MoveSelfInto(&prev);
-    SK.entity.Clear();
+    ZERO(&prev);
+    KeepCleanGroups(&prev, dirtyOnly);
+    // The groups that we solve get marked clean as we go; if we have to start
+    // over, then they must be solved again.
+    List<hGroup> solved;
+    ZERO(&solved);
 
     int64_t inTime = GetMilliseconds();
 
@@ -197,29 +721,8 @@ void SolveSpaceUI::GenerateAll(int first, int last, bool andFindFree) {
             char msg[1024];
             sprintf(msg, "generating group %d/%d", i, SK.group.n);
 
-            int w, h;
-            GetGraphicsWindowSize(&w, &h);
             glDrawBuffer(GL_FRONT);
-            glViewport(0, 0, w, h);
-            glLoadIdentity();
-            glTranslated(-1, 1, 0);
-            glScaled(2.0/w, 2.0/h, 1.0);
-            glDisable(GL_DEPTH_TEST);
-
-            double left = 80, top = -20, width = 240, height = 24;
-            glColor3d(0.9, 0.8, 0.8);
-            ssglAxisAlignedQuad(left, left+width, top, top-height);
-            ssglLineWidth(1);
-            glColor3d(0.0, 0.0, 0.0);
-            ssglAxisAlignedLineLoop(left, left+width, top, top-height);
-
-            ssglCreateBitmapFont();
-            glColor3d(0, 0, 0);
-            glPushMatrix();
-                glTranslated(left+8, top-20, 0);
-                glScaled(1, -1, 1);
-                ssglBitmapText(msg, Vector::From(0, 0, 0));
-            glPopMatrix();
+            DrawStatusMessage(msg);
             glFlush();
             glDrawBuffer(GL_BACK);
         }
@@ -230,13 +733,16 @@ void SolveSpaceUI::GenerateAll(int first, int last, bool andFindFree) {
         if(PruneGroups(g->h))
             goto pruned;
 
-        for(j = 0; j < SK.request.n; j++) {
-            Request *r = &(SK.request.elem[j]);
-            if(r->group.v != g->h.v) continue;
+        bool keep = KeepGroup(g->h, dirtyOnly);
+        if(!keep) {
+            for(j = 0; j < SK.request.n; j++) {
+                Request *r = &(SK.request.elem[j]);
+                if(r->group.v != g->h.v) continue;
 
-            r->Generate(&(SK.entity), &(SK.param));
+                r->Generate(&(SK.entity), &(SK.param));
+            }
+            g->Generate(&(SK.entity), &(SK.param));
         }
-        g->Generate(&(SK.entity), &(SK.param));
 
         // The requests and constraints depend on stuff in this or the
         // previous group, so check them after generating.
@@ -245,40 +751,44 @@ void SolveSpaceUI::GenerateAll(int first, int last, bool andFindFree) {
 
         // Use the previous values for params that we've seen before, as
         // initial guesses for the solver.
-        for(j = 0; j < SK.param.n; j++) {
-            Param *newp = &(SK.param.elem[j]);
-            if(newp->known) continue;
-
-            Param *prevp = prev.FindByIdNoOops(newp->h);
-            if(prevp) newp->val = prevp->val;
-        }
+        if(!keep) UsePreviousParams(g, &prev, false);
 
+        bool inRange = (i >= first && i <= last);
         if(g->h.v == Group::HGROUP_REFERENCES.v) {
             ForceReferences();
             g->solved.how = System::SOLVED_OKAY;
             g->clean = true;
+            g->cleanMesh = true;
+        } else if(inRange && (!dirtyOnly || !g->clean ||
+                              g->solved.how != System::SOLVED_OKAY))
+        {
+            // The group falls inside the range, so really solve it,
+            // and then regenerate the mesh based on the solved stuff.
+            SolveGroup(g->h, andFindFree);
+            g->GenerateLoops();
+            g->clean = true;
+            solved.Add(&(g->h));
+            GenerateShellAndMeshFor(g, dirtyOnly ? &jobs : NULL);
         } else {
-            if(i >= first && i <= last) {
-                // The group falls inside the range, so really solve it,
-                // and then regenerate the mesh based on the solved stuff.
-                SolveGroup(g->h, andFindFree);
-                g->GenerateLoops();
-                g->GenerateShellAndMesh();
-                g->clean = true;
-            } else {
-                // The group falls outside the range, so just assume that
-                // it's good wherever we left it. The mesh is unchanged,
-                // and the parameters must be marked as known.
-                for(j = 0; j < SK.param.n; j++) {
-                    Param *newp = &(SK.param.elem[j]);
-
-                    Param *prevp = prev.FindByIdNoOops(newp->h);
-                    if(prevp) newp->known = true;
-                }
+            // The group falls outside the range, or doesn't depend on
+            // anything that changed, so just assume that it's good wherever
+            // we left it. The parameters must be marked as known; if we kept
+            // them, then they already are.
+            if(!keep) UsePreviousParams(g, &prev, true);
+            if(inRange && !g->cleanMesh) {
+                // But the mesh that it merges into changed, so redo that.
+                GenerateShellAndMeshFor(g, dirtyOnly ? &jobs : NULL);
             }
         }
     }
 
+    if(jobs.n > 0) {
+        StartGenerate(&jobs);
+        // Small models are quick, so just wait for those.
+        WaitForGenerate(GENERATE_WAIT_MS);
+        PublishGenerated();
+    }
+
     // And update any reference dimensions with their new values
     for(i = 0; i < SK.constraint.n; i++) {
         Constraint *c = &(SK.constraint.elem[i]);
@@ -298,6 +808,7 @@ void SolveSpaceUI::GenerateAll(int first, int last, bool andFindFree) {
     }
 
     prev.Clear();
+    solved.Clear();
     InvalidateGraphics();
 
     // Remove nonexistent selection items, for same reason we waited till
@@ -344,11 +855,35 @@ void SolveSpaceUI::GenerateAll(int first, int last, bool andFindFree) {
     return;
 
 pruned:
-    // Restore the numerical guesses
-    SK.param.Clear();
-    prev.MoveSelfInto(&(SK.param));
+    BooleanWorker::ClearJobs(&jobs);
+    for(i = 0; i < solved.n; i++) {
+        Group *g = SK.group.FindByIdNoOops(solved.elem[i]);
+        if(g) g->clean = false;
+    }
+    solved.Clear();
+    // Restore the numerical guesses; the params that we kept never left.
+    // Both lists are sorted, so merge them, and every Add() is at the end.
+    {
+        IdList<Param,hParam> restored;
+        ZERO(&restored);
+        int j = 0;
+        for(i = 0; i < SK.param.n; i++) {
+            Param *p = &(SK.param.elem[i]);
+            if(!KeepParam(p->h, dirtyOnly)) continue;
+            for(; j < prev.n && prev.elem[j].h.v < p->h.v; j++) {
+                restored.Add(&(prev.elem[j]));
+            }
+            restored.Add(p);
+        }
+        for(; j < prev.n; j++) {
+            restored.Add(&(prev.elem[j]));
+        }
+        SK.param.Clear();
+        restored.MoveSelfInto(&(SK.param));
+    }
+    prev.Clear();
     // Try again
-    GenerateAll(first, last);
+    GenerateAll(first, last, andFindFree, dirtyOnly);
 }
 
 void SolveSpaceUI::ForceReferences(void) {
@@ -731,7 +731,10 @@ void GraphicsWindow::MenuEdit(int id) {
             }
             SS.GW.ClearSuper();
             SS.TW.HideEditControl();
-            SS.nakedEdges.Clear();
+            {
+                std::lock_guard<std::mutex> l(SShell::failedLock);
+                SS.nakedEdges.Clear();
+            }
             SS.justExportedInfo.draw = false;
             // This clears the marks drawn to indicate which points are
             // still free to drag.
@@ -23,12 +23,16 @@ void Group::Clear(void) {
     polyLoops.Clear();
     bezierLoops.Clear();
     bezierOpens.Clear();
+    polyError.openAt.Clear();
+    polyError.branchAt.Clear();
     thisMesh.Clear();
     runningMesh.Clear();
     thisShell.Clear();
     runningShell.Clear();
+    runningShellKey = 0;
     displayMesh.Clear();
     displayEdges.Clear();
+    displayLod.Clear();
     impMesh.Clear();
     impShell.Clear();
     impEntity.Clear();
@@ -42,6 +42,14 @@ void Group::AssembleLoops(bool *allClosed,
         }
     }
 
+    // Only the ends of the curves matter for whether they join up; keep
+    // those, since assembling the loops uses up the curves.
+    SEdgeList ends;
+    ZERO(&ends);
+    for(sb = sbl.l.First(); sb; sb = sbl.l.NextAfter(sb)) {
+        ends.AddEdge(sb->Start(), sb->Finish());
+    }
+
     // Try to assemble all these Beziers into loops. The closed loops go into
     // bezierLoops, with the outer loops grouped with their holes. The
     // leftovers, if any, go in bezierOpens.
@@ -50,6 +58,16 @@ void Group::AssembleLoops(bool *allClosed,
                                    allClosed, &(polyError.notClosedAt),
                                    allCoplanar, &(polyError.errorPointAt),
                                    &bezierOpens);
+    if(*allCoplanar && !*allClosed) {
+        // That only tells us about the first loop that wouldn't close; so
+        // find every point where a contour ends, or where contours branch.
+        SPolygon sp;
+        ZERO(&sp);
+        ends.AssemblePolygon(&sp, NULL, false,
+                             &(polyError.openAt), &(polyError.branchAt));
+        sp.Clear();
+    }
+    ends.Clear();
     done:
     sbl.Clear();
 }
@@ -58,6 +76,8 @@ void Group::GenerateLoops(void) {
     polyLoops.Clear();
     bezierLoops.Clear();
     bezierOpens.Clear();
+    polyError.openAt.Clear();
+    polyError.branchAt.Clear();
 
     if(type == DRAWING_3D || type == DRAWING_WORKPLANE ||
        type == ROTATE || type == TRANSLATE || type == IMPORTED)
@@ -159,7 +179,9 @@ void Group::GenerateForStepAndRepeat(T *steps, T *outs) {
 }
 
 template<class T>
-void Group::GenerateForBoolean(T *prevs, T *thiss, T *outs, int how) {
+void Group::GenerateForBoolean(T *prevs, T *thiss, T *outs, int how,
+                               bool suppress)
+{
     // If this group contributes no new mesh, then our running mesh is the
     // same as last time, no combining required. Likewise if we have a mesh
     // but it's suppressed.
@@ -180,15 +202,158 @@ void Group::GenerateForBoolean(T *prevs, T *thiss, T *outs, int how) {
 }
 
 void Group::GenerateShellAndMesh(void) {
+    GenerateThisShellAndMesh();
+
+    BooleanJob job;
+    ZERO(&job);
+    MakeBooleanJob(&job);
+    // We're doing it right here, so no need to copy anything; the job just
+    // borrows what we've got, and gives it back.
+    job.runningShell = runningShell;
+    ZERO(&runningShell);
+
+    Group *prevg = (type == TRANSLATE || type == ROTATE) ?
+        SK.GetGroup(opA)->RunningMeshGroup() : RunningMeshGroup();
+    job.Run(&(prevg->runningShell), &(prevg->runningMesh),
+            &thisShell, &thisMesh);
+
+    TakeBooleanResult(&job, false);
+}
+
+//-----------------------------------------------------------------------------
+// Set up the job to combine our solid model with the previous groups', with
+// the appropriate Boolean. Its inputs are left for the caller to fill in,
+// since they might be either borrowed or copied.
+//-----------------------------------------------------------------------------
+void Group::MakeBooleanJob(BooleanJob *job) {
+    // A step and repeat gets merged against the group's previous group,
+    // so it's that group's settings that apply.
+    Group *srcg = (type == TRANSLATE || type == ROTATE) ?
+        SK.GetGroup(opA) : this;
+
+    job->h              = h;
+    job->how            = srcg->meshCombine;
+    job->suppress       = suppress;
+    job->forceToMesh    = forceToMesh;
+    job->chordTol       = SS.ChordTolMm();
+    job->maxSegments    = SS.maxSegments;
+    job->key            = runningShellKey;
+    job->prev           = -1;
+}
+
+void Group::TakeBooleanResult(BooleanJob *job, bool copy) {
     bool prevBooleanFailed = booleanFailed;
+
+    if(job->changed || !copy) {
+        runningShell.Clear();
+        runningMesh.Clear();
+        // and the coarser meshes were of the old shell
+        displayLod.Clear();
+        if(copy) {
+            runningShell.MakeFromCopyOf(&(job->runningShell));
+            runningShell.booleanFailed = job->runningShell.booleanFailed;
+            runningMesh.MakeFromCopyOf(&(job->runningMesh));
+        } else {
+            runningShell = job->runningShell;
+            runningMesh  = job->runningMesh;
+            ZERO(&(job->runningShell));
+            ZERO(&(job->runningMesh));
+        }
+    }
+    runningShellKey = job->key;
+
+    // If the Boolean failed, then we should note that in the text screen
+    // for this group.
+    booleanFailed = job->booleanFailed;
+    if(booleanFailed != prevBooleanFailed) {
+        SS.ScheduleShowTW();
+    }
+
+    displayDirty = true;
+}
+
+void BooleanJob::Run(SShell *prevs, SMesh *prevm, SShell *thiss, SMesh *thism)
+{
     booleanFailed = false;
+    changed = true;
+    // This might be on the worker thread, so use the tolerances we were
+    // made with, not the live ones.
+    OverrideTolerances(chordTol, maxSegments);
 
-    Group *srcg = this;
+    runningMesh.Clear();
+    if(prevm->IsEmpty() && thism->IsEmpty() && !forceToMesh) {
+        // A group gets regenerated whenever an earlier group changes, but
+        // often its inputs come out the same; then so would the Boolean.
+        uint64_t k = HashMix(prevs->Hash(), thiss->Hash());
+        k = HashMix(k, (uint64_t)how);
+        k = HashMix(k, (uint64_t)suppress);
+        k = HashDouble(k, chordTol);
+        k = HashMix(k, (uint64_t)maxSegments);
+        if(k == 0 || k != key) {
+            runningShell.Clear();
+            Group::GenerateForBoolean<SShell>(prevs, thiss, &runningShell,
+                how, suppress);
+
+            if(how != Group::COMBINE_AS_ASSEMBLE) {
+                runningShell.MergeCoincidentSurfaces();
+            }
+            key = k;
+        } else {
+            changed = false;
+        }
+
+        booleanFailed = runningShell.booleanFailed;
+    } else {
+        runningShell.Clear();
+        key = 0;
+
+        SMesh prevtm, thistm;
+        ZERO(&prevtm);
+        ZERO(&thistm);
+
+        prevtm.MakeFromCopyOf(prevm);
+        prevs->TriangulateInto(&prevtm);
+
+        thistm.MakeFromCopyOf(thism);
+        thiss->TriangulateInto(&thistm);
 
+        SMesh outm;
+        ZERO(&outm);
+        Group::GenerateForBoolean<SMesh>(&prevtm, &thistm, &outm,
+            how, suppress);
+
+        // And make sure that the output mesh is vertex-to-vertex.
+        SKdNode *root = SKdNode::From(&outm);
+        root->SnapToMesh(&outm);
+        root->MakeMeshInto(&runningMesh);
+
+        outm.Clear();
+        thistm.Clear();
+        prevtm.Clear();
+    }
+    OverrideTolerances(0, 0);
+}
+
+void BooleanJob::Clear(void) {
     thisShell.Clear();
     thisMesh.Clear();
+    prevShell.Clear();
+    prevMesh.Clear();
     runningShell.Clear();
     runningMesh.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Generate the solid model for this group alone, before it's combined with
+// the model from the previous groups.
+//-----------------------------------------------------------------------------
+void Group::GenerateThisShellAndMesh(void) {
+    Group *srcg = this;
+
+    thisShell.Clear();
+    thisMesh.Clear();
+    // but runningShell stays, in case the Boolean that made it doesn't need
+    // to be redone; and runningMesh stays until there's a new one.
 
     // Don't attempt a lathe or extrusion unless the source section is good:
     // planar and not self-intersecting.
@@ -310,54 +475,6 @@ void Group::GenerateShellAndMesh(void) {
     if(srcg->meshCombine != COMBINE_AS_ASSEMBLE) {
         thisShell.MergeCoincidentSurfaces();
     }
-
-    // So now we've got the mesh or shell for this group. Combine it with
-    // the previous group's mesh or shell with the requested Boolean, and
-    // we're done.
-
-    Group *prevg = srcg->RunningMeshGroup();
-
-    if(prevg->runningMesh.IsEmpty() && thisMesh.IsEmpty() && !forceToMesh) {
-        SShell *prevs = &(prevg->runningShell);
-        GenerateForBoolean<SShell>(prevs, &thisShell, &runningShell,
-            srcg->meshCombine);
-
-        if(srcg->meshCombine != COMBINE_AS_ASSEMBLE) {
-            runningShell.MergeCoincidentSurfaces();
-        }
-
-        // If the Boolean failed, then we should note that in the text screen
-        // for this group.
-        booleanFailed = runningShell.booleanFailed;
-        if(booleanFailed != prevBooleanFailed) {
-            SS.ScheduleShowTW();
-        }
-    } else {
-        SMesh prevm, thism;
-        ZERO(&prevm);
-        ZERO(&thism);
-
-        prevm.MakeFromCopyOf(&(prevg->runningMesh));
-        prevg->runningShell.TriangulateInto(&prevm);
-
-        thism.MakeFromCopyOf(&thisMesh);
-        thisShell.TriangulateInto(&thism);
-
-        SMesh outm;
-        ZERO(&outm);
-        GenerateForBoolean<SMesh>(&prevm, &thism, &outm, srcg->meshCombine);
-
-        // And make sure that the output mesh is vertex-to-vertex.
-        SKdNode *root = SKdNode::From(&outm);
-        root->SnapToMesh(&outm);
-        root->MakeMeshInto(&runningMesh);
-
-        outm.Clear();
-        thism.Clear();
-        prevm.Clear();
-    }
-
-    displayDirty = true;
 }
 
 void Group::GenerateDisplayItems(void) {
@@ -379,6 +496,8 @@ void Group::GenerateDisplayItems(void) {
 
             displayMesh.Clear();
             displayMesh.MakeFromCopyOf(&(pg->displayMesh));
+            // and we'll draw the previous group's coarser meshes too
+            displayLod.Clear();
 
             displayEdges.Clear();
             if(SS.GW.showEdges) {
@@ -392,7 +511,7 @@ void Group::GenerateDisplayItems(void) {
             // We do contribute new solid model, so we have to triangulate the
             // shell, and edge-find the mesh.
             displayMesh.Clear();
-            runningShell.TriangulateInto(&displayMesh);
+            runningShell.TriangulateInto(&displayMesh, &displayLod);
             STriangle *t;
             for(t = runningMesh.l.First(); t; t = runningMesh.l.NextAfter(t)) {
                 STriangle trn = *t;
@@ -433,6 +552,19 @@ Group *Group::RunningMeshGroup(void) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// The display mesh, at the level of detail that the current view needs. A
+// group that doesn't contribute any new solid model displays the previous
+// group's, so it can use that group's coarser meshes too.
+//-----------------------------------------------------------------------------
+SMesh *Group::DisplayMeshForView(void) {
+    Group *pg = RunningMeshGroup();
+    if(pg && thisMesh.IsEmpty() && thisShell.IsEmpty()) {
+        return pg->DisplayMeshForView();
+    }
+    return displayLod.MeshForView(&runningShell, &displayMesh);
+}
+
 void Group::DrawDisplayItems(int t) {
     RgbaColor specColor;
     bool useSpecColor;
@@ -469,7 +601,8 @@ void Group::DrawDisplayItems(int t) {
         }
 
         glEnable(GL_LIGHTING);
-        ssglFillMesh(useSpecColor, specColor, &displayMesh, mh, ms1, ms2);
+        ssglFillMesh(useSpecColor, specColor, DisplayMeshForView(),
+                     mh, ms1, ms2);
         glDisable(GL_LIGHTING);
     }
 
@@ -480,7 +613,7 @@ void Group::DrawDisplayItems(int t) {
         ssglDrawEdges(&displayEdges, false);
     }
 
-    if(SS.GW.showMesh) ssglDebugMesh(&displayMesh);
+    if(SS.GW.showMesh) ssglDebugMesh(DisplayMeshForView());
 }
 
 void Group::Draw(void) {
@@ -511,6 +644,23 @@ void Group::Draw(void) {
                 DEFAULT_TEXT_HEIGHT,
                 polyError.notClosedAt.b, SS.GW.projRight, SS.GW.projUp,
                 NULL, NULL);
+            // And mark everywhere else that a contour ends or branches, so
+            // that the user can find all the gaps at once.
+            SPoint *sp;
+            glPointSize(12);
+            glBegin(GL_POINTS);
+                for(sp = polyError.openAt.l.First(); sp;
+                    sp = polyError.openAt.l.NextAfter(sp))
+                {
+                    ssglVertex3v(sp->p);
+                }
+                for(sp = polyError.branchAt.l.First(); sp;
+                    sp = polyError.branchAt.l.NextAfter(sp))
+                {
+                    ssglVertex3v(sp->p);
+                }
+            glEnd();
+            glPointSize(1);
             glEnable(GL_DEPTH_TEST);
         }
     } else if(polyError.how == POLY_NOT_COPLANAR ||
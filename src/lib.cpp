@@ -8,10 +8,21 @@
 #define EXPORT_DLL
 #include <slvs.h>
 
-Sketch SolveSpace::SK;
-static System SYS;
+#include <mutex>
 
-static int IsInit = 0;
+// Each thread solves its own sketch, so that contexts can be used from many
+// threads at once.
+thread_local Sketch SolveSpace::SK;
+
+// Everything else that a solve needs is in the System, which keeps some of
+// it (like the compiled equations for a drag) from one solve to the next.
+// Slvs_Solve() uses this one; the caller can create others.
+struct Slvs_Context {
+    System      sys;
+};
+static Slvs_Context DefaultContext;
+
+static std::once_flag HeapsInit;
 
 void Group::GenerateEquations(IdList<Equation,hEquation> *l) {
     // Nothing to do for now.
@@ -78,13 +89,32 @@ void Slvs_MakeQuaternion(double ux, double uy, double uz,
     *qz = q.vz;
 }
 
-void Slvs_Solve(Slvs_System *ssys, Slvs_hGroup shg)
+Slvs_Context *Slvs_CreateContext(void)
 {
-    if(!IsInit) {
-        InitHeaps();
-        IsInit = 1;
-    }
+    std::call_once(HeapsInit, InitHeaps);
+
+    Slvs_Context *ctx = (Slvs_Context *)MemAlloc(sizeof(*ctx));
+    memset(ctx, 0, sizeof(*ctx));
+    return ctx;
+}
+
+void Slvs_DestroyContext(Slvs_Context *ctx)
+{
+    ctx->sys.Clear();
+    MemFree(ctx);
+}
+
+int Slvs_GetIterationsInContext(Slvs_Context *ctx)
+{
+    return ctx->sys.iterations;
+}
 
+void Slvs_SolveInContext(Slvs_Context *ctx, Slvs_System *ssys,
+                         Slvs_hGroup shg)
+{
+    std::call_once(HeapsInit, InitHeaps);
+
+    System &SYS = ctx->sys;
     int i;
     for(i = 0; i < ssys->params; i++) {
         Slvs_Param *sp = &(ssys->param[i]);
@@ -93,10 +123,13 @@ void Slvs_Solve(Slvs_System *ssys, Slvs_hGroup shg)
 
         p.h.v = sp->h;
         p.val = sp->val;
-        SK.param.Add(&p);
         if(sp->group == shg) {
             SYS.param.Add(&p);
+        } else {
+            // Not being solved for, so these are just constants.
+            p.known = true;
         }
+        SK.param.Add(&p);
     }
 
     for(i = 0; i < ssys->entities; i++) {
@@ -264,4 +297,14 @@ default: dbp("bad constraint type %d", sc->type); return;
     FreeAllTemporary();
 }
 
+void Slvs_Solve(Slvs_System *ssys, Slvs_hGroup shg)
+{
+    Slvs_SolveInContext(&DefaultContext, ssys, shg);
+}
+
+int Slvs_GetIterations(void)
+{
+    return Slvs_GetIterationsInContext(&DefaultContext);
+}
+
 } /* extern "C" */
@@ -1,6 +1,6 @@
 //-----------------------------------------------------------------------------
-// Operations on triangle meshes, like our mesh Booleans using the BSP, and
-// the stuff to check for watertightness.
+// Operations on triangle meshes, like our mesh Booleans, and the stuff to
+// check for watertightness.
 //
 // Copyright 2008-2013 Jonathan Westhues.
 //-----------------------------------------------------------------------------
@@ -97,196 +97,769 @@ void SMesh::MakeEmphasizedEdgesInto(SEdgeList *sel) {
 }
 
 //-----------------------------------------------------------------------------
-// When we are called, all of the triangles from l.elem[start] to the end must
-// be coplanar. So we try to find a set of fewer triangles that covers the
-// exact same area, in order to reduce the number of triangles in the mesh.
-// We use this after a triangle has been split against the BSP.
-//
-// This is really ugly code; basically it just pastes things together to
-// form convex polygons, merging collinear edges when possible, then
-// triangulates the convex poly.
+// Mesh Booleans. Each triangle gets split along the segments where it meets
+// the other mesh, so that every piece is entirely inside the other mesh,
+// outside it, or on its surface. The pieces that meet without crossing one
+// of those segments form patches that all lie on the same side, so we cast
+// a ray from just one piece of each patch to classify the whole patch, and
+// then keep or discard it.
 //-----------------------------------------------------------------------------
-void SMesh::Simplify(int start) {
-    int maxTriangles = (l.n - start) + 10;
+static const int MB_OUTSIDE     = 0;
+static const int MB_INSIDE      = 1;
+static const int MB_COINC_SAME  = 2;
+static const int MB_COINC_OPP   = 3;
+
+// One operand of a mesh Boolean.
+typedef struct {
+    // The operand's triangles, less any degenerate ones
+    SMesh           m;
+    // The bounding box of each triangle, by index, and of the whole mesh
+    SBvh            bvh;
+    Vector          max, min;
+    // For each triangle, the segments along which it must be split
+    List<SEdgeList> cut;
+    // For each triangle, the pieces that it got split into
+    List<SMesh>     piece;
+    // All the pieces together; bit j of a piece's tag is set if its edge
+    // from vertex j lies along a cut. And for each piece, where it lies
+    // with respect to the other operand.
+    SMesh           split;
+    List<int>       where;
+} MbOperand;
+
+static void MbBegin(MbOperand *op, SMesh *m) {
+    ZERO(op);
+    op->max = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE);
+    op->min = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+
+    int i;
+    for(i = 0; i < m->l.n; i++) {
+        STriangle *tr = &(m->l.elem[i]);
+        if(tr->MinAltitude() <= LENGTH_EPS) continue;
+        op->m.AddTriangle(tr);
+
+        Vector tmax = tr->a, tmin = tr->a;
+        (tr->b).MakeMaxMin(&tmax, &tmin);
+        (tr->c).MakeMaxMin(&tmax, &tmin);
+        op->bvh.AddBox(tmax, tmin);
+        tmax.MakeMaxMin(&(op->max), &(op->min));
+        tmin.MakeMaxMin(&(op->max), &(op->min));
+    }
+    op->bvh.Build();
+
+    int n = op->m.l.n;
+    op->cut.Resize(n);
+    op->piece.Resize(n);
+    memset(op->cut.elem, 0, n*sizeof(op->cut.elem[0]));
+    memset(op->piece.elem, 0, n*sizeof(op->piece.elem[0]));
+}
 
-    STriMeta meta = l.elem[start].meta;
+static void MbEnd(MbOperand *op) {
+    int i;
+    for(i = 0; i < op->cut.n; i++) {
+        op->cut.elem[i].Clear();
+        op->piece.elem[i].Clear();
+    }
+    op->cut.Clear();
+    op->piece.Clear();
+    op->m.Clear();
+    op->bvh.Clear();
+    op->split.Clear();
+    op->where.Clear();
+}
 
-    STriangle *tout = (STriangle *)AllocTemporary(maxTriangles*sizeof(*tout));
-    int toutc = 0;
+//-----------------------------------------------------------------------------
+// Where the edge from a to b, at signed distances da and db from some plane,
+// crosses that plane. This always works from the same endpoint, so two
+// triangles that share the edge get exactly the same point.
+//-----------------------------------------------------------------------------
+static Vector MbEdgeCrossing(Vector a, Vector b, double da, double db) {
+    if(b.x < a.x || (b.x == a.x && (b.y < a.y || (b.y == a.y && b.z < a.z)))) {
+        swap(a, b);
+        swap(da, db);
+    }
+    return a.Plus((b.Minus(a)).ScaledBy(da/(da - db)));
+}
 
-    Vector n = Vector::From(0, 0, 0);
-    Vector *conv = (Vector *)AllocTemporary(maxTriangles*3*sizeof(*conv));
-    int convc = 0;
+// The points where a triangle meets a plane, given the signed distances of
+// its vertices from that plane: the vertices in the plane, and the points
+// where the edges cross it.
+static int MbPlaneCrossings(STriangle *tr, double *dist, Vector *pts) {
+    Vector v[3] = { tr->a, tr->b, tr->c };
+    int i, n = 0;
+    for(i = 0; i < 3; i++) {
+        int j = WRAP(i+1, 3);
+        if(dist[i] == 0) {
+            pts[n++] = v[i];
+        } else if(dist[i]*dist[j] < 0) {
+            pts[n++] = MbEdgeCrossing(v[i], v[j], dist[i], dist[j]);
+        }
+    }
+    return n;
+}
 
-    int start0 = start;
+// Add the parts of tr's edges that lie within the coplanar triangle in to
+// the list, tagged with aux.
+static void MbClipEdges(STriangle *tr, STriangle *in, int aux, SEdgeList *out)
+{
+    Vector n = (in->Normal()).WithMagnitude(1);
+    Vector iv[3] = { in->a, in->b, in->c },
+           tv[3] = { tr->a, tr->b, tr->c };
 
     int i, j;
-    for(i = start; i < l.n; i++) {
-        STriangle *tr = &(l.elem[i]);
-        if(tr->MinAltitude() < LENGTH_EPS) {
-            tr->tag = 1;
-        } else {
-            tr->tag = 0;
+    for(i = 0; i < 3; i++) {
+        Vector a = tv[i], b = tv[WRAP(i+1, 3)];
+        double t0 = 0, t1 = 1;
+        for(j = 0; j < 3 && t0 < t1; j++) {
+            Vector p = iv[j], q = iv[WRAP(j+1, 3)];
+            Vector inward = (n.Cross(q.Minus(p))).WithMagnitude(1);
+            double da = inward.Dot(a.Minus(p)), db = inward.Dot(b.Minus(p));
+            if(fabs(da) < LENGTH_EPS) da = 0;
+            if(fabs(db) < LENGTH_EPS) db = 0;
+
+            if(da < 0 && db < 0) {
+                t0 = 1; t1 = 0;
+            } else if(da < 0) {
+                t0 = max(t0, da/(da - db));
+            } else if(db < 0) {
+                t1 = min(t1, da/(da - db));
+            }
         }
+        if((t1 - t0)*(b.Minus(a)).Magnitude() < LENGTH_EPS) continue;
+
+        Vector ab = b.Minus(a);
+        out->AddEdge(a.Plus(ab.ScaledBy(t0)), a.Plus(ab.ScaledBy(t1)), aux);
     }
+}
 
-    for(;;) {
-        bool didAdd;
-        convc = 0;
-        for(i = start; i < l.n; i++) {
-            STriangle *tr = &(l.elem[i]);
-            if(tr->tag) continue;
+//-----------------------------------------------------------------------------
+// Find where triangles t and u meet, and add the segments along which each
+// must be split to the list: t's with auxA -1, and u's with auxA ui. Where
+// they're coplanar, each gets split along the other's edges.
+//-----------------------------------------------------------------------------
+static void MbIntersect(STriangle *t, STriangle *u, int ui, SEdgeList *out) {
+    Vector nt = (t->Normal()).WithMagnitude(1),
+           nu = (u->Normal()).WithMagnitude(1);
+    Vector tv[3] = { t->a, t->b, t->c },
+           uv[3] = { u->a, u->b, u->c };
+    double dt = nt.Dot(t->a), du = nu.Dot(u->a);
+
+    // The distances of t's vertices from u's plane, and of u's from t's.
+    double tdist[3], udist[3];
+    int i, tpos = 0, tneg = 0, upos = 0, uneg = 0;
+    for(i = 0; i < 3; i++) {
+        tdist[i] = nu.Dot(tv[i]) - du;
+        if(fabs(tdist[i]) < LENGTH_EPS) tdist[i] = 0;
+        if(tdist[i] > 0) tpos++;
+        if(tdist[i] < 0) tneg++;
+
+        udist[i] = nt.Dot(uv[i]) - dt;
+        if(fabs(udist[i]) < LENGTH_EPS) udist[i] = 0;
+        if(udist[i] > 0) upos++;
+        if(udist[i] < 0) uneg++;
+    }
+    if(tpos == 3 || tneg == 3 || upos == 3 || uneg == 3) return;
 
-            tr->tag = 1;
-            n = (tr->Normal()).WithMagnitude(1);
-            conv[convc++] = tr->a;
-            conv[convc++] = tr->b;
-            conv[convc++] = tr->c;
+    if((upos == 0 && uneg == 0) || (tpos == 0 && tneg == 0)) {
+        MbClipEdges(u, t, -1, out);
+        MbClipEdges(t, u, ui, out);
+        return;
+    }
 
-            start = i+1;
-            break;
-        }
-        if(i >= l.n) break;
+    Vector dir = nt.Cross(nu);
+    if(dir.Magnitude() < LENGTH_EPS) return;
+    dir = dir.WithMagnitude(1);
+
+    // Each triangle meets the other's plane along a segment of the line
+    // where the planes intersect; and the triangles meet where those two
+    // segments overlap.
+    Vector tp[3], up[3];
+    int tn = MbPlaneCrossings(t, tdist, tp),
+        un = MbPlaneCrossings(u, udist, up);
+    if(tn == 0 || un == 0) return;
+
+    Vector lo = tp[0], hi = tp[0];
+    for(i = 1; i < tn; i++) {
+        if(tp[i].Dot(dir) < lo.Dot(dir)) lo = tp[i];
+        if(tp[i].Dot(dir) > hi.Dot(dir)) hi = tp[i];
+    }
+    Vector ulo = up[0], uhi = up[0];
+    for(i = 1; i < un; i++) {
+        if(up[i].Dot(dir) < ulo.Dot(dir)) ulo = up[i];
+        if(up[i].Dot(dir) > uhi.Dot(dir)) uhi = up[i];
+    }
+    if(ulo.Dot(dir) > lo.Dot(dir)) lo = ulo;
+    if(uhi.Dot(dir) < hi.Dot(dir)) hi = uhi;
+    if(hi.Dot(dir) - lo.Dot(dir) < LENGTH_EPS) return;
 
-        do {
-            didAdd = false;
+    out->AddEdge(lo, hi, -1);
+    out->AddEdge(lo, hi, ui);
+}
 
-            for(j = 0; j < convc; j++) {
-                Vector a = conv[WRAP((j-1), convc)],
-                       b = conv[j],
-                       d = conv[WRAP((j+1), convc)],
-                       e = conv[WRAP((j+2), convc)];
+typedef struct {
+    MbOperand       *a, *b;
+    // For each triangle of a, the segments where it meets b
+    List<SEdgeList> hits;
+} MbIntersectJob;
+
+static void MbIntersectTriangle(void *data, int i) {
+    MbIntersectJob *job = (MbIntersectJob *)data;
+    STriangle *t = &(job->a->m.l.elem[i]);
+
+    List<int> near;
+    ZERO(&near);
+    job->b->bvh.FindOverlapping(job->a->bvh.boxMax.elem[i],
+                                job->a->bvh.boxMin.elem[i], &near);
+    int j;
+    for(j = 0; j < near.n; j++) {
+        int ui = near.elem[j];
+        MbIntersect(t, &(job->b->m.l.elem[ui]), ui, &(job->hits.elem[i]));
+    }
+    near.Clear();
+}
 
-                Vector c;
-                for(i = start; i < l.n; i++) {
-                    STriangle *tr = &(l.elem[i]);
-                    if(tr->tag) continue;
+//-----------------------------------------------------------------------------
+// The triangulation of a single triangle, as it gets split. The points are
+// welded within LENGTH_EPS, and the triangles refer to them by index; and
+// the constraints are the cuts, as pairs of point indices.
+//-----------------------------------------------------------------------------
+typedef struct {
+    int     v[3];
+} MbTri;
+
+typedef struct {
+    int     a, b;
+} MbConstraint;
+
+typedef struct {
+    Vector              n;
+    List<Vector>        pt;
+    List<MbTri>         tri;
+    List<MbConstraint>  con;
+} MbSplit;
+
+static int MbAddPoint(MbSplit *s, Vector p) {
+    int i;
+    for(i = 0; i < s->pt.n; i++) {
+        if(p.Equals(s->pt.elem[i])) return i;
+    }
+    s->pt.Add(&p);
+    return s->pt.n - 1;
+}
 
-                    if((tr->a).Equals(d) && (tr->b).Equals(b)) {
-                        c = tr->c;
-                    } else if((tr->b).Equals(d) && (tr->c).Equals(b)) {
-                        c = tr->a;
-                    } else if((tr->c).Equals(d) && (tr->a).Equals(b)) {
-                        c = tr->b;
-                    } else {
-                        continue;
-                    }
-                    // The vertex at C must be convex; but the others must
-                    // be tested
-                    Vector ab = b.Minus(a);
-                    Vector bc = c.Minus(b);
-                    Vector cd = d.Minus(c);
-                    Vector de = e.Minus(d);
-
-                    double bDot = (ab.Cross(bc)).Dot(n);
-                    double dDot = (cd.Cross(de)).Dot(n);
-
-                    bDot /= min(ab.Magnitude(), bc.Magnitude());
-                    dDot /= min(cd.Magnitude(), de.Magnitude());
-
-                    if(fabs(bDot) < LENGTH_EPS && fabs(dDot) < LENGTH_EPS) {
-                        conv[WRAP((j+1), convc)] = c;
-                        // and remove the vertex at j, which is a dup
-                        memmove(conv+j, conv+j+1,
-                                          (convc - j - 1)*sizeof(conv[0]));
-                        convc--;
-                    } else if(fabs(bDot) < LENGTH_EPS && dDot > 0) {
-                        conv[j] = c;
-                    } else if(fabs(dDot) < LENGTH_EPS && bDot > 0) {
-                        conv[WRAP((j+1), convc)] = c;
-                    } else if(bDot > 0 && dDot > 0) {
-                        // conv[j] is unchanged, conv[j+1] goes to [j+2]
-                        memmove(conv+j+2, conv+j+1,
-                                            (convc - j - 1)*sizeof(conv[0]));
-                        conv[j+1] = c;
-                        convc++;
-                    } else {
-                        continue;
-                    }
+// The signed distance of point k from the line through points i and j,
+// positive to the left when looking down the normal.
+static double MbDist(MbSplit *s, int i, int j, int k) {
+    Vector pi = s->pt.elem[i], pj = s->pt.elem[j], pk = s->pt.elem[k];
+    Vector d = pj.Minus(pi);
+    return ((d.Cross(pk.Minus(pi))).Dot(s->n))/d.Magnitude();
+}
+
+// Whether the segments between points a and b and between c and d cross,
+// with each one's endpoints more than tol from the other's line.
+static bool MbCrosses(MbSplit *s, int a, int b, int c, int d, double tol) {
+    if(a == c || a == d || b == c || b == d) return false;
+    double dc = MbDist(s, a, b, c), dd = MbDist(s, a, b, d);
+    if(!((dc > tol && dd < -tol) || (dc < -tol && dd > tol))) return false;
+    double da = MbDist(s, c, d, a), db = MbDist(s, c, d, b);
+    if(!((da > tol && db < -tol) || (da < -tol && db > tol))) return false;
+    return true;
+}
+
+// The triangle with an edge from point a to point b, and the position of a
+// in it; or -1 if there isn't one.
+static int MbFindEdge(MbSplit *s, int a, int b, int *pos) {
+    int i, j;
+    for(i = 0; i < s->tri.n; i++) {
+        for(j = 0; j < 3; j++) {
+            if(s->tri.elem[i].v[j] == a && s->tri.elem[i].v[WRAP(j+1, 3)] == b)
+            {
+                if(pos) *pos = j;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+static void MbInsertPoint(MbSplit *s, int k) {
+    int i, j, best = -1, bestEdge = -1;
+    double bestMin = VERY_NEGATIVE;
+    for(i = 0; i < s->tri.n; i++) {
+        MbTri *tr = &(s->tri.elem[i]);
+        double dmin = VERY_POSITIVE;
+        int jmin = -1;
+        for(j = 0; j < 3; j++) {
+            if(tr->v[j] == k) return;
+            double d = MbDist(s, tr->v[j], tr->v[WRAP(j+1, 3)], k);
+            if(d < dmin) {
+                dmin = d;
+                jmin = j;
+            }
+        }
+        if(dmin > bestMin) {
+            bestMin = dmin;
+            best = i;
+            bestEdge = jmin;
+        }
+    }
+    // Outside the triangle that we're splitting, so nothing to do.
+    if(best < 0 || bestMin < -LENGTH_EPS) return;
+
+    MbTri tr = s->tri.elem[best], nt;
+    if(bestMin > LENGTH_EPS) {
+        // Strictly inside, so split the triangle in three.
+        s->tri.elem[best].v[2] = k;
+        nt.v[0] = tr.v[1]; nt.v[1] = tr.v[2]; nt.v[2] = k;
+        s->tri.Add(&nt);
+        nt.v[0] = tr.v[2]; nt.v[1] = tr.v[0]; nt.v[2] = k;
+        s->tri.Add(&nt);
+        return;
+    }
+
+    // On an edge, so split that edge, and the triangle on its other side
+    // too, if there is one.
+    int p = tr.v[bestEdge], q = tr.v[WRAP(bestEdge+1, 3)],
+        r = tr.v[WRAP(bestEdge+2, 3)];
+    s->tri.elem[best].v[0] = p;
+    s->tri.elem[best].v[1] = k;
+    s->tri.elem[best].v[2] = r;
+    nt.v[0] = k; nt.v[1] = q; nt.v[2] = r;
+    s->tri.Add(&nt);
+
+    int pos;
+    int other = MbFindEdge(s, q, p, &pos);
+    if(other >= 0) {
+        int w = s->tri.elem[other].v[WRAP(pos+2, 3)];
+        s->tri.elem[other].v[0] = q;
+        s->tri.elem[other].v[1] = k;
+        s->tri.elem[other].v[2] = w;
+        nt.v[0] = k; nt.v[1] = p; nt.v[2] = w;
+        s->tri.Add(&nt);
+    }
+}
 
-                    didAdd = true;
-                    tr->tag = 1;
+//-----------------------------------------------------------------------------
+// Flip edges until there's one between points a and b. Each flip replaces
+// an edge that crosses the constraint with the other diagonal of the
+// quadrilateral around it, if that's convex; we prefer flips whose new edge
+// doesn't cross the constraint too, and give up if we can't make progress.
+//-----------------------------------------------------------------------------
+static bool MbRecoverConstraint(MbSplit *s, int a, int b) {
+    int pass;
+    for(pass = 0; pass < 10*s->tri.n + 100; pass++) {
+        if(MbFindEdge(s, a, b, NULL) >= 0) return true;
+        if(MbFindEdge(s, b, a, NULL) >= 0) return true;
+
+        int good = -1, goodPos = 0, okay = -1, okayPos = 0, okayCount = 0;
+        int i, j;
+        for(i = 0; i < s->tri.n && good < 0; i++) {
+            MbTri *tr = &(s->tri.elem[i]);
+            for(j = 0; j < 3; j++) {
+                int p = tr->v[j], q = tr->v[WRAP(j+1, 3)];
+                if(p > q) continue; // each interior edge just once
+                if(!MbCrosses(s, a, b, p, q, 0)) continue;
+
+                int pos;
+                int other = MbFindEdge(s, q, p, &pos);
+                if(other < 0) continue;
+                int w1 = tr->v[WRAP(j+2, 3)],
+                    w2 = s->tri.elem[other].v[WRAP(pos+2, 3)];
+                if(!MbCrosses(s, w1, w2, p, q, 0)) continue;
+
+                if(!MbCrosses(s, a, b, w1, w2, 0)) {
+                    good = i;
+                    goodPos = j;
                     break;
                 }
+                // Otherwise a different one on each pass, so that we don't
+                // keep flipping the same edge back and forth.
+                if(okayCount++ == pass % 7 || okay < 0) {
+                    okay = i;
+                    okayPos = j;
+                }
             }
-        } while(didAdd);
-
-        // I need to debug why this is required; sometimes the above code
-        // still generates a convex polygon
-        for(i = 0; i < convc; i++) {
-            Vector a = conv[WRAP((i-1), convc)],
-                   b = conv[i],
-                   c = conv[WRAP((i+1), convc)];
-            Vector ab = b.Minus(a);
-            Vector bc = c.Minus(b);
-            double bDot = (ab.Cross(bc)).Dot(n);
-            bDot /= min(ab.Magnitude(), bc.Magnitude());
-
-            if(bDot < 0) return; // XXX, shouldn't happen
-        }
-
-        for(i = 0; i < convc - 2; i++) {
-            STriangle tr = STriangle::From(meta, conv[0], conv[i+1], conv[i+2]);
-            if(tr.MinAltitude() > LENGTH_EPS) {
-                tout[toutc++] = tr;
-            }
+        }
+        int fi = (good >= 0) ? good : okay,
+            fj = (good >= 0) ? goodPos : okayPos;
+        if(fi < 0) return false;
+
+        MbTri tr = s->tri.elem[fi];
+        int p = tr.v[fj], q = tr.v[WRAP(fj+1, 3)], w1 = tr.v[WRAP(fj+2, 3)];
+        int pos;
+        int other = MbFindEdge(s, q, p, &pos);
+        int w2 = s->tri.elem[other].v[WRAP(pos+2, 3)];
+        s->tri.elem[fi].v[0] = p;
+        s->tri.elem[fi].v[1] = w2;
+        s->tri.elem[fi].v[2] = w1;
+        s->tri.elem[other].v[0] = w2;
+        s->tri.elem[other].v[1] = q;
+        s->tri.elem[other].v[2] = w1;
+    }
+    return false;
+}
+
+static bool MbIsConstraint(MbSplit *s, int a, int b) {
+    int i;
+    for(i = 0; i < s->con.n; i++) {
+        MbConstraint *c = &(s->con.elem[i]);
+        if((c->a == a && c->b == b) || (c->a == b && c->b == a)) return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Split a triangle along its cuts, and add the pieces to out, marking their
+// edges that lie along a cut in their tags. The cuts get split where they
+// cross each other or pass through each other's endpoints, so that they
+// become edges of the triangulation without adding any more points.
+//-----------------------------------------------------------------------------
+static void MbSplitTriangle(STriangle *tr, SEdgeList *cut, SMesh *out) {
+    if(cut->l.n == 0) {
+        STriangle st = *tr;
+        st.tag = 0;
+        out->AddTriangle(&st);
+        return;
+    }
+
+    MbSplit s;
+    ZERO(&s);
+    s.n = (tr->Normal()).WithMagnitude(1);
+    MbAddPoint(&s, tr->a);
+    MbAddPoint(&s, tr->b);
+    MbAddPoint(&s, tr->c);
+    MbTri first = { { 0, 1, 2 } };
+    s.tri.Add(&first);
+
+    int i, j, k;
+    for(i = 0; i < cut->l.n; i++) {
+        MbConstraint c;
+        c.a = MbAddPoint(&s, cut->l.elem[i].a);
+        c.b = MbAddPoint(&s, cut->l.elem[i].b);
+        if(c.a != c.b && !MbIsConstraint(&s, c.a, c.b)) s.con.Add(&c);
+    }
+
+    // Where two cuts cross, add the point where they cross; the cuts get
+    // split there below.
+    int ncon = s.con.n;
+    for(i = 0; i < ncon; i++) {
+        for(j = 0; j < i; j++) {
+            MbConstraint *ci = &(s.con.elem[i]), *cj = &(s.con.elem[j]);
+            if(!MbCrosses(&s, ci->a, ci->b, cj->a, cj->b, LENGTH_EPS)) continue;
+
+            double da = MbDist(&s, cj->a, cj->b, ci->a),
+                   db = MbDist(&s, cj->a, cj->b, ci->b);
+            Vector pa = s.pt.elem[ci->a], pb = s.pt.elem[ci->b];
+            MbAddPoint(&s, pa.Plus((pb.Minus(pa)).ScaledBy(da/(da - db))));
+        }
+    }
+
+    // Where a point lies on a cut, split the cut there.
+    for(i = 0; i < s.con.n; i++) {
+        for(k = 0; k < s.pt.n; k++) {
+            MbConstraint *c = &(s.con.elem[i]);
+            if(k == c->a || k == c->b) continue;
+            Vector pa = s.pt.elem[c->a], pb = s.pt.elem[c->b],
+                   pk = s.pt.elem[k];
+            Vector ab = pb.Minus(pa);
+            double t = (pk.Minus(pa)).Dot(ab)/ab.Dot(ab);
+            if(t <= 0 || t >= 1) continue;
+            if(pk.DistanceToLine(pa, ab) > LENGTH_EPS) continue;
+
+            MbConstraint rest = { k, c->b };
+            c->b = k;
+            if(!MbIsConstraint(&s, rest.a, rest.b)) s.con.Add(&rest);
         }
     }
 
-    l.n = start0;
-    for(i = 0; i < toutc; i++) {
-        AddTriangle(&(tout[i]));
+    for(k = 3; k < s.pt.n; k++) {
+        MbInsertPoint(&s, k);
     }
-    FreeTemporary(tout);
-    FreeTemporary(conv);
+    for(i = 0; i < s.con.n; i++) {
+        MbRecoverConstraint(&s, s.con.elem[i].a, s.con.elem[i].b);
+    }
+
+    for(i = 0; i < s.tri.n; i++) {
+        MbTri *mt = &(s.tri.elem[i]);
+        STriangle st;
+        ZERO(&st);
+        st.meta = tr->meta;
+        st.a = s.pt.elem[mt->v[0]];
+        st.b = s.pt.elem[mt->v[1]];
+        st.c = s.pt.elem[mt->v[2]];
+        for(j = 0; j < 3; j++) {
+            if(MbIsConstraint(&s, mt->v[j], mt->v[WRAP(j+1, 3)])) {
+                st.tag |= (1 << j);
+            }
+        }
+        out->AddTriangle(&st);
+    }
+
+    s.pt.Clear();
+    s.tri.Clear();
+    s.con.Clear();
 }
 
-void SMesh::AddAgainstBsp(SMesh *srcm, SBsp3 *bsp3) {
+static void MbSplitTriangleOf(void *data, int i) {
+    MbOperand *op = (MbOperand *)data;
+    MbSplitTriangle(&(op->m.l.elem[i]), &(op->cut.elem[i]),
+                    &(op->piece.elem[i]));
+}
+
+//-----------------------------------------------------------------------------
+// Classify the point p, on a piece with normal n, against the operand: it's
+// on the operand's surface if it lies on one of its triangles, and otherwise
+// inside if a ray from it crosses the surface an odd number of times. If the
+// ray passes too close to an edge, or grazes a triangle, then the count
+// could be wrong, so we try again in a different direction.
+//-----------------------------------------------------------------------------
+static int MbClassify(MbOperand *op, Vector p, Vector n) {
+    if(op->m.l.n == 0) return MB_OUTSIDE;
+
+    List<int> near;
+    ZERO(&near);
+    Vector eps = Vector::From(LENGTH_EPS, LENGTH_EPS, LENGTH_EPS);
+    op->bvh.FindOverlapping(p.Plus(eps), p.Minus(eps), &near);
     int i;
+    for(i = 0; i < near.n; i++) {
+        STriangle *u = &(op->m.l.elem[near.elem[i]]);
+        Vector nu = (u->Normal()).WithMagnitude(1);
+        if(fabs(nu.Dot(p.Minus(u->a))) > LENGTH_EPS) continue;
+        if(!u->ContainsPointProjd(nu, p)) continue;
+
+        near.Clear();
+        return (nu.Dot(n) > 0) ? MB_COINC_SAME : MB_COINC_OPP;
+    }
 
-    for(i = 0; i < srcm->l.n; i++) {
-        STriangle *st = &(srcm->l.elem[i]);
-        int pn = l.n;
-        atLeastOneDiscarded = false;
-        bsp3->Insert(st, this);
-        if(!atLeastOneDiscarded && (l.n != (pn+1))) {
-            l.n = pn;
-            if(flipNormal) {
-                AddTriangle(st->meta, st->c, st->b, st->a);
+    static const double DIRS[][3] = {
+        {  0.5497,  0.6386,  0.5385 },
+        { -0.7213,  0.3057,  0.6215 },
+        {  0.2134, -0.8715,  0.4416 },
+        { -0.3561, -0.4789, -0.8024 },
+        {  0.8170, -0.2308, -0.5285 },
+        { -0.1092,  0.9441, -0.3110 },
+    };
+    double len = (op->max.Minus(op->min)).Magnitude() +
+                 (p.Minus(op->min)).Magnitude() + 1;
+
+    int d, crossings = 0;
+    for(d = 0; d < (int)(sizeof(DIRS)/sizeof(DIRS[0])); d++) {
+        Vector dir = Vector::From(DIRS[d][0], DIRS[d][1], DIRS[d][2]);
+        dir = dir.WithMagnitude(1);
+
+        near.Clear();
+        op->bvh.FindAlongLine(p, p.Plus(dir.ScaledBy(len)), true, &near);
+
+        bool ambiguous = false;
+        crossings = 0;
+        for(i = 0; i < near.n && !ambiguous; i++) {
+            STriangle *u = &(op->m.l.elem[near.elem[i]]);
+            Vector nu = (u->Normal()).WithMagnitude(1);
+            double dn = dir.Dot(nu), h = nu.Dot(u->a.Minus(p));
+            if(fabs(dn) < 1e-6) {
+                if(fabs(h) < LENGTH_EPS) ambiguous = true;
+                continue;
+            }
+            double t = h/dn;
+            // Behind us, or we're in its plane but (from above) outside it.
+            if(t < LENGTH_EPS) continue;
+
+            Vector q = p.Plus(dir.ScaledBy(t));
+            Vector uv[3] = { u->a, u->b, u->c };
+            int j, in = 0, out = 0;
+            for(j = 0; j < 3; j++) {
+                Vector e = uv[WRAP(j+1, 3)].Minus(uv[j]);
+                double de = ((nu.Cross(e)).WithMagnitude(1)).Dot(
+                                q.Minus(uv[j]));
+                if(de > LENGTH_EPS) in++;
+                if(de < -LENGTH_EPS) out++;
+            }
+            if(out > 0) continue;
+            if(in == 3) {
+                crossings++;
             } else {
-                AddTriangle(st->meta, st->a, st->b, st->c);
+                ambiguous = true;
             }
         }
-        if(l.n - pn > 1) {
-            Simplify(pn);
-        }
+        if(!ambiguous) break;
     }
+    near.Clear();
+
+    return (crossings % 2) ? MB_INSIDE : MB_OUTSIDE;
 }
 
-void SMesh::MakeFromUnionOf(SMesh *a, SMesh *b) {
-    SBsp3 *bspa = SBsp3::FromMesh(a);
-    SBsp3 *bspb = SBsp3::FromMesh(b);
+typedef struct {
+    MbOperand       *op, *against;
+    // A piece of each patch, and where that patch lies
+    List<int>       rep;
+    List<int>       where;
+} MbClassifyJob;
+
+static void MbClassifyPatch(void *data, int i) {
+    MbClassifyJob *job = (MbClassifyJob *)data;
+    STriangle *tr = &(job->op->split.l.elem[job->rep.elem[i]]);
+    Vector c = ((tr->a).Plus(tr->b).Plus(tr->c)).ScaledBy(1.0/3);
+    job->where.elem[i] = MbClassify(job->against, c, tr->Normal());
+}
 
-    flipNormal = false;
-    keepCoplanar = false;
-    AddAgainstBsp(b, bspa);
+static int MbFindRoot(List<int> *parent, int i) {
+    while(parent->elem[i] != i) {
+        parent->elem[i] = parent->elem[parent->elem[i]];
+        i = parent->elem[i];
+    }
+    return i;
+}
 
-    flipNormal = false;
-    keepCoplanar = true;
-    AddAgainstBsp(a, bspb);
+//-----------------------------------------------------------------------------
+// Split an operand's triangles along their cuts, group the pieces into
+// patches that are connected across edges that don't lie on a cut, and
+// classify each patch against the other operand.
+//-----------------------------------------------------------------------------
+static void MbSplitAndClassify(MbOperand *op, MbOperand *against) {
+    ParallelFor(op->m.l.n, MbSplitTriangleOf, op);
+    int i;
+    for(i = 0; i < op->piece.n; i++) {
+        op->split.MakeFromCopyOf(&(op->piece.elem[i]));
+    }
+
+    int n = op->split.l.n;
+    SIndexedMesh im;
+    ZERO(&im);
+    im.MakeFromMesh(&(op->split));
+    im.MakeAdjacency();
+
+    List<int> parent;
+    ZERO(&parent);
+    parent.Resize(n);
+    for(i = 0; i < n; i++) parent.elem[i] = i;
+    int e;
+    for(e = 0; e < im.twin.n; e++) {
+        int f = im.twin.elem[e];
+        if(f < e) continue;
+        if(op->split.l.elem[e/3].tag & (1 << (e%3))) continue;
+        if(op->split.l.elem[f/3].tag & (1 << (f%3))) continue;
+        int ra = MbFindRoot(&parent, e/3), rb = MbFindRoot(&parent, f/3);
+        if(ra != rb) parent.elem[ra] = rb;
+    }
+    im.Clear();
+
+    // Classify each patch by its largest piece, whose centroid is least
+    // likely to be close to some other surface.
+    MbClassifyJob job;
+    ZERO(&job);
+    job.op = op;
+    job.against = against;
+    List<int> patch;
+    ZERO(&patch);
+    patch.Resize(n);
+    for(i = 0; i < n; i++) {
+        int r = MbFindRoot(&parent, i);
+        if(r == i) {
+            patch.elem[i] = job.rep.n;
+            job.rep.Add(&i);
+        }
+    }
+    for(i = 0; i < n; i++) {
+        int pi = patch.elem[MbFindRoot(&parent, i)];
+        patch.elem[i] = pi;
+        int *rep = &(job.rep.elem[pi]);
+        if((op->split.l.elem[i].Normal()).Magnitude() >
+           (op->split.l.elem[*rep].Normal()).Magnitude())
+        {
+            *rep = i;
+        }
+    }
+    job.where.Resize(job.rep.n);
+    ParallelFor(job.rep.n, MbClassifyPatch, &job);
+
+    op->where.Resize(n);
+    for(i = 0; i < n; i++) {
+        op->where.elem[i] = job.where.elem[patch.elem[i]];
+    }
+
+    parent.Clear();
+    patch.Clear();
+    job.rep.Clear();
+    job.where.Clear();
 }
 
-void SMesh::MakeFromDifferenceOf(SMesh *a, SMesh *b) {
-    SBsp3 *bspa = SBsp3::FromMesh(a);
-    SBsp3 *bspb = SBsp3::FromMesh(b);
+//-----------------------------------------------------------------------------
+// Make the union or difference of two meshes. Where the surfaces coincide,
+// the rules are the same as the BSP used to apply: on a union we keep one
+// copy if the normals agree, and neither if they don't; on a difference we
+// keep the copy from b, reversed, if they don't. The pieces are welded
+// together at the end, so the result is watertight wherever the operands
+// were.
+//-----------------------------------------------------------------------------
+static void MbBoolean(SMesh *dest, SMesh *ma, SMesh *mb, bool difference) {
+    MbOperand a, b;
+    MbBegin(&a, ma);
+    MbBegin(&b, mb);
+
+    MbIntersectJob job;
+    ZERO(&job);
+    job.a = &a;
+    job.b = &b;
+    job.hits.Resize(a.m.l.n);
+    memset(job.hits.elem, 0, a.m.l.n*sizeof(job.hits.elem[0]));
+    ParallelFor(a.m.l.n, MbIntersectTriangle, &job);
+
+    int i, j;
+    for(i = 0; i < job.hits.n; i++) {
+        SEdgeList *hits = &(job.hits.elem[i]);
+        for(j = 0; j < hits->l.n; j++) {
+            SEdge *se = &(hits->l.elem[j]);
+            SEdgeList *cut = (se->auxA < 0) ? &(a.cut.elem[i]) :
+                                              &(b.cut.elem[se->auxA]);
+            cut->AddEdge(se->a, se->b);
+        }
+        hits->Clear();
+    }
+    job.hits.Clear();
+
+    MbSplitAndClassify(&a, &b);
+    MbSplitAndClassify(&b, &a);
+
+    SMesh keep;
+    ZERO(&keep);
+    for(i = 0; i < b.split.l.n; i++) {
+        STriangle *tr = &(b.split.l.elem[i]);
+        int where = b.where.elem[i];
+        if(difference) {
+            if(where == MB_INSIDE || where == MB_COINC_OPP) {
+                keep.AddTriangle(tr->meta, tr->c, tr->b, tr->a);
+            }
+        } else {
+            if(where == MB_OUTSIDE) {
+                keep.AddTriangle(tr->meta, tr->a, tr->b, tr->c);
+            }
+        }
+    }
+    for(i = 0; i < a.split.l.n; i++) {
+        STriangle *tr = &(a.split.l.elem[i]);
+        int where = a.where.elem[i];
+        if(where == MB_OUTSIDE || (!difference && where == MB_COINC_SAME)) {
+            keep.AddTriangle(tr->meta, tr->a, tr->b, tr->c);
+        }
+    }
 
-    flipNormal = true;
-    keepCoplanar = true;
-    AddAgainstBsp(b, bspa);
+    SIndexedMesh im;
+    ZERO(&im);
+    im.MakeFromMesh(&keep);
+    im.MakeMeshInto(dest);
+    im.Clear();
+    keep.Clear();
 
-    flipNormal = false;
-    keepCoplanar = false;
-    AddAgainstBsp(a, bspb);
+    MbEnd(&a);
+    MbEnd(&b);
+}
+
+void SMesh::MakeFromUnionOf(SMesh *a, SMesh *b) {
+    MbBoolean(this, a, b, false);
+}
+
+void SMesh::MakeFromDifferenceOf(SMesh *a, SMesh *b) {
+    MbBoolean(this, a, b, true);
 }
 
 void SMesh::MakeFromCopyOf(SMesh *a) {
@@ -356,135 +929,282 @@ uint32_t SMesh::FirstIntersectionWith(Point2d mp) {
 }
 
 STriangleLl *STriangleLl::Alloc(void)
-    { return (STriangleLl *)AllocTemporary(sizeof(STriangleLl)); }
+    { return (STriangleLl *)AllocTemporaryNode(sizeof(STriangleLl)); }
 SKdNode *SKdNode::Alloc(void)
-    { return (SKdNode *)AllocTemporary(sizeof(SKdNode)); }
-
-SKdNode *SKdNode::From(SMesh *m) {
-    int i;
-    STriangle *tra = (STriangle *)AllocTemporary((m->l.n) * sizeof(*tra));
-
-    for(i = 0; i < m->l.n; i++) {
-        tra[i] = m->l.elem[i];
-    }
+    { return (SKdNode *)AllocTemporaryNode(sizeof(SKdNode)); }
 
-    srand(0);
-    int n = m->l.n;
-    while(n > 1) {
-        int k = rand() % n;
-        n--;
-        swap(tra[k], tra[n]);
-    }
-
-    STriangleLl *tll = NULL;
-    for(i = 0; i < m->l.n; i++) {
-        STriangleLl *tn = STriangleLl::Alloc();
-        tn->tri = &(tra[i]);
-        tn->next = tll;
-        tll = tn;
-    }
-
-    return SKdNode::From(tll);
+//-----------------------------------------------------------------------------
+// Build a kd tree for a mesh. Each split is chosen with the surface area
+// heuristic: of the candidate planes along each axis, take the one for which
+// the triangles on each side, weighted by the area of that side's cell, are
+// fewest; since that's proportional to the expected cost of a query. A
+// triangle within KDTREE_EPS of the plane goes on both sides, same as the
+// queries expect.
+//
+// The tree gets built into flat lists first. Below the first few levels the
+// subtrees are independent, so we build those on many threads at once, and
+// then copy the whole thing into nodes on the temporary heap.
+//-----------------------------------------------------------------------------
+typedef struct {
+    int         which;
+    double      c;
+    int         lt, gt;     // the children, or -1 if this is a leaf
+    int         start, n;   // a leaf's triangles, within the tree's tri
+    int         sub;        // the subtree that's built separately, or -1
+} KdBuildNode;
+
+typedef struct {
+    List<KdBuildNode>   node;
+    List<int>           tri;
+} KdBuildTree;
+
+typedef struct {
+    List<int>           in;
+    Vector              cmax, cmin;
+    int                 depth;
+    KdBuildTree         tree;
+} KdSubtree;
+
+typedef struct {
+    STriangle           *tra;
+    List<Vector>        tmax, tmin;
+    int                 maxDepth;
+    List<KdSubtree>     sub;
+} KdBuild;
+
+enum {
+    KD_BINS             = 32,
+    KD_MIN_SPLIT        = 3,
+    // Build the subtrees below this depth separately, if the mesh is big
+    // enough to be worth it.
+    KD_SUBTREE_DEPTH    = 4,
+    KD_SUBTREE_MIN_TRIS = 4096
+};
+
+static double KdCellArea(Vector cmax, Vector cmin) {
+    Vector d = cmax.Minus(cmin);
+    d.x = max(d.x, KDTREE_EPS);
+    d.y = max(d.y, KDTREE_EPS);
+    d.z = max(d.z, KDTREE_EPS);
+    return 2*(d.x*d.y + d.y*d.z + d.z*d.x);
 }
 
-SKdNode *SKdNode::From(STriangleLl *tll) {
-    int which = 0;
-    SKdNode *ret = Alloc();
-
-    int i;
-    int gtc[3] = { 0, 0, 0 }, ltc[3] = { 0, 0, 0 }, allc = 0;
-    double badness[3] = { 0, 0, 0 };
-    double split[3] = { 0, 0, 0 };
+static int KdBin(double x, double lo, double w) {
+    double b = floor((x - lo)/w);
+    if(b < 0) return 0;
+    if(b > KD_BINS) return KD_BINS;
+    return (int)b;
+}
 
-    if(!tll) {
-        goto leaf;
+static int KdBuildNodeFor(KdBuild *kb, KdBuildTree *t, List<int> *in,
+                          Vector cmax, Vector cmin, int depth, bool top)
+{
+    KdBuildNode bn;
+    ZERO(&bn);
+    bn.lt = bn.gt = bn.sub = -1;
+    int self = t->node.n;
+    t->node.Add(&bn);
+
+    int n = in->n;
+    if(top && depth == KD_SUBTREE_DEPTH) {
+        // Leave this one for later, on its own thread.
+        KdSubtree ks;
+        ZERO(&ks);
+        ks.in = *in;
+        ZERO(in);
+        ks.cmax = cmax;
+        ks.cmin = cmin;
+        ks.depth = depth;
+        t->node.elem[self].sub = kb->sub.n;
+        kb->sub.Add(&ks);
+        return self;
     }
 
-    for(i = 0; i < 3; i++) {
-        int tcnt = 0;
-        STriangleLl *ll;
-        for(ll = tll; ll; ll = ll->next) {
-            STriangle *tr = ll->tri;
-            split[i] += (ll->tri->a).Element(i);
-            split[i] += (ll->tri->b).Element(i);
-            split[i] += (ll->tri->c).Element(i);
-            tcnt++;
-        }
-        split[i] /= (tcnt*3);
-
-        for(ll = tll; ll; ll = ll->next) {
-            STriangle *tr = ll->tri;
-
-            double a = (tr->a).Element(i),
-                   b = (tr->b).Element(i),
-                   c = (tr->c).Element(i);
-
-            if(a < split[i] + KDTREE_EPS ||
-               b < split[i] + KDTREE_EPS ||
-               c < split[i] + KDTREE_EPS)
-            {
-                ltc[i]++;
+    int which = -1;
+    double c = 0;
+    if(n >= KD_MIN_SPLIT && depth < kb->maxDepth) {
+        double area = KdCellArea(cmax, cmin),
+               bestCost = n*area;
+        int i, k, axis;
+        for(axis = 0; axis < 3; axis++) {
+            double lo = cmin.Element(axis), hi = cmax.Element(axis),
+                   w = (hi - lo)/KD_BINS;
+            if(w <= 0) continue;
+
+            // A triangle goes on the lt side of the plane at the start of
+            // bin k if its min is in a bin before k, and on the gt side if
+            // its max is in bin k or after.
+            int startc[KD_BINS+1], endc[KD_BINS+1];
+            for(k = 0; k <= KD_BINS; k++) {
+                startc[k] = endc[k] = 0;
             }
-            if(a > split[i] - KDTREE_EPS ||
-               b > split[i] - KDTREE_EPS ||
-               c > split[i] - KDTREE_EPS)
-            {
-                gtc[i]++;
+            for(i = 0; i < n; i++) {
+                int ti = in->elem[i];
+                startc[KdBin(kb->tmin.elem[ti].Element(axis) - KDTREE_EPS,
+                             lo, w)]++;
+                endc[KdBin(kb->tmax.elem[ti].Element(axis) + KDTREE_EPS,
+                           lo, w)]++;
+            }
+
+            int ltc = 0, gtc = n;
+            for(k = 1; k < KD_BINS; k++) {
+                ltc += startc[k-1];
+                gtc -= endc[k-1];
+
+                double plane = lo + k*w;
+                Vector lmax = cmax, gmin = cmin;
+                if(axis == 0) { lmax.x = plane; gmin.x = plane; }
+                if(axis == 1) { lmax.y = plane; gmin.y = plane; }
+                if(axis == 2) { lmax.z = plane; gmin.z = plane; }
+
+                double cost = area + KdCellArea(lmax, cmin)*ltc +
+                                     KdCellArea(cmax, gmin)*gtc;
+                if(cost < bestCost) {
+                    bestCost = cost;
+                    which = axis;
+                    c = plane;
+                }
             }
-            if(i == 0) allc++;
         }
-        badness[i] = pow((double)ltc[i], 4) + pow((double)gtc[i], 4);
     }
-    if(badness[0] < badness[1] && badness[0] < badness[2]) {
-        which = 0;
-    } else if(badness[1] < badness[2]) {
-        which = 1;
-    } else {
-        which = 2;
+
+    List<int> lt, gt;
+    ZERO(&lt);
+    ZERO(&gt);
+    if(which >= 0) {
+        int i;
+        for(i = 0; i < n; i++) {
+            int ti = in->elem[i];
+            if(kb->tmin.elem[ti].Element(which) < c + KDTREE_EPS) lt.Add(&ti);
+            if(kb->tmax.elem[ti].Element(which) > c - KDTREE_EPS) gt.Add(&ti);
+        }
+        if(lt.n == n || gt.n == n) {
+            // Everything's on one side, so the split doesn't help.
+            which = -1;
+        }
     }
 
-    if(allc < 3 || allc == gtc[which] || allc == ltc[which]) {
-        goto leaf;
+    if(which < 0) {
+        t->node.elem[self].start = t->tri.n;
+        t->node.elem[self].n = n;
+        int i;
+        for(i = 0; i < n; i++) {
+            t->tri.Add(&(in->elem[i]));
+        }
+        in->Clear();
+        lt.Clear();
+        gt.Clear();
+        return self;
     }
+    in->Clear();
+
+    Vector lmax = cmax, gmin = cmin;
+    if(which == 0) { lmax.x = c; gmin.x = c; }
+    if(which == 1) { lmax.y = c; gmin.y = c; }
+    if(which == 2) { lmax.z = c; gmin.z = c; }
+
+    // The node list may get reallocated while we build the children, so
+    // don't hold a pointer into it.
+    int ltn = KdBuildNodeFor(kb, t, &lt, lmax, cmin, depth + 1, top),
+        gtn = KdBuildNodeFor(kb, t, &gt, cmax, gmin, depth + 1, top);
+    t->node.elem[self].which = which;
+    t->node.elem[self].c = c;
+    t->node.elem[self].lt = ltn;
+    t->node.elem[self].gt = gtn;
+    return self;
+}
 
-    STriangleLl *ll;
-    STriangleLl *lgt, *llt; lgt = llt = NULL;
-    for(ll = tll; ll; ll = ll->next) {
-        STriangle *tr = ll->tri;
+static void KdBuildSubtree(void *data, int i) {
+    KdBuild *kb = (KdBuild *)data;
+    KdSubtree *ks = &(kb->sub.elem[i]);
+    KdBuildNodeFor(kb, &(ks->tree), &(ks->in), ks->cmax, ks->cmin,
+                   ks->depth, false);
+}
 
-        double a = (tr->a).Element(which),
-               b = (tr->b).Element(which),
-               c = (tr->c).Element(which);
+static SKdNode *KdCopyNode(KdBuild *kb, KdBuildTree *t, int i,
+                           SKdNode **nodes, STriangleLl **lls)
+{
+    KdBuildNode *bn = &(t->node.elem[i]);
+    if(bn->sub >= 0) {
+        return KdCopyNode(kb, &(kb->sub.elem[bn->sub].tree), 0, nodes, lls);
+    }
 
-        if(a < split[which] + KDTREE_EPS ||
-           b < split[which] + KDTREE_EPS ||
-           c < split[which] + KDTREE_EPS)
-        {
-            STriangleLl *n = STriangleLl::Alloc();
-            *n = *ll;
-            n->next = llt;
-            llt = n;
-        }
-        if(a > split[which] - KDTREE_EPS ||
-           b > split[which] - KDTREE_EPS ||
-           c > split[which] - KDTREE_EPS)
-        {
-            STriangleLl *n = STriangleLl::Alloc();
-            *n = *ll;
-            n->next = lgt;
-            lgt = n;
+    SKdNode *ret = (*nodes)++;
+    if(bn->lt >= 0) {
+        ret->which = bn->which;
+        ret->c = bn->c;
+        ret->lt = KdCopyNode(kb, t, bn->lt, nodes, lls);
+        ret->gt = KdCopyNode(kb, t, bn->gt, nodes, lls);
+    } else {
+        int j;
+        for(j = bn->start; j < bn->start + bn->n; j++) {
+            STriangleLl *ll = (*lls)++;
+            ll->tri = &(kb->tra[t->tri.elem[j]]);
+            ll->next = ret->tris;
+            ret->tris = ll;
         }
     }
-
-    ret->which = which;
-    ret->c = split[which];
-    ret->gt = SKdNode::From(lgt);
-    ret->lt = SKdNode::From(llt);
     return ret;
+}
 
-leaf:
-    ret->tris = tll;
-    return ret;
+SKdNode *SKdNode::From(SMesh *m) {
+    KdBuild kb;
+    ZERO(&kb);
+
+    int i, n = m->l.n;
+    kb.tra = (STriangle *)AllocTemporary(max(n, 1) * sizeof(*kb.tra));
+
+    Vector cmax = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE),
+           cmin = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+    List<int> in;
+    ZERO(&in);
+    for(i = 0; i < n; i++) {
+        STriangle *tr = &(kb.tra[i]);
+        *tr = m->l.elem[i];
+
+        Vector tmax = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE),
+               tmin = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+        (tr->a).MakeMaxMin(&tmax, &tmin);
+        (tr->b).MakeMaxMin(&tmax, &tmin);
+        (tr->c).MakeMaxMin(&tmax, &tmin);
+        kb.tmax.Add(&tmax);
+        kb.tmin.Add(&tmin);
+        tmax.MakeMaxMin(&cmax, &cmin);
+        tmin.MakeMaxMin(&cmax, &cmin);
+        in.Add(&i);
+    }
+    // Deep enough for a good tree, but not so deep that a bad mesh (with
+    // many triangles that straddle every plane) can blow up.
+    kb.maxDepth = 8 + (int)(1.3*log2((double)(n + 1)));
+
+    KdBuildTree top;
+    ZERO(&top);
+    KdBuildNodeFor(&kb, &top, &in, cmax, cmin, 0, n >= KD_SUBTREE_MIN_TRIS);
+    ParallelFor(kb.sub.n, KdBuildSubtree, &kb);
+
+    // And copy everything into the nodes that the queries use, in just two
+    // allocations.
+    int nodec = top.node.n, llc = top.tri.n;
+    for(i = 0; i < kb.sub.n; i++) {
+        nodec += kb.sub.elem[i].tree.node.n;
+        llc += kb.sub.elem[i].tree.tri.n;
+    }
+    SKdNode *nodes = (SKdNode *)AllocTemporary(nodec * sizeof(*nodes));
+    STriangleLl *lls =
+        (STriangleLl *)AllocTemporary(max(llc, 1) * sizeof(*lls));
+    SKdNode *root = KdCopyNode(&kb, &top, 0, &nodes, &lls);
+
+    for(i = 0; i < kb.sub.n; i++) {
+        kb.sub.elem[i].in.Clear();
+        kb.sub.elem[i].tree.node.Clear();
+        kb.sub.elem[i].tree.tri.Clear();
+    }
+    kb.sub.Clear();
+    kb.tmax.Clear();
+    kb.tmin.Clear();
+    top.node.Clear();
+    top.tri.Clear();
+    return root;
 }
 
 void SKdNode::ClearTags(void) {
@@ -628,7 +1348,7 @@ void SKdNode::SnapToMesh(SMesh *m) {
             SnapToVertex(v, &extra);
 
             for(k = 0; k < extra.l.n; k++) {
-                STriangle *tra = (STriangle *)AllocTemporary(sizeof(*tra));
+                STriangle *tra = (STriangle *)AllocTemporaryNode(sizeof(*tra));
                 *tra = extra.l.elem[k];
                 AddTriangle(tra);
             }
@@ -637,154 +1357,6 @@ void SKdNode::SnapToMesh(SMesh *m) {
     }
 }
 
-//-----------------------------------------------------------------------------
-// For all the edges in sel, split them against the given triangle, and test
-// them for occlusion. Keep only the visible segments. sel is both our input
-// and our output.
-//-----------------------------------------------------------------------------
-void SKdNode::SplitLinesAgainstTriangle(SEdgeList *sel, STriangle *tr) {
-    SEdgeList seln;
-    ZERO(&seln);
-
-    Vector tn = tr->Normal().WithMagnitude(1);
-    double td = tn.Dot(tr->a);
-
-    // Consider front-facing triangles only.
-    if(tn.z > LENGTH_EPS) {
-        // If the edge crosses our triangle's plane, then split into above
-        // and below parts. Note that we must preserve auxA, which contains
-        // the style associated with this line.
-        SEdge *se;
-        for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
-            double da = (se->a).Dot(tn) - td,
-                   db = (se->b).Dot(tn) - td;
-            if((da < -LENGTH_EPS && db > LENGTH_EPS) ||
-               (db < -LENGTH_EPS && da > LENGTH_EPS))
-            {
-                Vector m = Vector::AtIntersectionOfPlaneAndLine(
-                                        tn, td,
-                                        se->a, se->b, NULL);
-                seln.AddEdge(m, se->b, se->auxA);
-                se->b = m;
-            }
-        }
-        for(se = seln.l.First(); se; se = seln.l.NextAfter(se)) {
-            sel->AddEdge(se->a, se->b, se->auxA);
-        }
-        seln.Clear();
-
-        for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
-            Vector pt = ((se->a).Plus(se->b)).ScaledBy(0.5);
-            double dt = pt.Dot(tn) - td;
-            if(pt.Dot(tn) - td > -LENGTH_EPS) {
-                // Edge is in front of or on our plane (remember, tn.z > 0)
-                // so it is exempt from further splitting
-                se->auxB = 1;
-            } else {
-                // Edge is behind our plane, needs further splitting
-                se->auxB = 0;
-            }
-        }
-
-        // Considering only the (x, y) coordinates, split the edge against our
-        // triangle.
-        Point2d a = (tr->a).ProjectXy(),
-                b = (tr->b).ProjectXy(),
-                c = (tr->c).ProjectXy();
-
-        Point2d n[3] = { (b.Minus(a)).Normal().WithMagnitude(1),
-                         (c.Minus(b)).Normal().WithMagnitude(1),
-                         (a.Minus(c)).Normal().WithMagnitude(1)  };
-
-        double d[3] = { n[0].Dot(b),
-                        n[1].Dot(c),
-                        n[2].Dot(a)  };
-
-        // Split all of the edges where they intersect the triangle edges
-        int i;
-        for(i = 0; i < 3; i++) {
-            for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
-                if(se->auxB) continue;
-
-                Point2d ap = (se->a).ProjectXy(),
-                        bp = (se->b).ProjectXy();
-                double da = n[i].Dot(ap) - d[i],
-                       db = n[i].Dot(bp) - d[i];
-                if((da < -LENGTH_EPS && db > LENGTH_EPS) ||
-                   (db < -LENGTH_EPS && da > LENGTH_EPS))
-                {
-                    double dab = (db - da);
-                    Vector spl = ((se->a).ScaledBy( db/dab)).Plus(
-                                  (se->b).ScaledBy(-da/dab));
-                    seln.AddEdge(spl, se->b, se->auxA);
-                    se->b = spl;
-                }
-            }
-            for(se = seln.l.First(); se; se = seln.l.NextAfter(se)) {
-                // The split pieces are all behind the triangle, since only
-                // edges behind the triangle got split. So their auxB is 0.
-                sel->AddEdge(se->a, se->b, se->auxA, 0);
-            }
-            seln.Clear();
-        }
-
-        for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
-            if(se->auxB) {
-                // Lies above or on the triangle plane, so triangle doesn't
-                // occlude it.
-                se->tag = 0;
-            } else {
-                // Test the segment to see if it lies outside the triangle
-                // (i.e., outside wrt at least one edge), and keep it only
-                // then.
-                Point2d pt = ((se->a).Plus(se->b).ScaledBy(0.5)).ProjectXy();
-                se->tag = 1;
-                for(i = 0; i < 3; i++) {
-                    // If the test point lies on the boundary of our triangle,
-                    // then we still discard the edge.
-                    if(n[i].Dot(pt) - d[i] > LENGTH_EPS) se->tag = 0;
-                }
-            }
-        }
-        sel->l.RemoveTagged();
-    }
-}
-
-//-----------------------------------------------------------------------------
-// Given an edge orig, occlusion test it against our mesh. We output an edge
-// list in sel, containing the visible portions of that edge.
-//-----------------------------------------------------------------------------
-void SKdNode::OcclusionTestLine(SEdge orig, SEdgeList *sel, int cnt) {
-    if(gt && lt) {
-        double ac = (orig.a).Element(which),
-               bc = (orig.b).Element(which);
-        // We can ignore triangles that are separated in x or y, but triangles
-        // that are separated in z may still contribute
-        if(ac < c + KDTREE_EPS ||
-           bc < c + KDTREE_EPS ||
-           which == 2)
-        {
-            lt->OcclusionTestLine(orig, sel, cnt);
-        }
-        if(ac > c - KDTREE_EPS ||
-           bc > c - KDTREE_EPS ||
-           which == 2)
-        {
-            gt->OcclusionTestLine(orig, sel, cnt);
-        }
-    } else {
-        STriangleLl *ll;
-        for(ll = tris; ll; ll = ll->next) {
-            STriangle *tr = ll->tri;
-
-            if(tr->tag == cnt) continue;
-
-            SplitLinesAgainstTriangle(sel, tr);
-            tr->tag = cnt;
-        }
-    }
-}
-
 //-----------------------------------------------------------------------------
 // Search the mesh for a triangle with an edge from b to a (i.e., the mate
 // for the edge from a to b), and increment *n each time that we find one.
@@ -975,3 +1547,206 @@ void SKdNode::MakeCertainEdgesInto(SEdgeList *sel, int how,
     m.Clear();
 }
 
+
+//-----------------------------------------------------------------------------
+// A hash table that welds points as they're added: each point gets the
+// index of the first one already added that it coincides with, or else a
+// new index of its own. With a tolerance, a point is hashed by the grid cell
+// that contains it, and coincident points must be in the same or adjacent
+// cells; without, only identical points weld.
+//-----------------------------------------------------------------------------
+typedef struct {
+    List<Vector>    *pts;
+    double          tol;
+    List<int>       head;
+    List<int>       next;
+} WeldTable;
+
+static int WeldBucket(WeldTable *wt, int64_t x, int64_t y, int64_t z) {
+    uint64_t h = HashMix(0, (uint64_t)x);
+    h = HashMix(h, (uint64_t)y);
+    h = HashMix(h, (uint64_t)z);
+    h ^= h >> 29;
+    return (int)(h & (uint64_t)(wt->head.n - 1));
+}
+
+static void WeldCell(WeldTable *wt, Vector p, int64_t *x, int64_t *y,
+                     int64_t *z)
+{
+    if(wt->tol > 0) {
+        double cell = 2*wt->tol;
+        *x = (int64_t)floor(p.x/cell);
+        *y = (int64_t)floor(p.y/cell);
+        *z = (int64_t)floor(p.z/cell);
+    } else {
+        memcpy(x, &(p.x), sizeof(*x));
+        memcpy(y, &(p.y), sizeof(*y));
+        memcpy(z, &(p.z), sizeof(*z));
+    }
+}
+
+static void WeldBegin(WeldTable *wt, List<Vector> *pts, double tol, int n) {
+    ZERO(wt);
+    wt->pts = pts;
+    wt->tol = tol;
+
+    int nb = 16, i;
+    while(nb < 2*n) nb *= 2;
+    wt->head.Resize(nb);
+    for(i = 0; i < nb; i++) wt->head.elem[i] = -1;
+}
+
+static uint32_t WeldPoint(WeldTable *wt, Vector p) {
+    int64_t x, y, z;
+    WeldCell(wt, p, &x, &y, &z);
+
+    int best = -1;
+    if(wt->tol > 0) {
+        int dx, dy, dz, k;
+        for(dx = -1; dx <= 1; dx++) {
+            for(dy = -1; dy <= 1; dy++) {
+                for(dz = -1; dz <= 1; dz++) {
+                    int b = WeldBucket(wt, x+dx, y+dy, z+dz);
+                    for(k = wt->head.elem[b]; k >= 0; k = wt->next.elem[k]) {
+                        if(best >= 0 && k >= best) continue;
+                        if(p.Equals(wt->pts->elem[k], wt->tol)) best = k;
+                    }
+                }
+            }
+        }
+    } else {
+        int k;
+        for(k = wt->head.elem[WeldBucket(wt, x, y, z)]; k >= 0;
+            k = wt->next.elem[k])
+        {
+            if(p.EqualsExactly(wt->pts->elem[k])) {
+                best = k;
+                break;
+            }
+        }
+    }
+    if(best >= 0) return (uint32_t)best;
+
+    int b = WeldBucket(wt, x, y, z);
+    wt->pts->Add(&p);
+    wt->next.Add(&(wt->head.elem[b]));
+    wt->head.elem[b] = wt->pts->n - 1;
+    return (uint32_t)(wt->pts->n - 1);
+}
+
+static void WeldEnd(WeldTable *wt) {
+    wt->head.Clear();
+    wt->next.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Make an indexed mesh from a triangle mesh. Vertices within LENGTH_EPS get
+// welded, same as SPointList would, and numbered in the order that they
+// first appear.
+//-----------------------------------------------------------------------------
+void SIndexedMesh::MakeFromMesh(SMesh *m) {
+    Clear();
+    isTransparent = m->isTransparent;
+
+    WeldTable wv, wn;
+    WeldBegin(&wv, &vertex, LENGTH_EPS, 3*m->l.n);
+    WeldBegin(&wn, &normal, 0, 3*m->l.n);
+
+    tri.Resize(m->l.n);
+    int i;
+    for(i = 0; i < m->l.n; i++) {
+        STriangle *st = &(m->l.elem[i]);
+        SIndexedTriangle *it = &(tri.elem[i]);
+        it->v[0] = WeldPoint(&wv, st->a);
+        it->v[1] = WeldPoint(&wv, st->b);
+        it->v[2] = WeldPoint(&wv, st->c);
+        it->n[0] = WeldPoint(&wn, st->an);
+        it->n[1] = WeldPoint(&wn, st->bn);
+        it->n[2] = WeldPoint(&wn, st->cn);
+        it->meta = st->meta;
+    }
+
+    WeldEnd(&wv);
+    WeldEnd(&wn);
+}
+
+void SIndexedMesh::MakeMeshInto(SMesh *m) {
+    int i;
+    for(i = 0; i < tri.n; i++) {
+        SIndexedTriangle *it = &(tri.elem[i]);
+        STriangle st;
+        ZERO(&st);
+        st.meta = it->meta;
+        st.a  = vertex.elem[it->v[0]];
+        st.b  = vertex.elem[it->v[1]];
+        st.c  = vertex.elem[it->v[2]];
+        st.an = normal.elem[it->n[0]];
+        st.bn = normal.elem[it->n[1]];
+        st.cn = normal.elem[it->n[2]];
+        m->AddTriangle(&st);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Pair up each edge with the one that runs back along it. Sort the edges by
+// their vertices, so that all the edges between the same two vertices end
+// up together; and if there's exactly two of those, in opposite directions,
+// then they're each other's twins.
+//-----------------------------------------------------------------------------
+typedef struct {
+    uint32_t    lo, hi;
+    int         e;
+} EdgeKey;
+
+static bool EdgeKeyBefore(const EdgeKey &a, const EdgeKey &b) {
+    if(a.lo != b.lo) return a.lo < b.lo;
+    if(a.hi != b.hi) return a.hi < b.hi;
+    return a.e < b.e;
+}
+
+void SIndexedMesh::MakeAdjacency(void) {
+    int n = 3*tri.n;
+    List<EdgeKey> keys;
+    ZERO(&keys);
+    keys.Resize(n);
+    twin.Clear();
+    twin.Resize(n);
+
+    int e;
+    for(e = 0; e < n; e++) {
+        SIndexedTriangle *it = &(tri.elem[e/3]);
+        uint32_t a = it->v[e%3], b = it->v[(e+1)%3];
+        EdgeKey *ek = &(keys.elem[e]);
+        ek->lo = min(a, b);
+        ek->hi = max(a, b);
+        ek->e  = e;
+        twin.elem[e] = -1;
+    }
+    std::sort(keys.elem, keys.elem + n, EdgeKeyBefore);
+
+    int i, j;
+    for(i = 0; i < n; i = j) {
+        for(j = i + 1; j < n; j++) {
+            if(keys.elem[j].lo != keys.elem[i].lo) break;
+            if(keys.elem[j].hi != keys.elem[i].hi) break;
+        }
+        if(j - i != 2) continue;
+
+        int ea = keys.elem[i].e, eb = keys.elem[i+1].e;
+        if(tri.elem[ea/3].v[ea%3] == tri.elem[eb/3].v[eb%3]) {
+            // Both in the same direction, so the normals are inconsistent.
+            continue;
+        }
+        twin.elem[ea] = eb;
+        twin.elem[eb] = ea;
+    }
+
+    keys.Clear();
+}
+
+void SIndexedMesh::Clear(void) {
+    vertex.Clear();
+    normal.Clear();
+    tri.Clear();
+    twin.Clear();
+}
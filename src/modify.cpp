@@ -396,6 +396,7 @@ void GraphicsWindow::MakeTangentArc(void) {
                 re->tag = 1;
             } else {
                 re->construction = true;
+                SS.MarkGroupDirty(re->group);
             }
         }
     }
@@ -577,6 +578,7 @@ void GraphicsWindow::MakeDogboneArc(void) {
                 r->tag = 1;
             } else {
                 r->construction = true;
+                SS.MarkGroupDirty(r->group);
             }
         }
     }
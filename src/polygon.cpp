@@ -160,34 +160,145 @@ void SEdgeList::AddEdge(Vector a, Vector b, int auxA, int auxB) {
     l.Add(&e);
 }
 
-bool SEdgeList::AssembleContour(Vector first, Vector last, SContour *dest,
-                                SEdge *errorAt, bool keepDir)
-{
+//-----------------------------------------------------------------------------
+// Hash the endpoints of all the edges in the list. Each point goes in a
+// single cell, and we look in that cell and all of its neighbours to find
+// the points that might be coincident with a given one.
+//-----------------------------------------------------------------------------
+const double SEdgeIndex::CELL = 2*LENGTH_EPS;
+
+void SEdgeIndex::Build(SEdgeList *el) {
+    Clear();
+    sel = el;
+
+    int n = 2*sel->l.n, nb = 16;
+    while(nb < 2*n) nb *= 2;
+
+    head.Resize(nb);
     int i;
+    for(i = 0; i < nb; i++) head.elem[i] = -1;
 
-    dest->AddPoint(first);
-    dest->AddPoint(last);
+    next.Resize(n);
+    for(i = 0; i < n; i++) {
+        Vector p = Endpoint(i);
+        int b = Bucket((int64_t)floor(p.x/CELL),
+                       (int64_t)floor(p.y/CELL),
+                       (int64_t)floor(p.z/CELL));
+        next.elem[i] = head.elem[b];
+        head.elem[b] = i;
+    }
+}
 
-    do {
-        for(i = 0; i < l.n; i++) {
-            SEdge *se = &(l.elem[i]);
-            if(se->tag) continue;
+int SEdgeIndex::Bucket(int64_t x, int64_t y, int64_t z) {
+    uint64_t h = HashMix(0, (uint64_t)x);
+    h = HashMix(h, (uint64_t)y);
+    h = HashMix(h, (uint64_t)z);
+    h ^= h >> 29;
+    return (int)(h & (uint64_t)(head.n - 1));
+}
 
-            if(se->a.Equals(last)) {
-                dest->AddPoint(se->b);
-                last = se->b;
-                se->tag = 1;
-                break;
+//-----------------------------------------------------------------------------
+// The buckets for the cell containing p and all its neighbours, without
+// duplicates, since neighbouring cells may hash to the same bucket. Returns
+// how many; b must have space for 27.
+//-----------------------------------------------------------------------------
+int SEdgeIndex::BucketsNear(Vector p, int *b) {
+    int64_t x = (int64_t)floor(p.x/CELL),
+            y = (int64_t)floor(p.y/CELL),
+            z = (int64_t)floor(p.z/CELL);
+
+    int n = 0;
+    int dx, dy, dz, i;
+    for(dx = -1; dx <= 1; dx++) {
+        for(dy = -1; dy <= 1; dy++) {
+            for(dz = -1; dz <= 1; dz++) {
+                int bk = Bucket(x+dx, y+dy, z+dz);
+                for(i = 0; i < n; i++) {
+                    if(b[i] == bk) break;
+                }
+                if(i >= n) b[n++] = bk;
             }
-            // Don't allow backwards edges if keepDir is true.
-            if(!keepDir && se->b.Equals(last)) {
-                dest->AddPoint(se->a);
-                last = se->a;
-                se->tag = 1;
-                break;
+        }
+    }
+    return n;
+}
+
+Vector SEdgeIndex::Endpoint(int k) {
+    SEdge *se = &(sel->l.elem[k/2]);
+    return (k & 1) ? se->b : se->a;
+}
+
+//-----------------------------------------------------------------------------
+// Return the untagged edge that starts at p, or that finishes there too if
+// keepDir is false; or -1 if there's none. Where there's more than one, it's
+// the first in the list, same as a linear search would find.
+//-----------------------------------------------------------------------------
+int SEdgeIndex::FirstUntaggedAt(Vector p, bool keepDir) {
+    int b[27];
+    int nb = BucketsNear(p, b);
+
+    int best = -1;
+    int j, k;
+    for(j = 0; j < nb; j++) {
+        for(k = head.elem[b[j]]; k >= 0; k = next.elem[k]) {
+            int i = k/2;
+            if(best >= 0 && i >= best) continue;
+            if(keepDir && (k & 1)) continue;
+            if(sel->l.elem[i].tag) continue;
+            if(!Endpoint(k).Equals(p)) continue;
+            best = i;
+        }
+    }
+    return best;
+}
+
+//-----------------------------------------------------------------------------
+// Find the points where only one edge ends, so that a contour through there
+// can't close; and the points where more than two edges do, so that which
+// way a contour goes is ambiguous. Each such point gets reported once.
+//-----------------------------------------------------------------------------
+void SEdgeIndex::FindOpenAndBranchPoints(SPointList *openAt,
+                                         SPointList *branchAt)
+{
+    int i;
+    for(i = 0; i < next.n; i++) {
+        Vector p = Endpoint(i);
+        int b[27];
+        int nb = BucketsNear(p, b);
+
+        int cnt = 0;
+        bool first = true;
+        int j, k;
+        for(j = 0; j < nb; j++) {
+            for(k = head.elem[b[j]]; k >= 0; k = next.elem[k]) {
+                if(!Endpoint(k).Equals(p)) continue;
+                cnt++;
+                if(k < i) first = false;
             }
         }
-        if(i >= l.n) {
+        // Report the point only from the first of its coincident endpoints.
+        if(!first) continue;
+
+        if(cnt == 1 && openAt) openAt->Add(p);
+        if(cnt > 2 && branchAt) branchAt->Add(p);
+    }
+}
+
+void SEdgeIndex::Clear(void) {
+    head.Clear();
+    next.Clear();
+}
+
+bool SEdgeList::AssembleContour(Vector first, Vector last, SContour *dest,
+                                SEdge *errorAt, bool keepDir,
+                                SEdgeIndex *index)
+{
+    dest->AddPoint(first);
+    dest->AddPoint(last);
+
+    do {
+        int i = index->FirstUntaggedAt(last, keepDir);
+        if(i < 0) {
             // Couldn't assemble a closed contour; mark where.
             if(errorAt) {
                 errorAt->a = first;
@@ -196,20 +307,44 @@ bool SEdgeList::AssembleContour(Vector first, Vector last, SContour *dest,
             return false;
         }
 
+        SEdge *se = &(l.elem[i]);
+        // Don't allow backwards edges if keepDir is true; the index didn't
+        // return any, so an edge that doesn't start here finishes here.
+        if(se->a.Equals(last)) {
+            dest->AddPoint(se->b);
+            last = se->b;
+        } else {
+            dest->AddPoint(se->a);
+            last = se->a;
+        }
+        se->tag = 1;
     } while(!last.Equals(first));
 
     return true;
 }
 
-bool SEdgeList::AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir) {
+bool SEdgeList::AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir,
+                                SPointList *openAt, SPointList *branchAt)
+{
     dest->Clear();
 
+    // Index the edges by their endpoints, so that finding the next edge in
+    // a contour doesn't take a search through the whole list.
+    SEdgeIndex index;
+    ZERO(&index);
+    index.Build(this);
+    if(openAt || branchAt) {
+        index.FindOpenAndBranchPoints(openAt, branchAt);
+    }
+
     bool allClosed = true;
+    // Edges only ever get tagged, so the first untagged one is never before
+    // the last one that we started a contour with.
+    int i = 0;
     for(;;) {
         Vector first = Vector::From(0, 0, 0);
         Vector last  = Vector::From(0, 0, 0);
-        int i;
-        for(i = 0; i < l.n; i++) {
+        for(; i < l.n; i++) {
             if(!l.elem[i].tag) {
                 first = l.elem[i].a;
                 last = l.elem[i].b;
@@ -218,6 +353,7 @@ bool SEdgeList::AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir) {
             }
         }
         if(i >= l.n) {
+            index.Clear();
             return allClosed;
         }
 
@@ -225,7 +361,7 @@ bool SEdgeList::AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir) {
         // into that contour.
         dest->AddEmptyContour();
         if(!AssembleContour(first, last, &(dest->l.elem[dest->l.n-1]),
-                errorAt, keepDir))
+                errorAt, keepDir, &index))
         {
             allClosed = false;
         }
@@ -302,12 +438,12 @@ void SEdgeList::CullExtraneousEdges(void) {
 // that would naively be O(n).
 //-----------------------------------------------------------------------------
 SKdNodeEdges *SKdNodeEdges::Alloc(void) {
-    SKdNodeEdges *ne = (SKdNodeEdges *)AllocTemporary(sizeof(SKdNodeEdges));
+    SKdNodeEdges *ne = (SKdNodeEdges *)AllocTemporaryNode(sizeof(SKdNodeEdges));
     ZERO(ne);
     return ne;
 }
 SEdgeLl *SEdgeLl::Alloc(void) {
-    SEdgeLl *sell = (SEdgeLl *)AllocTemporary(sizeof(SEdgeLl));
+    SEdgeLl *sell = (SEdgeLl *)AllocTemporaryNode(sizeof(SEdgeLl));
     ZERO(sell);
     return sell;
 }
@@ -429,41 +565,6 @@ int SKdNodeEdges::AnyEdgeCrossings(Vector a, Vector b, int cnt,
     return inters;
 }
 
-//-----------------------------------------------------------------------------
-// We have an edge list that contains only collinear edges, maybe with more
-// splits than necessary. Merge any collinear segments that join.
-//-----------------------------------------------------------------------------
-static Vector LineStart, LineDirection;
-static int ByTAlongLine(const void *av, const void *bv)
-{
-    SEdge *a = (SEdge *)av,
-          *b = (SEdge *)bv;
-
-    double ta = (a->a.Minus(LineStart)).DivPivoting(LineDirection),
-           tb = (b->a.Minus(LineStart)).DivPivoting(LineDirection);
-
-    return (ta > tb) ? 1 : -1;
-}
-void SEdgeList::MergeCollinearSegments(Vector a, Vector b) {
-    LineStart = a;
-    LineDirection = b.Minus(a);
-    qsort(l.elem, l.n, sizeof(l.elem[0]), ByTAlongLine);
-
-    l.ClearTags();
-    int i;
-    for(i = 1; i < l.n; i++) {
-        SEdge *prev = &(l.elem[i-1]),
-              *now  = &(l.elem[i]);
-
-        if((prev->b).Equals(now->a)) {
-            // The previous segment joins up to us; so merge it into us.
-            prev->tag = 1;
-            now->a = prev->a;
-        }
-    }
-    l.RemoveTagged();
-}
-
 void SPointList::Clear(void) {
     l.Clear();
 }
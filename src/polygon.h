@@ -11,6 +11,7 @@
 class SPointList;
 class SPolygon;
 class SContour;
+class SEdgeIndex;
 class SMesh;
 class SBsp3;
 
@@ -30,15 +31,38 @@ public:
 
     void Clear(void);
     void AddEdge(Vector a, Vector b, int auxA=0, int auxB=0);
-    bool AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir=false);
+    bool AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir=false,
+                         SPointList *openAt=NULL, SPointList *branchAt=NULL);
     bool AssembleContour(Vector first, Vector last, SContour *dest,
-                            SEdge *errorAt, bool keepDir);
+                            SEdge *errorAt, bool keepDir, SEdgeIndex *index);
     int AnyEdgeCrossings(Vector a, Vector b,
         Vector *pi=NULL, SPointList *spl=NULL);
     bool ContainsEdgeFrom(SEdgeList *sel);
     bool ContainsEdge(SEdge *se);
     void CullExtraneousEdges(void);
-    void MergeCollinearSegments(Vector a, Vector b);
+};
+
+// A hash of the endpoints of a list's edges, to find the edges that meet at
+// a point without searching the whole list. The cells are no smaller than
+// LENGTH_EPS, so two points that are Equals() always land in the same or
+// neighbouring cells. Endpoint k is edge k/2's a, if k is even, else its b.
+class SEdgeIndex {
+public:
+    SEdgeList       *sel;
+    // The first endpoint in each hash bucket, and then for each endpoint
+    // the next one in its bucket; or -1 if there isn't one.
+    List<int>       head;
+    List<int>       next;
+
+    static const double CELL;
+
+    void Build(SEdgeList *sel);
+    int Bucket(int64_t x, int64_t y, int64_t z);
+    int BucketsNear(Vector p, int *b);
+    Vector Endpoint(int k);
+    int FirstUntaggedAt(Vector p, bool keepDir);
+    void FindOpenAndBranchPoints(SPointList *openAt, SPointList *branchAt);
+    void Clear(void);
 };
 
 // A kd-tree element needs to go on a side of a node if it's when KDTREE_EPS
@@ -118,7 +142,7 @@ public:
     bool IsEar(int bp, double scaledEps);
     bool BridgeToContour(SContour *sc, SEdgeList *el, List<Vector> *vl);
     void ClipEarInto(SMesh *m, int bp, double scaledEps);
-    void UvTriangulateInto(SMesh *m, SSurface *srf);
+    void UvTriangulateInto(SMesh *m, SSurface *srf, double chordTol);
 };
 
 typedef struct {
@@ -143,8 +167,8 @@ public:
     bool IsEmpty(void);
     Vector AnyPoint(void);
     void OffsetInto(SPolygon *dest, double r);
-    void UvTriangulateInto(SMesh *m, SSurface *srf);
-    void UvGridTriangulateInto(SMesh *m, SSurface *srf);
+    void UvTriangulateInto(SMesh *m, SSurface *srf, double chordTol);
+    void UvGridTriangulateInto(SMesh *m, SSurface *srf, double chordTol);
 };
 
 class STriangle {
@@ -177,8 +201,6 @@ public:
     SBsp2       *more;
 
     enum { POS = 100, NEG = 101, COPLANAR = 200 };
-    void InsertTriangleHow(int how, STriangle *tr, SMesh *m, SBsp3 *bsp3);
-    void InsertTriangle(STriangle *tr, SMesh *m, SBsp3 *bsp3);
     Vector IntersectionWith(Vector a, Vector b);
     SBsp2 *InsertEdge(SEdge *nedge, Vector nnp, Vector out);
     static SBsp2 *Alloc(void);
@@ -205,14 +227,11 @@ public:
     Vector IntersectionWith(Vector a, Vector b);
 
     enum { POS = 100, NEG = 101, COPLANAR = 200 };
-    void InsertHow(int how, STriangle *str, SMesh *instead);
-    SBsp3 *Insert(STriangle *str, SMesh *instead);
+    void InsertHow(int how, STriangle *str);
+    SBsp3 *Insert(STriangle *str);
 
-    void InsertConvexHow(int how, STriMeta meta, Vector *vertex, int n,
-                                SMesh *instead);
-    SBsp3 *InsertConvex(STriMeta meta, Vector *vertex, int n, SMesh *instead);
-
-    void InsertInPlane(bool pos2, STriangle *tr, SMesh *m);
+    void InsertConvexHow(int how, STriMeta meta, Vector *vertex, int n);
+    SBsp3 *InsertConvex(STriMeta meta, Vector *vertex, int n);
 
     void GenerateInPaintOrder(SMesh *m);
 
@@ -223,9 +242,6 @@ class SMesh {
 public:
     List<STriangle>     l;
 
-    bool    flipNormal;
-    bool    keepCoplanar;
-    bool    atLeastOneDiscarded;
     bool    isTransparent;
 
     void Clear(void);
@@ -235,9 +251,6 @@ public:
     void DoBounding(Vector v, Vector *vmax, Vector *vmin);
     void GetBounding(Vector *vmax, Vector *vmin);
 
-    void Simplify(int start);
-
-    void AddAgainstBsp(SMesh *srcm, SBsp3 *bsp3);
     void MakeFromUnionOf(SMesh *a, SMesh *b);
     void MakeFromDifferenceOf(SMesh *a, SMesh *b);
 
@@ -255,6 +268,39 @@ public:
     uint32_t FirstIntersectionWith(Point2d mp);
 };
 
+// A triangle of an indexed mesh, in terms of that mesh's shared vertices and
+// normals.
+class SIndexedTriangle {
+public:
+    uint32_t    v[3];
+    uint32_t    n[3];
+    STriMeta    meta;
+};
+
+// A triangle mesh where coincident vertices are welded together, so each is
+// stored once and the triangles refer to them by index. That's smaller than
+// an SMesh, and since triangles that share an edge share its vertices too,
+// we can find the triangles on each side of an edge without searching.
+class SIndexedMesh {
+public:
+    List<Vector>            vertex;
+    // The normals get welded too, but only if they're identical.
+    List<Vector>            normal;
+    List<SIndexedTriangle>  tri;
+    bool                    isTransparent;
+
+    // Edge 3*i + j of the mesh runs from vertex j to vertex (j+1)%3 of
+    // triangle i. For each edge, this is the edge of the neighbouring
+    // triangle that runs back along it; or -1 if there's no neighbour, or
+    // more than one. Empty until MakeAdjacency().
+    List<int>               twin;
+
+    void MakeFromMesh(SMesh *m);
+    void MakeMeshInto(SMesh *m);
+    void MakeAdjacency(void);
+    void Clear(void);
+};
+
 // A linked list of triangles
 class STriangleLl {
 public:
@@ -277,7 +323,6 @@ public:
 
     static SKdNode *Alloc(void);
     static SKdNode *From(SMesh *m);
-    static SKdNode *From(STriangleLl *tll);
 
     void AddTriangle(STriangle *tr);
     void MakeMeshInto(SMesh *m);
@@ -295,9 +340,6 @@ public:
     void MakeCertainEdgesInto(SEdgeList *sel, int how, bool coplanarIsInter,
                                                 bool *inter, bool *leaky);
 
-    void OcclusionTestLine(SEdge orig, SEdgeList *sel, int cnt);
-    void SplitLinesAgainstTriangle(SEdgeList *sel, STriangle *tr);
-
     void SnapToMesh(SMesh *m);
     void SnapToVertex(Vector v, SMesh *extras);
 };
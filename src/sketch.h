@@ -19,6 +19,7 @@ class hEquation;
 class Entity;
 class Param;
 class Equation;
+class BooleanJob;
 
 
 // All of the hWhatever handles are a 32-bit ID, that is used to represent
@@ -59,7 +60,9 @@ public:
     //      31:16   -- request index
     uint32_t v;
 
+    inline bool isFromRequest(void);
     inline hRequest request(void);
+    inline hGroup group(void);
 };
 
 class hStyle {
@@ -114,6 +117,7 @@ public:
     double      scale;
 
     bool        clean;
+    bool        cleanMesh;
     hEntity     activeWorkplane;
     double      valA;
     double      valB;
@@ -163,12 +167,19 @@ public:
         int             how;
         SEdge           notClosedAt;
         Vector          errorPointAt;
+        // If not closed, the points where only one curve ends, and where
+        // more than two meet.
+        SPointList      openAt;
+        SPointList      branchAt;
     }               polyError;
 
     bool            booleanFailed;
 
     SShell          thisShell;
     SShell          runningShell;
+    // A hash of the inputs to the Boolean that made runningShell, so that
+    // if they haven't changed then we can keep it; or zero if none.
+    uint64_t        runningShellKey;
 
     SMesh           thisMesh;
     SMesh           runningMesh;
@@ -176,6 +187,9 @@ public:
     bool            displayDirty;
     SMesh           displayMesh;
     SEdgeList       displayEdges;
+    // The display mesh, but with coarser triangles where that's good enough
+    // for the view.
+    SShellLod       displayLod;
 
     enum {
         COMBINE_AS_UNION           = 0,
@@ -243,9 +257,14 @@ public:
     Group *PreviousGroup(void);
     Group *RunningMeshGroup(void);
     void GenerateShellAndMesh(void);
+    void GenerateThisShellAndMesh(void);
+    void MakeBooleanJob(BooleanJob *job);
+    void TakeBooleanResult(BooleanJob *job, bool copy);
     template<class T> void GenerateForStepAndRepeat(T *steps, T *outs);
-    template<class T> void GenerateForBoolean(T *a, T *b, T *o, int how);
+    template<class T> static void GenerateForBoolean(T *a, T *b, T *o,
+                                                     int how, bool suppress);
     void GenerateDisplayItems(void);
+    SMesh *DisplayMeshForView(void);
     void DrawDisplayItems(int t);
     void Draw(void);
     RgbaColor GetLoopSetFillColor(SBezierLoopSet *sbls,
@@ -258,6 +277,39 @@ public:
     static void MenuGroup(int id);
 };
 
+// The Boolean that combines a group's own solid model with the running
+// model from the groups before it. That's the slow part of regenerating, so
+// the job can have its own copies of everything, and run on another thread.
+class BooleanJob {
+public:
+    hGroup      h;
+    int         how;
+    bool        suppress;
+    bool        forceToMesh;
+    double      chordTol;
+    int         maxSegments;
+
+    SShell      thisShell;
+    SMesh       thisMesh;
+
+    // The running model that we combine with; made by an earlier job in the
+    // same batch, or else copied in here.
+    int         prev;
+    SShell      prevShell;
+    SMesh       prevMesh;
+
+    // The result. This starts out as what the group already has, since
+    // we can keep that if the inputs to the Boolean haven't changed.
+    uint64_t    key;
+    SShell      runningShell;
+    SMesh       runningMesh;
+    bool        changed;
+    bool        booleanFailed;
+
+    void Run(SShell *prevs, SMesh *prevm, SShell *thiss, SMesh *thism);
+    void Clear(void);
+};
+
 // A user request for some primitive or derived operation; for example a
 // line, or a step and repeat.
 class Request {
@@ -810,8 +862,12 @@ inline hGroup hEntity::group(void)
 inline hEquation hEntity::equation(int i)
     { if(i != 0) oops(); hEquation r; r.v = v | 0x40000000; return r; }
 
+inline bool hParam::isFromRequest(void)
+    { if(v & 0x80000000) return false; else return true; }
 inline hRequest hParam::request(void)
     { hRequest r; r.v = (v >> 16); return r; }
+inline hGroup hParam::group(void)
+    { hGroup r; r.v = (v >> 16) & 0x3fff; return r; }
 
 
 inline hEquation hConstraint::equation(int i)
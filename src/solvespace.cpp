@@ -275,8 +275,19 @@ double SolveSpaceUI::StringToMm(const char *str) {
     return atof(str) * MmPerUnit();
 }
 double SolveSpaceUI::ChordTolMm(void) {
+    double chordTolMm;
+    int maxSegs;
+    GetToleranceOverride(&chordTolMm, &maxSegs);
+    if(chordTolMm > 0) return chordTolMm;
     return SS.chordTol / SS.GW.scale;
 }
+int SolveSpaceUI::MaxSegments(void) {
+    double chordTolMm;
+    int maxSegs;
+    GetToleranceOverride(&chordTolMm, &maxSegs);
+    if(maxSegs > 0) return maxSegs;
+    return SS.maxSegments;
+}
 int SolveSpaceUI::UnitDigitsAfterDecimal(void) {
     return (viewUnits == UNIT_INCHES) ? afterDecimalInch : afterDecimalMm;
 }
@@ -300,8 +311,12 @@ void SolveSpaceUI::AfterNewFile(void) {
     // Clear out the traced point, which is no longer valid
     traced.point = Entity::NO_ENTITY;
     traced.path.l.Clear();
-    // and the naked edges
-    nakedEdges.Clear();
+    // and the naked edges, which a Boolean on the worker thread might still
+    // be adding to
+    {
+        std::lock_guard<std::mutex> l(SShell::failedLock);
+        nakedEdges.Clear();
+    }
 
     // GenerateAll() expects the view to be valid, because it uses that to
     // fill in default values for extrusion depths etc. (which won't matter
@@ -549,6 +564,7 @@ void SolveSpaceUI::MenuFile(int id) {
 }
 
 void SolveSpaceUI::MenuAnalyze(int id) {
+    SS.FinishGenerate();
     SS.GW.GroupSelection();
 #define gs (SS.GW.gs)
 
@@ -582,14 +598,16 @@ void SolveSpaceUI::MenuAnalyze(int id) {
             break;
 
         case GraphicsWindow::MNU_NAKED_EDGES: {
-            SS.nakedEdges.Clear();
-
             Group *g = SK.GetGroup(SS.GW.activeGroup);
             SMesh *m = &(g->displayMesh);
             SKdNode *root = SKdNode::From(m);
             bool inters, leaks;
-            root->MakeCertainEdgesInto(&(SS.nakedEdges),
-                SKdNode::NAKED_OR_SELF_INTER_EDGES, true, &inters, &leaks);
+            {
+                std::lock_guard<std::mutex> l(SShell::failedLock);
+                SS.nakedEdges.Clear();
+                root->MakeCertainEdgesInto(&(SS.nakedEdges),
+                    SKdNode::NAKED_OR_SELF_INTER_EDGES, true, &inters, &leaks);
+            }
 
             InvalidateGraphics();
 
@@ -616,13 +634,15 @@ void SolveSpaceUI::MenuAnalyze(int id) {
         }
 
         case GraphicsWindow::MNU_INTERFERENCE: {
-            SS.nakedEdges.Clear();
-
             SMesh *m = &(SK.GetGroup(SS.GW.activeGroup)->displayMesh);
             SKdNode *root = SKdNode::From(m);
             bool inters, leaks;
-            root->MakeCertainEdgesInto(&(SS.nakedEdges),
-                SKdNode::SELF_INTER_EDGES, false, &inters, &leaks);
+            {
+                std::lock_guard<std::mutex> l(SShell::failedLock);
+                SS.nakedEdges.Clear();
+                root->MakeCertainEdgesInto(&(SS.nakedEdges),
+                    SKdNode::SELF_INTER_EDGES, false, &inters, &leaks);
+            }
 
             InvalidateGraphics();
 
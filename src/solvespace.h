@@ -17,6 +17,7 @@
 #include <math.h>
 #include <limits.h>
 #include <algorithm>
+#include <mutex>
 #ifdef HAVE_STDINT_H
 #   include <stdint.h>
 #endif
@@ -110,6 +111,17 @@ inline double Random(double vmax) {
     return (vmax*rand()) / RAND_MAX;
 }
 
+// Combine a value into a running hash.
+inline uint64_t HashMix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    return h;
+}
+inline uint64_t HashDouble(uint64_t h, double v) {
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    return HashMix(h, u);
+}
+
 class Expr;
 class ExprVector;
 class ExprQuaternion;
@@ -258,6 +270,10 @@ float CnfThawFloat(float v, const char *name);
 void *AllocTemporary(size_t n);
 void FreeTemporary(void *p);
 void FreeAllTemporary(void);
+// Small temporary objects, like tree nodes and expressions, come from an
+// arena instead, which FreeAllTemporary() resets; they can't be freed
+// individually.
+void *AllocTemporaryNode(size_t n);
 void *MemRealloc(void *p, size_t n);
 void *MemAlloc(size_t n);
 void MemFree(void *p);
@@ -341,6 +357,16 @@ void MakePathAbsolute(const char *base, char *path);
 bool MakeAcceleratorLabel(int accel, char *out);
 bool StringAllPrintable(const char *str);
 bool StringEndsIn(const char *str, const char *ending);
+// Call fn(data, i) for every i from 0 to n-1, on as many threads as we have
+// cores, and return once they're all done. The calls may happen in any
+// order, so they mustn't depend on each other.
+typedef void ParallelFn(void *data, int i);
+void ParallelFor(int n, ParallelFn *fn, void *data);
+// Make SS.ChordTolMm() and SS.MaxSegments() return these on the calling
+// thread, and on the pool threads for any ParallelFor() that it starts;
+// zero goes back to the global settings.
+void OverrideTolerances(double chordTolMm, int maxSegs);
+void GetToleranceOverride(double *chordTolMm, int *maxSegs);
 void Message(const char *str, ...);
 void Error(const char *str, ...);
 void CnfFreezeBool(bool v, const char *name);
@@ -350,8 +376,6 @@ RgbaColor CnfThawColor(RgbaColor v, const char *name);
 
 class System {
 public:
-    enum { MAX_UNKNOWNS = 1024 };
-
     EntityList                      entity;
     ParamList                       param;
     IdList<Equation,hEquation>      eq;
@@ -360,52 +384,118 @@ public:
     // we should put as close as possible to their initial positions.
     List<hParam>                    dragged;
 
+    // The params of the sketch that we're solving, for the ones that aren't
+    // our unknowns. The subsystems get solved on other threads, where SK
+    // may be some other sketch, so this is set on the calling thread.
+    ParamList                      *sketchParam;
+
     enum {
         // In general, the tag indicates the subsys that a variable/equation
         // has been assigned to; these are exceptions for variables:
-        VAR_SUBSTITUTED      = 10000,
-        VAR_DOF_TEST         = 10001,
+        VAR_SUBSTITUTED      = -1,
         // and for equations:
-        EQ_SUBSTITUTED       = 20000
+        EQ_SUBSTITUTED       = -2
     };
 
-    // The system Jacobian matrix
+    // The system Jacobian matrix. Each equation depends on only a few of
+    // the unknowns, so this is stored sparse.
     struct {
         // The corresponding equation for each row
-        hEquation   eq[MAX_UNKNOWNS];
+        List<hEquation> eq;
 
-        // The corresponding parameter for each column
-        hParam      param[MAX_UNKNOWNS];
+        // The corresponding parameter for each column, in order of
+        // increasing handle
+        List<hParam>    param;
 
         // We're solving AX = B
         int m, n;
         struct {
-            Expr        *sym[MAX_UNKNOWNS][MAX_UNKNOWNS];
-            double       num[MAX_UNKNOWNS][MAX_UNKNOWNS];
+            // The nonzero entries of row i are at [row[i], row[i+1]), in
+            // order of increasing column.
+            List<int>       row;
+            List<int>       col;
+            List<double>    num;
+
+            // The register of B's tape that loads the param for each entry,
+            // whose adjoint is the partial.
+            List<int>       reg;
+
+            // And the same entries by column: those of column j are the
+            // entries colEntry[k], in rows colRow[k], for k in
+            // [colStart[j], colStart[j+1]).
+            List<int>       colStart;
+            List<int>       colEntry;
+            List<int>       colRow;
         }           A;
 
-        double      scale[MAX_UNKNOWNS];
+        List<double>    scale;
 
         // Some helpers for the least squares solve
-        double AAt[MAX_UNKNOWNS][MAX_UNKNOWNS];
-        double Z[MAX_UNKNOWNS];
+        SparseLdl       AAt;
+        List<double>    Z;
 
-        double      X[MAX_UNKNOWNS];
+        List<double>    X;
 
         struct {
-            Expr        *sym[MAX_UNKNOWNS];
-            double       num[MAX_UNKNOWNS];
+            List<double>    num;
+
+            // The equations, compiled, for both the residuals and (by
+            // reverse-mode differentiation) the Jacobian
+            ExprTape        tape;
         }           B;
     } mat;
 
     static const double RANK_MAG_TOLERANCE, CONVERGE_TOLERANCE;
     int CalculateRank(void);
-    static bool SolveLinearSystem(double X[], double A[][MAX_UNKNOWNS],
-                                  double B[], int N);
+    void FindFree(void);
+    void EvalAAt(void);
     bool SolveLeastSquares(void);
 
-    bool WriteJacobian(int tag);
+    void WriteJacobian(int tag);
     void EvalJacobian(void);
+    void EvalResiduals(void);
+
+    int TagSubsystems(int tag);
+
+    // The independent subsystems, which we solve each in a System of its
+    // own, so that they can go in parallel. Subsystem i's equations are
+    // eq[subsysEq[subsys[i].eqStart]] etc.
+    typedef struct {
+        int     tag;
+        // A single equation in a single unknown, solved before the others
+        bool    alone;
+        int     eqStart;
+        int     eqEnd;
+        System *sys;
+        int     result;
+        int     dof;
+        int     iterations;
+    } Subsystem;
+    enum {
+        PARALLEL_MIN_EQUATIONS = 200
+    };
+    List<Subsystem>                 subsys;
+    List<int>                       subsysEq;
+    List<System *>                  subsysSys;
+    void WriteSubsystems(int first, int alone, int last);
+    int SolveSubsystems(int start, int finish, bool andFindFree, bool again);
+    void SolveSubsystem(int i, bool andFindFree, bool again);
+    void CopySubsystemFrom(System *from, Subsystem *ss);
+
+    // While dragging, we keep the substitutions and subsystems (with their
+    // compiled Jacobians and factorizations) from one solve to the next,
+    // and use them again if the equations are unchanged.
+    struct {
+        bool            valid;
+        uint64_t        key;
+        int             alone;
+        int             dof;
+        List<int>       paramTag;
+        List<hParam>    paramSubstd;
+    }                               drag;
+    uint64_t HashExpr(Expr *e, uint64_t h);
+    uint64_t HashSystem(Group *g);
+    bool SolveAgain(void);
 
     void WriteEquationsExceptFor(hConstraint hc, Group *g);
     void FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad);
@@ -414,11 +504,16 @@ public:
     bool IsDragged(hParam p);
 
     bool NewtonSolve(int tag);
+    // The number of Newton iterations in the last Solve(), over all of its
+    // subsystems; that's just for benchmarking.
+    int iterations;
 
     enum {
         SOLVED_OKAY          = 0,
         DIDNT_CONVERGE       = 10,
         SINGULAR_JACOBIAN    = 11,
+        // No longer returned, since the Jacobian is sparse and has no
+        // fixed size; kept for libslvs compatibility.
         TOO_MANY_UNKNOWNS    = 20
     };
     int Solve(Group *g, int *dof, List<hConstraint> *bad,
@@ -782,6 +877,7 @@ public:
     int UnitDigitsAfterDecimal(void);
     void SetUnitDigitsAfterDecimal(int v);
     double ChordTolMm(void);
+    int MaxSegments(void);
     bool usePerspectiveProj;
     double CameraTangent(void);
 
@@ -895,6 +991,7 @@ public:
 
     void MarkGroupDirty(hGroup hg);
     void MarkGroupDirtyByEntity(hEntity he);
+    void MarkDependentGroupsDirty(void);
 
     // Consistency checking on the sketch: stuff with missing dependencies
     // will get deleted automatically.
@@ -913,7 +1010,13 @@ public:
     bool PruneConstraints(hGroup hg);
 
     void GenerateAll(void);
-    void GenerateAll(int first, int last, bool andFindFree=false);
+    void GenerateAll(int first, int last, bool andFindFree=false,
+                     bool dirtyOnly=false);
+    // The Booleans from GenerateAll() may still be running in the background.
+    void PublishGenerated(void);
+    void CancelGenerate(void);
+    void FinishGenerate(void);
+    void DrawGenerateStatus(void);
     void SolveGroup(hGroup hg, bool andFindFree);
     void MarkDraggedParams(void);
     void ForceReferences(void);
@@ -946,7 +1049,12 @@ public:
 };
 
 extern SolveSpaceUI SS;
+#ifdef LIBRARY
+// The library solves on many threads at once, each with its own sketch.
+extern thread_local Sketch SK;
+#else
 extern Sketch SK;
+#endif
 
 };
 
@@ -6,7 +6,12 @@
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
 
-static int I, N, FLAG;
+// We trim many surfaces at once on different threads, so each has its own
+// number for the surface that it's working on.
+static thread_local int I;
+static int N, FLAG;
+
+std::mutex SShell::failedLock;
 
 void SShell::MakeFromUnionOf(SShell *a, SShell *b) {
     MakeFromBoolean(a, b, AS_UNION);
@@ -24,7 +29,7 @@ void SShell::MakeFromDifferenceOf(SShell *a, SShell *b) {
 // the intersection of srfA and srfB.) Return a new pwl curve with everything
 // split.
 //-----------------------------------------------------------------------------
-static Vector LineStart, LineDirection;
+static thread_local Vector LineStart, LineDirection;
 static int ByTAlongLine(const void *av, const void *bv)
 {
     SInter *a = (SInter *)av,
@@ -131,18 +136,39 @@ SCurve SCurve::MakeCopySplitAgainst(SShell *agnstA, SShell *agnstB,
     return ret;
 }
 
+typedef struct {
+    SShell          *shell;
+    SShell          *agnst;
+    List<SCurve>    split;
+} SplitCurvesJob;
+static void SplitCurve(void *data, int i) {
+    SplitCurvesJob *job = (SplitCurvesJob *)data;
+    SShell *sh = job->shell;
+    SCurve *sc = &(sh->curve.elem[i]);
+    job->split.elem[i] = sc->MakeCopySplitAgainst(job->agnst, NULL,
+                                sh->surface.FindById(sc->surfA),
+                                sh->surface.FindById(sc->surfB));
+}
 void SShell::CopyCurvesSplitAgainst(bool opA, SShell *agnst, SShell *into) {
-    SCurve *sc;
-    for(sc = curve.First(); sc; sc = curve.NextAfter(sc)) {
-        SCurve scn = sc->MakeCopySplitAgainst(agnst, NULL,
-                                surface.FindById(sc->surfA),
-                                surface.FindById(sc->surfB));
+    // Split all the curves at once, and then add them in order, so that they
+    // get the same handles no matter which thread split which.
+    SplitCurvesJob job;
+    ZERO(&job);
+    job.shell = this;
+    job.agnst = agnst;
+    job.split.Resize(curve.n);
+    ParallelFor(curve.n, SplitCurve, &job);
+
+    int i;
+    for(i = 0; i < curve.n; i++) {
+        SCurve scn = job.split.elem[i];
         scn.source = opA ? SCurve::FROM_A : SCurve::FROM_B;
 
         hSCurve hsc = into->curve.AddAndAssignId(&scn);
         // And note the new ID so that we can rewrite the trims appropriately
-        sc->newH = hsc;
+        curve.elem[i].newH = hsc;
     }
+    job.split.Clear();
 }
 
 void SSurface::TrimFromEdgeList(SEdgeList *el, bool asUv) {
@@ -612,6 +638,7 @@ SSurface SSurface::MakeCopyTrimAgainst(SShell *parent,
     ZERO(&poly);
     final.l.ClearTags();
     if(!final.AssemblePolygon(&poly, NULL, true)) {
+        std::lock_guard<std::mutex> l(SShell::failedLock);
         into->booleanFailed = true;
         dbp("failed: I=%d, avoid=%d", I, choosing.l.n);
         DEBUGEDGELIST(&final, &ret);
@@ -625,29 +652,150 @@ SSurface SSurface::MakeCopyTrimAgainst(SShell *parent,
     return ret;
 }
 
+typedef struct {
+    SShell          *shell;
+    SShell          *sha, *shb;
+    SShell          *into;
+    int             type;
+    int             first;
+    List<SSurface>  trimmed;
+} TrimSurfacesJob;
+static void TrimSurface(void *data, int i) {
+    TrimSurfacesJob *job = (TrimSurfacesJob *)data;
+    SSurface *ss = &(job->shell->surface.elem[i]);
+    I = job->first + i;
+    job->trimmed.elem[i] = ss->MakeCopyTrimAgainst(job->shell,
+                                    job->sha, job->shb, job->into, job->type);
+}
 void SShell::CopySurfacesTrimAgainst(SShell *sha, SShell *shb, SShell *into,
                                         int type)
 {
-    SSurface *ss;
-    for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
-        SSurface ssn;
-        ssn = ss->MakeCopyTrimAgainst(this, sha, shb, into, type);
-        ss->newH = into->surface.AddAndAssignId(&ssn);
-        I++;
+    // Trim all the surfaces at once; the curves are all in into already,
+    // and trimming doesn't change them. Then add the surfaces in order.
+    TrimSurfacesJob job;
+    ZERO(&job);
+    job.shell = this;
+    job.sha = sha;
+    job.shb = shb;
+    job.into = into;
+    job.type = type;
+    job.first = I;
+    job.trimmed.Resize(surface.n);
+    ParallelFor(surface.n, TrimSurface, &job);
+
+    int i;
+    for(i = 0; i < surface.n; i++) {
+        SSurface *ss = &(surface.elem[i]);
+        ss->newH = into->surface.AddAndAssignId(&(job.trimmed.elem[i]));
+    }
+    I = job.first + surface.n;
+    job.trimmed.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Intersect one of our surfaces against every surface from agnst whose
+// bounding box overlaps its own. The curves go into the buffer if we're given
+// one, or straight into into otherwise.
+//-----------------------------------------------------------------------------
+static void IntersectSurfaceAgainst(SShell *sh, int i, SShell *agnst,
+                                    SShell *into, SCurveBuffer *buf)
+{
+    SSurface *sa = &(sh->surface.elem[i]);
+    Vector amax, amin;
+    sa->GetAxisAlignedBounding(&amax, &amin);
+
+    List<int> near;
+    ZERO(&near);
+    agnst->index.srf.FindOverlapping(amax, amin, &near);
+    // Keep them in list order, so that the curves get generated in the same
+    // order as if we'd tried every pair.
+    std::sort(near.elem, near.elem + near.n);
+
+    int j;
+    for(j = 0; j < near.n; j++) {
+        SSurface *sb = &(agnst->surface.elem[near.elem[j]]);
+        // Intersect every surface from our shell against every nearby
+        // surface from agnst; this will add zero or more curves to the
+        // curve list for into.
+        sa->IntersectAgainst(sb, sh, agnst, into, buf);
+    }
+    near.Clear();
+}
+
+typedef struct {
+    SShell              *shell;
+    SShell              *agnst;
+    SShell              *into;
+    List<SCurveBuffer>  buf;
+} IntersectSurfacesJob;
+static void IntersectSurface(void *data, int i) {
+    IntersectSurfacesJob *job = (IntersectSurfacesJob *)data;
+    SCurveBuffer *buf = &(job->buf.elem[i]);
+    ZERO(buf);
+    IntersectSurfaceAgainst(job->shell, i, job->agnst, job->into, buf);
+}
+
+//-----------------------------------------------------------------------------
+// Would any of the exact curves that we tried have reused the pwl of a curve
+// that was added to into after the given handle?
+//-----------------------------------------------------------------------------
+bool SCurveBuffer::WouldReuse(SShell *into, uint32_t after) {
+    int i;
+    for(i = 0; i < tried.n; i++) {
+        SBezier sb = tried.elem[i], sbrev = sb;
+        sbrev.Reverse();
+
+        SCurve *sc;
+        for(sc = into->curve.First(); sc; sc = into->curve.NextAfter(sc)) {
+            if(sc->h.v <= after || !sc->isExact) continue;
+            if(sb.Equals(&(sc->exact)) || sbrev.Equals(&(sc->exact))) {
+                return true;
+            }
+        }
     }
+    return false;
+}
+
+void SCurveBuffer::Clear(void) {
+    curve.Clear();
+    tried.Clear();
 }
 
 void SShell::MakeIntersectionCurvesAgainst(SShell *agnst, SShell *into) {
-    SSurface *sa;
-    for(sa = surface.First(); sa; sa = surface.NextAfter(sa)) {
-        SSurface *sb;
-        for(sb = agnst->surface.First(); sb; sb = agnst->surface.NextAfter(sb)){
-            // Intersect every surface from our shell against every surface
-            // from agnst; this will add zero or more curves to the curve
-            // list for into.
-            sa->IntersectAgainst(sb, this, agnst, into);
+    // Intersect all of our surfaces at once, each into its own buffer. While
+    // that's happening, into doesn't change.
+    IntersectSurfacesJob job;
+    ZERO(&job);
+    job.shell = this;
+    job.agnst = agnst;
+    job.into = into;
+    job.buf.Resize(surface.n);
+    uint32_t before = into->curve.MaximumId();
+    ParallelFor(surface.n, IntersectSurface, &job);
+
+    // And then merge the buffers in order, so that the curves get the same
+    // handles as if we'd done one surface at a time.
+    int i;
+    for(i = 0; i < surface.n; i++) {
+        SCurveBuffer *buf = &(job.buf.elem[i]);
+        if(buf->WouldReuse(into, before)) {
+            // A curve from an earlier surface would have been reused here,
+            // so our curves might be different; do this surface over, now
+            // that those are in into.
+            buf->Clear();
+            IntersectSurfaceAgainst(this, i, agnst, into, NULL);
+            continue;
         }
+
+        SCurve *sc;
+        for(sc = buf->curve.First(); sc; sc = buf->curve.NextAfter(sc)) {
+            into->curve.AddAndAssignId(sc);
+        }
+        // The pts now belong to the curves in into.
+        buf->curve.n = 0;
+        buf->Clear();
     }
+    job.buf.Clear();
 }
 
 void SShell::CleanupAfterBoolean(void) {
@@ -655,6 +803,7 @@ void SShell::CleanupAfterBoolean(void) {
     for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
         ss->edges.Clear();
     }
+    index.ClearEdges();
 }
 
 //-----------------------------------------------------------------------------
@@ -726,6 +875,11 @@ void SShell::MakeFromBoolean(SShell *a, SShell *b, int type) {
     a->MakeClassifyingBsps(NULL);
     b->MakeClassifyingBsps(NULL);
 
+    // Index the surfaces by their bounding boxes, for the intersection and
+    // classification tests below; they don't move during the Boolean.
+    a->index.BuildSurfaces(a);
+    b->index.BuildSurfaces(b);
+
     // Copy over all the original curves, splitting them so that a
     // piecwise linear segment never crosses a surface from the other
     // shell.
@@ -751,6 +905,9 @@ void SShell::MakeFromBoolean(SShell *a, SShell *b, int type) {
     // curves
     a->MakeClassifyingBsps(this);
     b->MakeClassifyingBsps(this);
+    // and index the new pwl edges too, for the edge-on-edge tests
+    a->index.BuildEdges(a);
+    b->index.BuildEdges(b);
 
     if(b->surface.n == 0 || a->surface.n == 0) {
         I = 1000000;
@@ -769,6 +926,8 @@ void SShell::MakeFromBoolean(SShell *a, SShell *b, int type) {
     // And clean up the piecewise linear things we made as a calculation aid
     a->CleanupAfterBoolean();
     b->CleanupAfterBoolean();
+    a->index.Clear();
+    b->index.Clear();
 }
 
 //-----------------------------------------------------------------------------
@@ -794,7 +953,7 @@ void SSurface::MakeClassifyingBsp(SShell *shell, SShell *useCurvesFrom) {
 }
 
 SBspUv *SBspUv::Alloc(void) {
-    return (SBspUv *)AllocTemporary(sizeof(SBspUv));
+    return (SBspUv *)AllocTemporaryNode(sizeof(SBspUv));
 }
 
 static int ByLength(const void *av, const void *bv)
@@ -93,34 +93,99 @@ double SolveSpace::BernsteinDerivative(int k, int deg, double t)
     oops();
 }
 
-Vector SBezier::PointAt(double t) {
+//-----------------------------------------------------------------------------
+// All of the Bernstein basis polynomials of one degree at once, and their
+// derivatives; the same as Bernstein() and BernsteinDerivative() for each k,
+// but without the switch for every term. With the degree known at compile
+// time, the evaluation loops below unroll completely.
+//-----------------------------------------------------------------------------
+template<int DEG>
+static inline void BernsteinBasis(double t, double *B) {
+    switch(DEG) {
+        case 0:
+            B[0] = 1;
+            break;
+
+        case 1:
+            B[0] = (1 - t);
+            B[1] = t;
+            break;
+
+        case 2:
+            B[0] = (1 - t)*(1 - t);
+            B[1] = 2*(1 - t)*t;
+            B[2] = t*t;
+            break;
+
+        case 3:
+            B[0] = (1 - t)*(1 - t)*(1 - t);
+            B[1] = 3*(1 - t)*(1 - t)*t;
+            B[2] = 3*(1 - t)*t*t;
+            B[3] = t*t*t;
+            break;
+    }
+}
+
+template<int DEG>
+static inline void BernsteinDerivativeBasis(double t, double *Bp) {
+    switch(DEG) {
+        case 0:
+            Bp[0] = 0;
+            break;
+
+        case 1:
+            Bp[0] = -1;
+            Bp[1] = 1;
+            break;
+
+        case 2:
+            Bp[0] = -2 + 2*t;
+            Bp[1] = 2 - 4*t;
+            Bp[2] = 2*t;
+            break;
+
+        case 3:
+            Bp[0] = -3 + 6*t - 3*t*t;
+            Bp[1] = 3 - 12*t + 9*t*t;
+            Bp[2] = 6*t - 9*t*t;
+            Bp[3] = 3*t*t;
+            break;
+    }
+}
+
+template<int DEG>
+static Vector CurvePointAt(SBezier *sb, double t) {
+    double B[DEG+1];
+    BernsteinBasis<DEG>(t, B);
+
     Vector pt = Vector::From(0, 0, 0);
     double d = 0;
 
     int i;
-    for(i = 0; i <= deg; i++) {
-        double B = Bernstein(i, deg, t);
-        pt = pt.Plus(ctrl[i].ScaledBy(B*weight[i]));
-        d += weight[i]*B;
+    for(i = 0; i <= DEG; i++) {
+        pt = pt.Plus(sb->ctrl[i].ScaledBy(B[i]*sb->weight[i]));
+        d += sb->weight[i]*B[i];
     }
     pt = pt.ScaledBy(1.0/d);
     return pt;
 }
 
-Vector SBezier::TangentAt(double t) {
+template<int DEG>
+static Vector CurveTangentAt(SBezier *sb, double t) {
+    double B[DEG+1], Bp[DEG+1];
+    BernsteinBasis<DEG>(t, B);
+    BernsteinDerivativeBasis<DEG>(t, Bp);
+
     Vector pt = Vector::From(0, 0, 0), pt_p = Vector::From(0, 0, 0);
     double d = 0, d_p = 0;
 
     int i;
-    for(i = 0; i <= deg; i++) {
-        double B  = Bernstein(i, deg, t),
-               Bp = BernsteinDerivative(i, deg, t);
+    for(i = 0; i <= DEG; i++) {
+        pt = pt.Plus(sb->ctrl[i].ScaledBy(B[i]*sb->weight[i]));
+        d += sb->weight[i]*B[i];
 
-        pt = pt.Plus(ctrl[i].ScaledBy(B*weight[i]));
-        d += weight[i]*B;
-
-        pt_p = pt_p.Plus(ctrl[i].ScaledBy(Bp*weight[i]));
-        d_p += weight[i]*Bp;
+        pt_p = pt_p.Plus(sb->ctrl[i].ScaledBy(Bp[i]*sb->weight[i]));
+        d_p += sb->weight[i]*Bp[i];
     }
 
     // quotient rule; f(t) = n(t)/d(t), so f' = (n'*d - n*d')/(d^2)
@@ -130,6 +195,26 @@ Vector SBezier::TangentAt(double t) {
     return ret;
 }
 
+Vector SBezier::PointAt(double t) {
+    switch(deg) {
+        case 0: return CurvePointAt<0>(this, t);
+        case 1: return CurvePointAt<1>(this, t);
+        case 2: return CurvePointAt<2>(this, t);
+        case 3: return CurvePointAt<3>(this, t);
+    }
+    oops();
+}
+
+Vector SBezier::TangentAt(double t) {
+    switch(deg) {
+        case 0: return CurveTangentAt<0>(this, t);
+        case 1: return CurveTangentAt<1>(this, t);
+        case 2: return CurveTangentAt<2>(this, t);
+        case 3: return CurveTangentAt<3>(this, t);
+    }
+    oops();
+}
+
 void SBezier::ClosestPointTo(Vector p, double *t, bool converge) {
     int i;
     double minDist = VERY_POSITIVE;
@@ -292,7 +377,7 @@ void SBezier::MakePwlWorker(List<Vector> *l, double ta, double tb,
     double d = max(pm1.DistanceToLine(pa, pb.Minus(pa)),
                    pm2.DistanceToLine(pa, pb.Minus(pa)));
 
-    double step = 1.0/SS.maxSegments;
+    double step = 1.0/SS.MaxSegments();
     if((tb - ta) < step || d < chordTol) {
         // A previous call has already added the beginning of our interval.
         l->Add(&pb);
@@ -303,28 +388,43 @@ void SBezier::MakePwlWorker(List<Vector> *l, double ta, double tb,
     }
 }
 
-Vector SSurface::PointAt(Point2d puv) {
-    return PointAt(puv.x, puv.y);
-}
-Vector SSurface::PointAt(double u, double v) {
+//-----------------------------------------------------------------------------
+// Evaluate the surface, with kernels specialized for each degree in u and v;
+// the sums are done in the same order as the general case always did, so
+// the results are identical, just faster. We usually want many points on
+// the same surface, so there's a batch version of each too.
+//-----------------------------------------------------------------------------
+template<int DEGM, int DEGN>
+static inline Vector SurfacePointAt(SSurface *srf, double u, double v) {
+    double Bi[DEGM+1], Bj[DEGN+1];
+    BernsteinBasis<DEGM>(u, Bi);
+    BernsteinBasis<DEGN>(v, Bj);
+
     Vector num = Vector::From(0, 0, 0);
     double den = 0;
 
     int i, j;
-    for(i = 0; i <= degm; i++) {
-        for(j = 0; j <= degn; j++) {
-            double Bi = Bernstein(i, degm, u),
-                   Bj = Bernstein(j, degn, v);
-
-            num = num.Plus(ctrl[i][j].ScaledBy(Bi*Bj*weight[i][j]));
-            den += weight[i][j]*Bi*Bj;
+    for(i = 0; i <= DEGM; i++) {
+        for(j = 0; j <= DEGN; j++) {
+            num = num.Plus(srf->ctrl[i][j].ScaledBy(Bi[i]*Bj[j]*
+                                                   srf->weight[i][j]));
+            den += srf->weight[i][j]*Bi[i]*Bj[j];
         }
     }
     num = num.ScaledBy(1.0/den);
     return num;
 }
 
-void SSurface::TangentsAt(double u, double v, Vector *tu, Vector *tv) {
+template<int DEGM, int DEGN>
+static inline void SurfaceTangentsAt(SSurface *srf, double u, double v,
+                                     Vector *tu, Vector *tv)
+{
+    double Bi[DEGM+1], Bj[DEGN+1], Bip[DEGM+1], Bjp[DEGN+1];
+    BernsteinBasis<DEGM>(u, Bi);
+    BernsteinBasis<DEGN>(v, Bj);
+    BernsteinDerivativeBasis<DEGM>(u, Bip);
+    BernsteinDerivativeBasis<DEGN>(v, Bjp);
+
     Vector num   = Vector::From(0, 0, 0),
            num_u = Vector::From(0, 0, 0),
            num_v = Vector::From(0, 0, 0);
@@ -333,21 +433,19 @@ void SSurface::TangentsAt(double u, double v, Vector *tu, Vector *tv) {
            den_v = 0;
 
     int i, j;
-    for(i = 0; i <= degm; i++) {
-        for(j = 0; j <= degn; j++) {
-            double Bi  = Bernstein(i, degm, u),
-                   Bj  = Bernstein(j, degn, v),
-                   Bip = BernsteinDerivative(i, degm, u),
-                   Bjp = BernsteinDerivative(j, degn, v);
+    for(i = 0; i <= DEGM; i++) {
+        for(j = 0; j <= DEGN; j++) {
+            Vector ctrl = srf->ctrl[i][j];
+            double w = srf->weight[i][j];
 
-            num = num.Plus(ctrl[i][j].ScaledBy(Bi*Bj*weight[i][j]));
-            den += weight[i][j]*Bi*Bj;
+            num = num.Plus(ctrl.ScaledBy(Bi[i]*Bj[j]*w));
+            den += w*Bi[i]*Bj[j];
 
-            num_u = num_u.Plus(ctrl[i][j].ScaledBy(Bip*Bj*weight[i][j]));
-            den_u += weight[i][j]*Bip*Bj;
+            num_u = num_u.Plus(ctrl.ScaledBy(Bip[i]*Bj[j]*w));
+            den_u += w*Bip[i]*Bj[j];
 
-            num_v = num_v.Plus(ctrl[i][j].ScaledBy(Bi*Bjp*weight[i][j]));
-            den_v += weight[i][j]*Bi*Bjp;
+            num_v = num_v.Plus(ctrl.ScaledBy(Bi[i]*Bjp[j]*w));
+            den_v += w*Bi[i]*Bjp[j];
         }
     }
     // quotient rule; f(t) = n(t)/d(t), so f' = (n'*d - n*d')/(d^2)
@@ -358,13 +456,72 @@ void SSurface::TangentsAt(double u, double v, Vector *tu, Vector *tv) {
     *tv = tv->ScaledBy(1.0/(den*den));
 }
 
+template<int DEGM, int DEGN>
+static void SurfacePointsAt(SSurface *srf, const Point2d *puv, Vector *pt,
+                            int n)
+{
+    int i;
+    for(i = 0; i < n; i++) {
+        pt[i] = SurfacePointAt<DEGM, DEGN>(srf, puv[i].x, puv[i].y);
+    }
+}
+
+template<int DEGM, int DEGN>
+static void SurfaceNormalsAt(SSurface *srf, const Point2d *puv, Vector *nv,
+                             int n)
+{
+    int i;
+    for(i = 0; i < n; i++) {
+        Vector tu, tv;
+        SurfaceTangentsAt<DEGM, DEGN>(srf, puv[i].x, puv[i].y, &tu, &tv);
+        nv[i] = tu.Cross(tv);
+    }
+}
+
+typedef void SurfaceEvalFn(SSurface *srf, const Point2d *puv, Vector *out,
+                           int n);
+typedef void SurfaceTangentsFn(SSurface *srf, double u, double v,
+                               Vector *tu, Vector *tv);
+
+#define FOR_EACH_DEGREE(f) { \
+    { f<0, 0>, f<0, 1>, f<0, 2>, f<0, 3> }, \
+    { f<1, 0>, f<1, 1>, f<1, 2>, f<1, 3> }, \
+    { f<2, 0>, f<2, 1>, f<2, 2>, f<2, 3> }, \
+    { f<3, 0>, f<3, 1>, f<3, 2>, f<3, 3> } }
+static SurfaceEvalFn * const PointsAtKernel[4][4] =
+    FOR_EACH_DEGREE(SurfacePointsAt);
+static SurfaceEvalFn * const NormalsAtKernel[4][4] =
+    FOR_EACH_DEGREE(SurfaceNormalsAt);
+static SurfaceTangentsFn * const TangentsAtKernel[4][4] =
+    FOR_EACH_DEGREE(SurfaceTangentsAt);
+#undef FOR_EACH_DEGREE
+
+Vector SSurface::PointAt(Point2d puv) {
+    Vector pt;
+    PointsAtKernel[degm][degn](this, &puv, &pt, 1);
+    return pt;
+}
+Vector SSurface::PointAt(double u, double v) {
+    return PointAt(Point2d::From(u, v));
+}
+void SSurface::PointsAt(const Point2d *puv, Vector *pt, int n) {
+    PointsAtKernel[degm][degn](this, puv, pt, n);
+}
+
+void SSurface::TangentsAt(double u, double v, Vector *tu, Vector *tv) {
+    TangentsAtKernel[degm][degn](this, u, v, tu, tv);
+}
+
 Vector SSurface::NormalAt(Point2d puv) {
-    return NormalAt(puv.x, puv.y);
+    Vector nv;
+    NormalsAtKernel[degm][degn](this, &puv, &nv, 1);
+    return nv;
 }
 Vector SSurface::NormalAt(double u, double v) {
-    Vector tu, tv;
-    TangentsAt(u, v, &tu, &tv);
-    return tu.Cross(tv);
+    return NormalAt(Point2d::From(u, v));
+}
+void SSurface::NormalsAt(const Point2d *puv, Vector *nv, int n) {
+    NormalsAtKernel[degm][degn](this, puv, nv, n);
 }
 
 void SSurface::ClosestPointTo(Vector p, Point2d *puv, bool converge) {
@@ -8,6 +8,7 @@
 // Copyright 2008-2013 Jonathan Westhues.
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
+#include <random>
 
 // Dot product tolerance for perpendicular; this is on the direction cosine,
 // so it's about 0.001 degrees.
@@ -384,10 +385,35 @@ void SShell::AllPointsIntersecting(Vector a, Vector b,
                                    List<SInter> *il,
                                    bool seg, bool trimmed, bool inclTangent)
 {
-    SSurface *ss;
-    for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
+    List<int> near;
+    ZERO(&near);
+    SurfacesAlongLine(a, b, seg, &near);
+
+    int i;
+    for(i = 0; i < near.n; i++) {
+        SSurface *ss = &(surface.elem[near.elem[i]]);
         ss->AllPointsIntersecting(a, b, il, seg, trimmed, inclTangent);
     }
+    near.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Add the index of every surface whose bounding box the line (or segment)
+// through a and b might pass through to the list, in list order. That's
+// every surface, unless we've built the index for a Boolean.
+//-----------------------------------------------------------------------------
+void SShell::SurfacesAlongLine(Vector a, Vector b, bool seg, List<int> *l) {
+    int i;
+    if(index.srf.boxMax.n == surface.n && surface.n > 0) {
+        index.srf.FindAlongLine(a, b, seg, l);
+        // In list order, so that the results come out the same as if we'd
+        // tried every surface.
+        std::sort(l->elem, l->elem + l->n);
+    } else {
+        for(i = 0; i < surface.n; i++) {
+            l->Add(&i);
+        }
+    }
 }
 
 
@@ -412,6 +438,40 @@ int SShell::ClassifyRegion(Vector edge_n, Vector inter_surf_n,
     }
 }
 
+static double RandomFrom(std::minstd_rand *rng, double vmax) {
+    return (vmax*((*rng)() - rng->min())) / (rng->max() - rng->min());
+}
+
+//-----------------------------------------------------------------------------
+// If the edge se of srf coincides with our edge from ea to eb, or passes
+// through the test point p, then count it, and record the normals there for
+// the first two.
+//-----------------------------------------------------------------------------
+static void EdgeOnEdge(SSurface *srf, SEdge *se, Vector ea, Vector eb,
+                       Vector p, int *edge_inters,
+                       Vector *inter_surf_n, Vector *inter_edge_n)
+{
+    if((ea.Equals(se->a) && eb.Equals(se->b)) ||
+       (eb.Equals(se->a) && ea.Equals(se->b)) ||
+        p.OnLineSegment(se->a, se->b))
+    {
+        if(*edge_inters < 2) {
+            // Edge-on-edge case
+            Point2d pm;
+            srf->ClosestPointTo(p,  &pm, false);
+            // A vector normal to the surface, at the intersection point
+            inter_surf_n[*edge_inters] = srf->NormalAt(pm);
+            // A vector normal to the intersecting edge (but within the
+            // intersecting surface) at the intersection point, pointing
+            // out.
+            inter_edge_n[*edge_inters] =
+              (inter_surf_n[*edge_inters]).Cross((se->b).Minus((se->a)));
+        }
+
+        (*edge_inters)++;
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Does the given point lie on our shell? There are many cases; inside and
 // outside are obvious, but then there's all the edge-on-edge and edge-on-face
@@ -429,36 +489,54 @@ bool SShell::ClassifyEdge(int *indir, int *outdir,
     List<SInter> l;
     ZERO(&l);
 
-    srand(0);
+    // The directions of our rays are random, but the same every time, and
+    // the same on every thread; so not from rand(), which is shared.
+    std::minstd_rand rng;
 
     // First, check for edge-on-edge
     int edge_inters = 0;
     Vector inter_surf_n[2], inter_edge_n[2];
     SSurface *srf;
-    for(srf = surface.First(); srf; srf = surface.NextAfter(srf)) {
-        if(srf->LineEntirelyOutsideBbox(ea, eb, true)) continue;
+    if(index.edge.boxMax.n > 0 && index.srf.boxMax.n == surface.n) {
+        // Any edge that we hit lies within the box around our edge and
+        // the test point, so look only at the edges whose boxes overlap it.
+        Vector emax = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE),
+               emin = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+        ea.MakeMaxMin(&emax, &emin);
+        eb.MakeMaxMin(&emax, &emin);
+        p.MakeMaxMin(&emax, &emin);
+
+        List<int> near;
+        ZERO(&near);
+        index.edge.FindOverlapping(emax, emin, &near);
+        // The edges were indexed surface by surface, so this is the same
+        // order in which we'd have visited them otherwise.
+        std::sort(near.elem, near.elem + near.n);
 
-        SEdgeList *sel = &(srf->edges);
-        SEdge *se;
-        for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
-            if((ea.Equals(se->a) && eb.Equals(se->b)) ||
-               (eb.Equals(se->a) && ea.Equals(se->b)) ||
-                p.OnLineSegment(se->a, se->b))
+        int i;
+        for(i = 0; i < near.n; i++) {
+            int k = near.elem[i], si = index.edgeSrf.elem[k];
+            if(SBvh::LineEntirelyOutsideBox(index.srf.boxMax.elem[si],
+                                            index.srf.boxMin.elem[si],
+                                            ea, eb, true))
             {
-                if(edge_inters < 2) {
-                    // Edge-on-edge case
-                    Point2d pm;
-                    srf->ClosestPointTo(p,  &pm, false);
-                    // A vector normal to the surface, at the intersection point
-                    inter_surf_n[edge_inters] = srf->NormalAt(pm);
-                    // A vector normal to the intersecting edge (but within the
-                    // intersecting surface) at the intersection point, pointing
-                    // out.
-                    inter_edge_n[edge_inters] =
-                      (inter_surf_n[edge_inters]).Cross((se->b).Minus((se->a)));
-                }
-
-                edge_inters++;
+                continue;
+            }
+            srf = &(surface.elem[si]);
+            SEdge *se = &(srf->edges.l.elem[index.edgeNum.elem[k]]);
+            EdgeOnEdge(srf, se, ea, eb, p,
+                       &edge_inters, inter_surf_n, inter_edge_n);
+        }
+        near.Clear();
+    } else {
+        for(srf = surface.First(); srf; srf = surface.NextAfter(srf)) {
+            if(srf->LineEntirelyOutsideBbox(ea, eb, true)) continue;
+
+            SEdgeList *sel = &(srf->edges);
+            SEdge *se;
+            for(se = sel->l.First(); se; se = sel->l.NextAfter(se)) {
+                EdgeOnEdge(srf, se, ea, eb, p,
+                           &edge_inters, inter_surf_n, inter_edge_n);
             }
         }
     }
@@ -520,7 +598,13 @@ bool SShell::ClassifyEdge(int *indir, int *outdir,
     // are on surface) and for numerical stability, so we don't pick up
     // the additional error from the line intersection.
 
-    for(srf = surface.First(); srf; srf = surface.NextAfter(srf)) {
+    List<int> near;
+    ZERO(&near);
+    SurfacesAlongLine(ea, eb, true, &near);
+
+    int i;
+    for(i = 0; i < near.n; i++) {
+        srf = &(surface.elem[near.elem[i]]);
         if(srf->LineEntirelyOutsideBbox(ea, eb, true)) continue;
 
         Point2d puv;
@@ -542,8 +626,10 @@ bool SShell::ClassifyEdge(int *indir, int *outdir,
 
         *indir  = ClassifyRegion(edge_n_in,  surf_n_in,  surf_n);
         *outdir = ClassifyRegion(edge_n_out, surf_n_out, surf_n);
+        near.Clear();
         return true;
     }
+    near.Clear();
 
     // Edge is not on face or on edge; so it's either inside or outside
     // the shell, and we'll determine which by raycasting.
@@ -552,7 +638,8 @@ bool SShell::ClassifyEdge(int *indir, int *outdir,
         // Cast a ray in a random direction (two-sided so that we test if
         // the point lies on a surface, but use only one side for in/out
         // testing)
-        Vector ray = Vector::From(Random(1), Random(1), Random(1));
+        Vector ray = Vector::From(RandomFrom(&rng, 1), RandomFrom(&rng, 1),
+                                  RandomFrom(&rng, 1));
 
         AllPointsIntersecting(
             p.Minus(ray), p.Plus(ray), &l, false, true, false);
@@ -603,6 +690,7 @@ bool SShell::ClassifyEdge(int *indir, int *outdir,
         if(cnt++ > 5) {
             dbp("can't find a ray that doesn't hit on edge!");
             dbp("on edge = %d, edge_inters = %d", onEdge, edge_inters);
+            std::lock_guard<std::mutex> l(failedLock);
             SS.nakedEdges.AddEdge(ea, eb);
             break;
         }
@@ -191,19 +191,202 @@ void SSurface::GetAxisAlignedBounding(Vector *ptMax, Vector *ptMin) {
     }
 }
 
-bool SSurface::LineEntirelyOutsideBbox(Vector a, Vector b, bool segment) {
-    Vector amax, amin;
-    GetAxisAlignedBounding(&amax, &amin);
-    if(!Vector::BoundingBoxIntersectsLine(amax, amin, a, b, segment)) {
+//-----------------------------------------------------------------------------
+// Build a bounding volume hierarchy over all the boxes that were added, by
+// splitting them at the median of their centers along the longest axis,
+// until there are few enough in each leaf.
+//-----------------------------------------------------------------------------
+void SBvh::AddBox(Vector max, Vector min) {
+    boxMax.Add(&max);
+    boxMin.Add(&min);
+}
+
+void SBvh::Build(void) {
+    node.Clear();
+    item.Clear();
+
+    int i;
+    for(i = 0; i < boxMax.n; i++) {
+        item.Add(&i);
+    }
+    if(item.n > 0) BuildNode(0, item.n);
+}
+
+int SBvh::BuildNode(int start, int n) {
+    SBvhNode bn;
+    ZERO(&bn);
+    bn.max = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE);
+    bn.min = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+    Vector cmax = bn.max, cmin = bn.min;
+    int i;
+    for(i = start; i < start + n; i++) {
+        int j = item.elem[i];
+        boxMax.elem[j].MakeMaxMin(&bn.max, &bn.min);
+        boxMin.elem[j].MakeMaxMin(&bn.max, &bn.min);
+        Vector c = (boxMax.elem[j].Plus(boxMin.elem[j])).ScaledBy(0.5);
+        c.MakeMaxMin(&cmax, &cmin);
+    }
+
+    int self = node.n;
+    node.Add(&bn);
+
+    const int LEAF_SIZE = 4;
+    if(n <= LEAF_SIZE) {
+        node.elem[self].left = node.elem[self].right = -1;
+        node.elem[self].start = start;
+        node.elem[self].n = n;
+        return self;
+    }
+
+    Vector d = cmax.Minus(cmin);
+    int axis = (d.x > d.y) ? ((d.x > d.z) ? 0 : 2) : ((d.y > d.z) ? 1 : 2);
+    int half = n / 2;
+    std::nth_element(item.elem + start, item.elem + start + half,
+                     item.elem + start + n,
+        [&](int a, int b) {
+            return boxMax.elem[a].Element(axis) + boxMin.elem[a].Element(axis) <
+                   boxMax.elem[b].Element(axis) + boxMin.elem[b].Element(axis);
+        });
+
+    // The node list may get reallocated while we build the children, so
+    // don't hold a pointer into it.
+    int left  = BuildNode(start, half),
+        right = BuildNode(start + half, n - half);
+    node.elem[self].left  = left;
+    node.elem[self].right = right;
+    return self;
+}
+
+//-----------------------------------------------------------------------------
+// Add the index of every box that overlaps the given box (with the usual
+// tolerance) to the list, in no particular order.
+//-----------------------------------------------------------------------------
+void SBvh::FindOverlapping(Vector amax, Vector amin, List<int> *l, int i) {
+    if(node.n == 0) return;
+
+    SBvhNode *bn = &(node.elem[i]);
+    if(Vector::BoundingBoxesDisjoint(amax, amin, bn->max, bn->min)) return;
+
+    if(bn->left < 0) {
+        int j;
+        for(j = bn->start; j < bn->start + bn->n; j++) {
+            int k = item.elem[j];
+            if(!Vector::BoundingBoxesDisjoint(amax, amin,
+                                              boxMax.elem[k], boxMin.elem[k]))
+            {
+                l->Add(&k);
+            }
+        }
+    } else {
+        FindOverlapping(amax, amin, l, bn->left);
+        FindOverlapping(amax, amin, l, bn->right);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Add the index of every box that the line through a and b (or just the
+// segment, if seg is true) might pass through to the list, in no particular
+// order. Each node's box contains the boxes of its children, so if the line
+// misses a node then it misses everything below it.
+//-----------------------------------------------------------------------------
+void SBvh::FindAlongLine(Vector a, Vector b, bool seg, List<int> *l, int i) {
+    if(node.n == 0) return;
+
+    SBvhNode *bn = &(node.elem[i]);
+    if(LineEntirelyOutsideBox(bn->max, bn->min, a, b, seg)) return;
+
+    if(bn->left < 0) {
+        int j;
+        for(j = bn->start; j < bn->start + bn->n; j++) {
+            int k = item.elem[j];
+            if(!LineEntirelyOutsideBox(boxMax.elem[k], boxMin.elem[k],
+                                       a, b, seg))
+            {
+                l->Add(&k);
+            }
+        }
+    } else {
+        FindAlongLine(a, b, seg, l, bn->left);
+        FindAlongLine(a, b, seg, l, bn->right);
+    }
+}
+
+bool SBvh::LineEntirelyOutsideBox(Vector max, Vector min,
+                                  Vector a, Vector b, bool seg)
+{
+    if(!Vector::BoundingBoxIntersectsLine(max, min, a, b, seg)) {
         // The line segment could fail to intersect the bbox, but lie entirely
         // within it and intersect the surface.
-        if(a.OutsideAndNotOn(amax, amin) && b.OutsideAndNotOn(amax, amin)) {
+        if(a.OutsideAndNotOn(max, min) && b.OutsideAndNotOn(max, min)) {
             return true;
         }
     }
     return false;
 }
 
+void SBvh::Clear(void) {
+    node.Clear();
+    item.Clear();
+    boxMax.Clear();
+    boxMin.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Index the surfaces of a shell by their bounding boxes, and separately the
+// pwl edges of those surfaces, which exist only after we've made the
+// classifying BSPs.
+//-----------------------------------------------------------------------------
+void SShellIndex::BuildSurfaces(SShell *shell) {
+    srf.Clear();
+
+    int i;
+    for(i = 0; i < shell->surface.n; i++) {
+        Vector smax, smin;
+        (shell->surface.elem[i]).GetAxisAlignedBounding(&smax, &smin);
+        srf.AddBox(smax, smin);
+    }
+    srf.Build();
+}
+
+void SShellIndex::BuildEdges(SShell *shell) {
+    ClearEdges();
+
+    int i, j;
+    for(i = 0; i < shell->surface.n; i++) {
+        SEdgeList *sel = &(shell->surface.elem[i].edges);
+        for(j = 0; j < sel->l.n; j++) {
+            SEdge *se = &(sel->l.elem[j]);
+            Vector emax = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE,
+                                       VERY_NEGATIVE),
+                   emin = Vector::From(VERY_POSITIVE, VERY_POSITIVE,
+                                       VERY_POSITIVE);
+            (se->a).MakeMaxMin(&emax, &emin);
+            (se->b).MakeMaxMin(&emax, &emin);
+            edge.AddBox(emax, emin);
+            edgeSrf.Add(&i);
+            edgeNum.Add(&j);
+        }
+    }
+    edge.Build();
+}
+
+void SShellIndex::ClearEdges(void) {
+    edge.Clear();
+    edgeSrf.Clear();
+    edgeNum.Clear();
+}
+
+void SShellIndex::Clear(void) {
+    srf.Clear();
+    ClearEdges();
+}
+
+bool SSurface::LineEntirelyOutsideBbox(Vector a, Vector b, bool segment) {
+    Vector amax, amin;
+    GetAxisAlignedBounding(&amax, &amin);
+    return SBvh::LineEntirelyOutsideBox(amax, amin, a, b, segment);
+}
+
 //-----------------------------------------------------------------------------
 // Generate the piecewise linear approximation of the trim stb, which applies
 // to the curve sc.
@@ -402,7 +585,7 @@ void SSurface::MakeSectionEdgesInto(SShell *shell,
     }
 }
 
-void SSurface::TriangulateInto(SShell *shell, SMesh *sm) {
+void SSurface::TriangulateInto(SShell *shell, SMesh *sm, double chordTol) {
     SEdgeList el;
     ZERO(&el);
 
@@ -421,27 +604,52 @@ void SSurface::TriangulateInto(SShell *shell, SMesh *sm) {
             //
             // If this is just a plane (degree (1, 1)) then the triangulation
             // code will notice that, and not bother checking chord tols.
-            poly.UvTriangulateInto(sm, this);
+            poly.UvTriangulateInto(sm, this, chordTol);
         } else {
             // A surface with compound curvature. So we must overlay a
             // two-dimensional grid, and triangulate around that.
-            poly.UvGridTriangulateInto(sm, this);
+            poly.UvGridTriangulateInto(sm, this, chordTol);
+        }
+
+        // Gather the uv coordinates of all the new vertices, so that we can
+        // evaluate the surface at them in one batch.
+        int nv = 3*(sm->l.n - start);
+        List<Point2d> uv;
+        List<Vector> pt, nt;
+        ZERO(&uv);
+        ZERO(&pt);
+        ZERO(&nt);
+        uv.Resize(nv);
+        pt.Resize(nv);
+        nt.Resize(nv);
+        for(i = start; i < sm->l.n; i++) {
+            STriangle *st = &(sm->l.elem[i]);
+            Point2d *puv = &(uv.elem[3*(i - start)]);
+            puv[0] = Point2d::From(st->a.x, st->a.y);
+            puv[1] = Point2d::From(st->b.x, st->b.y);
+            puv[2] = Point2d::From(st->c.x, st->c.y);
         }
+        PointsAt(uv.elem, pt.elem, nv);
+        NormalsAt(uv.elem, nt.elem, nv);
 
         STriMeta meta = { face, color };
         for(i = start; i < sm->l.n; i++) {
             STriangle *st = &(sm->l.elem[i]);
+            int k = 3*(i - start);
             st->meta = meta;
-            st->an = NormalAt(st->a.x, st->a.y);
-            st->bn = NormalAt(st->b.x, st->b.y);
-            st->cn = NormalAt(st->c.x, st->c.y);
-            st->a = PointAt(st->a.x, st->a.y);
-            st->b = PointAt(st->b.x, st->b.y);
-            st->c = PointAt(st->c.x, st->c.y);
+            st->an = nt.elem[k];
+            st->bn = nt.elem[k+1];
+            st->cn = nt.elem[k+2];
+            st->a = pt.elem[k];
+            st->b = pt.elem[k+1];
+            st->c = pt.elem[k+2];
             // Works out that my chosen contour direction is inconsistent with
             // the triangle direction, sigh.
             st->FlipNormal();
         }
+        uv.Clear();
+        pt.Clear();
+        nt.Clear();
     } else {
         dbp("failed to assemble polygon to trim nurbs surface in uv space");
     }
@@ -863,17 +1071,255 @@ void SShell::MakeSectionEdgesInto(Vector n, double d,
     }
 }
 
-void SShell::TriangulateInto(SMesh *sm) {
-    SSurface *s;
-    for(s = surface.First(); s; s = surface.NextAfter(s)) {
-        s->TriangulateInto(this, sm);
+typedef struct {
+    SShell          *shell;
+    double          chordTol;
+    List<SMesh>     mesh;
+} TriangulateJob;
+static void TriangulateSurface(void *data, int i) {
+    TriangulateJob *job = (TriangulateJob *)data;
+    SMesh *m = &(job->mesh.elem[i]);
+    ZERO(m);
+    job->shell->surface.elem[i].TriangulateInto(job->shell, m, job->chordTol);
+}
+void SShell::TriangulateInto(SMesh *sm, SShellLod *lod) {
+    // Each surface gets triangulated on its own, so do them all at once, and
+    // then add the triangles in surface order; so the mesh comes out the
+    // same no matter which thread did which.
+    TriangulateJob job;
+    ZERO(&job);
+    job.shell = this;
+    job.chordTol = SS.ChordTolMm();
+    job.mesh.Resize(surface.n);
+    ParallelFor(surface.n, TriangulateSurface, &job);
+
+    // If we're asked to, then note where each surface's triangles went, so
+    // that they can be swapped for coarser ones later.
+    if(lod) {
+        lod->Clear();
+        lod->chordTol = job.chordTol;
+        lod->shellStart = sm->l.n;
+        lod->surface.Resize(surface.n);
+    }
+
+    int i, j;
+    for(i = 0; i < surface.n; i++) {
+        SMesh *m = &(job.mesh.elem[i]);
+        if(lod) {
+            SSurface *ss = &(surface.elem[i]);
+            SSurfaceLod *sl = &(lod->surface.elem[i]);
+            ZERO(sl);
+            ss->GetAxisAlignedBounding(&(sl->ptMax), &(sl->ptMin));
+            sl->start = sm->l.n;
+            sl->n = m->l.n;
+            sl->levels = (ss->degm == 1 && ss->degn == 1) ?
+                1 : SSurfaceLod::LEVELS;
+            sl->built[0] = true;
+        }
+        for(j = 0; j < m->l.n; j++) {
+            sm->l.Add(&(m->l.elem[j]));
+        }
+        if(m->isTransparent) sm->isTransparent = true;
+        m->Clear();
+    }
+    job.mesh.Clear();
+
+    if(lod) lod->shellEnd = sm->l.n;
+}
+
+//-----------------------------------------------------------------------------
+// Choose the level of detail for each surface, according to how big it is
+// on screen, and return a mesh with those; or the full mesh itself, if
+// that's what the view needs everywhere. The coarser levels get triangulated
+// the first time that they're needed, and then kept.
+//-----------------------------------------------------------------------------
+typedef struct {
+    SShell          *shell;
+    SShellLod       *lod;
+    List<int>       todo;
+} LodJob;
+static void TriangulateSurfaceLod(void *data, int i) {
+    LodJob *job = (LodJob *)data;
+    int is = job->todo.elem[i];
+    SSurfaceLod *sl = &(job->lod->surface.elem[is]);
+
+    int k;
+    double tol = job->lod->chordTol;
+    for(k = 0; k < sl->shown; k++) {
+        tol *= SSurfaceLod::LEVEL_RATIO;
+    }
+    job->shell->surface.elem[is].TriangulateInto(job->shell,
+        &(sl->level[sl->shown]), tol);
+    sl->built[sl->shown] = true;
+}
+SMesh *SShellLod::MeshForView(SShell *shell, SMesh *full) {
+    // We can only swap triangles in a mesh that came from this shell.
+    if(surface.n == 0 || surface.n != shell->surface.n ||
+       full->l.n < shellEnd)
+    {
+        return full;
+    }
+
+    LodJob job;
+    ZERO(&job);
+    job.shell = shell;
+    job.lod = this;
+
+    bool changed = !assembled, coarse = false;
+    int i, j;
+    for(i = 0; i < surface.n; i++) {
+        SSurfaceLod *sl = &(surface.elem[i]);
+
+        // The most pixels per mm anywhere on the surface, from the corners
+        // of its bounding box; in perspective, the nearest corner's biggest.
+        double ppmm = 0;
+        for(j = 0; j < 8; j++) {
+            Vector p = Vector::From((j & 1) ? sl->ptMax.x : sl->ptMin.x,
+                                    (j & 2) ? sl->ptMax.y : sl->ptMin.y,
+                                    (j & 4) ? sl->ptMax.z : sl->ptMin.z);
+            double w;
+            SS.GW.ProjectPoint4(p, &w);
+            if(w <= 0) {
+                // Behind the camera, so no telling; take the finest.
+                ppmm = VERY_POSITIVE;
+                break;
+            }
+            ppmm = max(ppmm, SS.GW.scale/w);
+        }
+
+        // The chord tolerance is configured in pixels, so that's how coarse
+        // the surface may be here.
+        double tol = SS.chordTol / ppmm, levelTol = chordTol;
+        int k = 0;
+        while(k + 1 < sl->levels) {
+            levelTol *= SSurfaceLod::LEVEL_RATIO;
+            if(levelTol > tol) break;
+            k++;
+        }
+
+        if(k != sl->shown) {
+            sl->shown = k;
+            changed = true;
+        }
+        if(k > 0) coarse = true;
+        if(!sl->built[k]) job.todo.Add(&i);
+    }
+    if(!coarse) {
+        job.todo.Clear();
+        return full;
+    }
+
+    ParallelFor(job.todo.n, TriangulateSurfaceLod, &job);
+    job.todo.Clear();
+
+    if(changed) {
+        mesh.Clear();
+        for(i = 0; i < shellStart; i++) {
+            mesh.l.Add(&(full->l.elem[i]));
+        }
+        for(i = 0; i < surface.n; i++) {
+            SSurfaceLod *sl = &(surface.elem[i]);
+            if(sl->shown == 0) {
+                for(j = sl->start; j < sl->start + sl->n; j++) {
+                    mesh.l.Add(&(full->l.elem[j]));
+                }
+            } else {
+                SMesh *m = &(sl->level[sl->shown]);
+                for(j = 0; j < m->l.n; j++) {
+                    mesh.l.Add(&(m->l.elem[j]));
+                }
+            }
+        }
+        for(i = shellEnd; i < full->l.n; i++) {
+            mesh.l.Add(&(full->l.elem[i]));
+        }
+        mesh.isTransparent = full->isTransparent;
+        assembled = true;
     }
+    return &mesh;
+}
+
+void SShellLod::Clear(void) {
+    int i, k;
+    for(i = 0; i < surface.n; i++) {
+        for(k = 0; k < SSurfaceLod::LEVELS; k++) {
+            surface.elem[i].level[k].Clear();
+        }
+    }
+    surface.Clear();
+    mesh.Clear();
+    assembled = false;
 }
 
 bool SShell::IsEmpty(void) {
     return (surface.n == 0);
 }
 
+//-----------------------------------------------------------------------------
+// A hash of everything in the shell: the surfaces and their trims, and the
+// curves. Two shells with the same hash will give the same result from any
+// Boolean.
+//-----------------------------------------------------------------------------
+static uint64_t HashVector(uint64_t h, Vector v) {
+    h = HashDouble(h, v.x);
+    h = HashDouble(h, v.y);
+    h = HashDouble(h, v.z);
+    return h;
+}
+static uint64_t HashBezier(uint64_t h, SBezier *sb) {
+    h = HashMix(h, (uint64_t)sb->deg);
+    int i;
+    for(i = 0; i <= sb->deg; i++) {
+        h = HashVector(h, sb->ctrl[i]);
+        h = HashDouble(h, sb->weight[i]);
+    }
+    return h;
+}
+uint64_t SShell::Hash(void) {
+    uint64_t h = HashMix(1, (uint64_t)booleanFailed);
+
+    SSurface *s;
+    for(s = surface.First(); s; s = surface.NextAfter(s)) {
+        h = HashMix(h, s->h.v);
+        h = HashMix(h, s->color.ToPackedInt());
+        h = HashMix(h, s->face);
+        h = HashMix(h, (uint64_t)s->degm);
+        h = HashMix(h, (uint64_t)s->degn);
+        int i, j;
+        for(i = 0; i <= s->degm; i++) {
+            for(j = 0; j <= s->degn; j++) {
+                h = HashVector(h, s->ctrl[i][j]);
+                h = HashDouble(h, s->weight[i][j]);
+            }
+        }
+
+        STrimBy *stb;
+        for(stb = s->trim.First(); stb; stb = s->trim.NextAfter(stb)) {
+            h = HashMix(h, stb->curve.v);
+            h = HashMix(h, (uint64_t)stb->backwards);
+            h = HashVector(h, stb->start);
+            h = HashVector(h, stb->finish);
+        }
+    }
+
+    SCurve *c;
+    for(c = curve.First(); c; c = curve.NextAfter(c)) {
+        h = HashMix(h, c->h.v);
+        h = HashMix(h, (uint64_t)c->source);
+        h = HashMix(h, c->surfA.v);
+        h = HashMix(h, c->surfB.v);
+        h = HashMix(h, (uint64_t)c->isExact);
+        if(c->isExact) h = HashBezier(h, &(c->exact));
+
+        SCurvePt *pt;
+        for(pt = c->pts.First(); pt; pt = c->pts.NextAfter(pt)) {
+            h = HashMix(h, (uint64_t)pt->vertex);
+            h = HashVector(h, pt->p);
+        }
+    }
+    return h;
+}
+
 void SShell::Clear(void) {
     SSurface *s;
     for(s = surface.First(); s; s = surface.NextAfter(s)) {
@@ -886,5 +1332,7 @@ void SShell::Clear(void) {
         c->Clear();
     }
     curve.Clear();
+
+    index.Clear();
 }
 
@@ -16,6 +16,7 @@ double BernsteinDerivative(int k, int deg, double t);
 
 class SSurface;
 class SCurvePt;
+class SCurveBuffer;
 
 // Utility data structure, a two-dimensional BSP to accelerate polygon
 // operations.
@@ -287,9 +288,10 @@ public:
                                     SShell *into, int type);
     void TrimFromEdgeList(SEdgeList *el, bool asUv);
     void IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
-                          SShell *into);
+                          SShell *into, SCurveBuffer *buf=NULL);
     void AddExactIntersectionCurve(SBezier *sb, SSurface *srfB,
-                          SShell *agnstA, SShell *agnstB, SShell *into);
+                          SShell *agnstA, SShell *agnstB, SShell *into,
+                          SCurveBuffer *buf=NULL);
 
     typedef struct {
         int     tag;
@@ -319,9 +321,11 @@ public:
     void PointOnSurfaces(SSurface *s1, SSurface *s2, double *u, double *v);
     Vector PointAt(double u, double v);
     Vector PointAt(Point2d puv);
+    void PointsAt(const Point2d *puv, Vector *pt, int n);
     void TangentsAt(double u, double v, Vector *tu, Vector *tv);
     Vector NormalAt(Point2d puv);
     Vector NormalAt(double u, double v);
+    void NormalsAt(const Point2d *puv, Vector *nv, int n);
     bool LineEntirelyOutsideBbox(Vector a, Vector b, bool segment);
     void GetAxisAlignedBounding(Vector *ptMax, Vector *ptMin);
     bool CoincidentWithPlane(Vector n, double d);
@@ -330,7 +334,7 @@ public:
     bool IsCylinder(Vector *axis, Vector *center, double *r,
                         Vector *start, Vector *finish);
 
-    void TriangulateInto(SShell *shell, SMesh *sm);
+    void TriangulateInto(SShell *shell, SMesh *sm, double chordTol);
 
     // these are intended as bitmasks, even though there's just one now
     enum {
@@ -347,13 +351,76 @@ public:
     void MakeClassifyingBsp(SShell *shell, SShell *useCurvesFrom);
     double ChordToleranceForEdge(Vector a, Vector b);
     void MakeTriangulationGridInto(List<double> *l, double vs, double vf,
-                                    bool swapped);
+                                    bool swapped, double chordTol);
     Vector PointAtMaybeSwapped(double u, double v, bool swapped);
 
     void Reverse(void);
     void Clear(void);
 };
 
+// A bounding volume hierarchy over a list of boxes, so that we can find the
+// boxes that overlap a given box, or that a line passes through, without
+// testing them all.
+class SBvhNode {
+public:
+    Vector      max, min;
+    // The children, or -1 for a leaf; a leaf holds item[start] through
+    // item[start + n - 1].
+    int         left, right;
+    int         start, n;
+};
+
+class SBvh {
+public:
+    List<SBvhNode>  node;
+    // Indices of the boxes, and the boxes themselves by that same index,
+    // in the order that they were added.
+    List<int>       item;
+    List<Vector>    boxMax, boxMin;
+
+    void AddBox(Vector max, Vector min);
+    void Build(void);
+    int BuildNode(int start, int n);
+    void FindOverlapping(Vector amax, Vector amin, List<int> *l, int i=0);
+    void FindAlongLine(Vector a, Vector b, bool seg, List<int> *l, int i=0);
+    static bool LineEntirelyOutsideBox(Vector max, Vector min,
+                                       Vector a, Vector b, bool seg);
+    void Clear(void);
+};
+
+// The boxes of a shell's surfaces, and of the pwl trim edges of those
+// surfaces; built at the start of a Boolean, and freed at its end.
+class SShellIndex {
+public:
+    SBvh        srf;
+    SBvh        edge;
+    // For each box in the edge tree, the index of its surface, and of the
+    // edge within that surface's edges.
+    List<int>   edgeSrf, edgeNum;
+
+    void BuildSurfaces(SShell *shell);
+    void BuildEdges(SShell *shell);
+    void ClearEdges(void);
+    void Clear(void);
+};
+
+// The intersection curves from one surface, when we're intersecting many
+// surfaces at once on different threads. They go here instead of into the
+// result, so that they can be merged into it in order afterwards.
+class SCurveBuffer {
+public:
+    IdList<SCurve,hSCurve>  curve;
+    // Every exact curve that we looked for in the result, and didn't find;
+    // if one of those gets added before we merge, then we'd have reused its
+    // pwl, so the buffer isn't valid.
+    List<SBezier>           tried;
+
+    bool WouldReuse(SShell *into, uint32_t after);
+    void Clear(void);
+};
+
+class SShellLod;
+
 class SShell {
 public:
     IdList<SCurve,hSCurve>      curve;
@@ -361,6 +428,12 @@ public:
 
     bool                        booleanFailed;
 
+    SShellIndex                 index;
+
+    // We trim many surfaces on different threads at once, so hold this to
+    // report a failure, or to draw into SS.nakedEdges for debugging.
+    static std::mutex           failedLock;
+
     void MakeFromExtrusionOf(SBezierLoopSet *sbls, Vector t0, Vector t1,
                              RgbaColor color);
     void MakeFromRevolutionOf(SBezierLoopSet *sbls, Vector pt, Vector axis,
@@ -381,6 +454,7 @@ public:
     void MakeClassifyingBsps(SShell *useCurvesFrom);
     void AllPointsIntersecting(Vector a, Vector b, List<SInter> *il,
                                 bool seg, bool trimmed, bool inclTangent);
+    void SurfacesAlongLine(Vector a, Vector b, bool seg, List<int> *l);
     void MakeCoincidentEdgesInto(SSurface *proto, bool sameNormal,
                                  SEdgeList *el, SShell *useCurvesFrom);
     void RewriteSurfaceHandlesForCurves(SShell *a, SShell *b);
@@ -408,12 +482,54 @@ public:
     void MakeFromAssemblyOf(SShell *a, SShell *b);
     void MergeCoincidentSurfaces(void);
 
-    void TriangulateInto(SMesh *sm);
+    void TriangulateInto(SMesh *sm, SShellLod *lod=NULL);
     void MakeEdgesInto(SEdgeList *sel);
     void MakeSectionEdgesInto(Vector n, double d,
                                 SEdgeList *sel, SBezierList *sbl);
     bool IsEmpty(void);
     void RemapFaces(Group *g, int remap);
+    uint64_t Hash(void);
+    void Clear(void);
+};
+
+// One surface's triangles, at each level of detail. The finest level is the
+// triangles that the surface contributed to the full mesh; each coarser one
+// has a chord tolerance LEVEL_RATIO times the last, and gets triangulated
+// only once a view needs it.
+class SSurfaceLod {
+public:
+    enum {
+        LEVELS      = 4,
+        LEVEL_RATIO = 4
+    };
+
+    Vector      ptMax, ptMin;
+    // The range of this surface's triangles in the full mesh
+    int         start, n;
+    // How many levels are worth having; a surface triangulated without a
+    // grid comes out the same at any chord tolerance.
+    int         levels;
+    SMesh       level[LEVELS];
+    bool        built[LEVELS];
+    int         shown;
+};
+
+// A shell's tessellation at many levels of detail, so that a surface that's
+// small on screen can be drawn with fewer triangles. This is for display
+// only; anything exported uses the full mesh.
+class SShellLod {
+public:
+    List<SSurfaceLod>   surface;
+    // The chord tolerance of the full mesh, in mm
+    double              chordTol;
+    // Triangles in the full mesh outside this range aren't from the shell,
+    // and so always get drawn as they are.
+    int                 shellStart, shellEnd;
+
+    SMesh               mesh;
+    bool                assembled;
+
+    SMesh *MeshForView(SShell *shell, SMesh *full);
     void Clear(void);
 };
 
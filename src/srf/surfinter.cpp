@@ -10,7 +10,8 @@
 extern int FLAG;
 
 void SSurface::AddExactIntersectionCurve(SBezier *sb, SSurface *srfB,
-                            SShell *agnstA, SShell *agnstB, SShell *into)
+                            SShell *agnstA, SShell *agnstB, SShell *into,
+                            SCurveBuffer *buf)
 {
     SCurve sc;
     ZERO(&sc);
@@ -23,23 +24,30 @@ void SSurface::AddExactIntersectionCurve(SBezier *sb, SSurface *srfB,
 
     // Now we have to piecewise linearize the curve. If there's already an
     // identical curve in the shell, then follow that pwl exactly, otherwise
-    // calculate from scratch.
+    // calculate from scratch. If we're writing to a buffer, then the curves
+    // that we generated earlier are there, after everything in the shell.
     SCurve split, *existing = NULL, *se;
     SBezier sbrev = *sb;
     sbrev.Reverse();
     bool backwards = false;
-    for(se = into->curve.First(); se; se = into->curve.NextAfter(se)) {
-        if(se->isExact) {
-            if(sb->Equals(&(se->exact))) {
-                existing = se;
-                break;
-            }
-            if(sbrev.Equals(&(se->exact))) {
-                existing = se;
-                backwards = true;
-                break;
+    IdList<SCurve,hSCurve> *search = &(into->curve);
+    for(;;) {
+        for(se = search->First(); se; se = search->NextAfter(se)) {
+            if(se->isExact) {
+                if(sb->Equals(&(se->exact))) {
+                    existing = se;
+                    break;
+                }
+                if(sbrev.Equals(&(se->exact))) {
+                    existing = se;
+                    backwards = true;
+                    break;
+                }
             }
         }
+        if(existing || !buf || search == &(buf->curve)) break;
+        buf->tried.Add(sb);
+        search = &(buf->curve);
     }
     if(existing) {
         SCurvePt *v;
@@ -102,11 +110,15 @@ void SSurface::AddExactIntersectionCurve(SBezier *sb, SSurface *srfB,
     if((sb->Start()).Equals(sb->Finish())) oops();
 
     split.source = SCurve::FROM_INTERSECTION;
-    into->curve.AddAndAssignId(&split);
+    if(buf) {
+        buf->curve.AddAndAssignId(&split);
+    } else {
+        into->curve.AddAndAssignId(&split);
+    }
 }
 
 void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
-                                SShell *into)
+                                SShell *into, SCurveBuffer *buf)
 {
     Vector amax, amin, bmax, bmin;
     GetAxisAlignedBounding(&amax, &amin);
@@ -180,7 +192,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
         if(tmax > tmin + LENGTH_EPS) {
             SBezier bezier = SBezier::From(p.Plus(dl.ScaledBy(tmin)),
                                            p.Plus(dl.ScaledBy(tmax)));
-            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into, buf);
         }
     } else if((degm == 1 && degn == 1 && isExtdb) ||
               (b->degm == 1 && b->degn == 1 && isExtdt))
@@ -226,7 +238,8 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
                 Vector al = along.ScaledBy(0.5);
                 SBezier bezier;
                 bezier = SBezier::From((si->p).Minus(al), (si->p).Plus(al));
-                AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+                AddExactIntersectionCurve(&bezier, b, agnstA, agnstB,
+                                          into, buf);
             }
 
             inters.Clear();
@@ -242,7 +255,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
                     Vector::AtIntersectionOfPlaneAndLine(n, d, p0, p1, NULL);
             }
 
-            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into, buf);
         }
     } else if(isExtdt && isExtdb &&
                 sqrt(fabs(alongt.Dot(alongb))) >
@@ -304,7 +317,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
 
             SBezier bezier;
             bezier = SBezier::From(p.Plus(axis0), p.Plus(axis1));
-            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into);
+            AddExactIntersectionCurve(&bezier, b, agnstA, agnstB, into, buf);
         }
 
         inters.Clear();
@@ -384,7 +397,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
 
             // Our chord tolerance is whatever the user specified
             double maxtol = SS.ChordTolMm();
-            int maxsteps = max(300, SS.maxSegments*3);
+            int maxsteps = max(300, SS.MaxSegments()*3);
 
             // The curve starts at our starting point.
             SCurvePt padd;
@@ -460,7 +473,11 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
             // And now we split and insert the curve
             SCurve split = sc.MakeCopySplitAgainst(agnstA, agnstB, this, b);
             sc.Clear();
-            into->curve.AddAndAssignId(&split);
+            if(buf) {
+                buf->curve.AddAndAssignId(&split);
+            } else {
+                into->curve.AddAndAssignId(&split);
+            }
         }
         spl.Clear();
     }
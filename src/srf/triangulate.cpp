@@ -8,7 +8,9 @@
 //-----------------------------------------------------------------------------
 #include "../solvespace.h"
 
-void SPolygon::UvTriangulateInto(SMesh *m, SSurface *srf) {
+void SPolygon::UvTriangulateInto(SMesh *m, SSurface *srf,
+                                 double chordTol)
+{
     if(l.n <= 0) return;
 
     //int64_t in = GetMilliseconds();
@@ -91,7 +93,7 @@ void SPolygon::UvTriangulateInto(SMesh *m, SSurface *srf) {
         }
 //        dbp("finished merging holes: %d ms", (int)(GetMilliseconds() - in));
 
-        merged.UvTriangulateInto(m, srf);
+        merged.UvTriangulateInto(m, srf, chordTol);
 //        dbp("finished ear clippping: %d ms", (int)(GetMilliseconds() - in));
         merged.l.Clear();
         el.Clear();
@@ -292,7 +294,9 @@ void SContour::ClipEarInto(SMesh *m, int bp, double scaledEps) {
     l.RemoveTagged();
 }
 
-void SContour::UvTriangulateInto(SMesh *m, SSurface *srf) {
+void SContour::UvTriangulateInto(SMesh *m, SSurface *srf,
+                                 double chordTol)
+{
     Vector tu, tv;
     srf->TangentsAt(0.5, 0.5, &tu, &tv);
     double s = sqrt(tu.MagSquared() + tv.MagSquared());
@@ -350,7 +354,7 @@ void SContour::UvTriangulateInto(SMesh *m, SSurface *srf) {
                     bestEar = ear;
                     bestChordTol = tol;
                 }
-                if(bestChordTol < 0.1*SS.ChordTolMm()) {
+                if(bestChordTol < 0.1*chordTol) {
                     break;
                 }
             }
@@ -389,7 +393,7 @@ Vector SSurface::PointAtMaybeSwapped(double u, double v, bool swapped) {
 }
 
 void SSurface::MakeTriangulationGridInto(List<double> *l, double vs, double vf,
-                                         bool swapped)
+                                         bool swapped, double chordTol)
 {
     double worst = 0;
 
@@ -415,16 +419,18 @@ void SSurface::MakeTriangulationGridInto(List<double> *l, double vs, double vf,
         worst = max(worst, pm2.DistanceToLine(ps, pf.Minus(ps)));
     }
 
-    double step = 1.0/SS.maxSegments;
-    if((vf - vs) < step || worst < SS.ChordTolMm()) {
+    double step = 1.0/SS.MaxSegments();
+    if((vf - vs) < step || worst < chordTol) {
         l->Add(&vf);
     } else {
-        MakeTriangulationGridInto(l, vs, (vs+vf)/2, swapped);
-        MakeTriangulationGridInto(l, (vs+vf)/2, vf, swapped);
+        MakeTriangulationGridInto(l, vs, (vs+vf)/2, swapped, chordTol);
+        MakeTriangulationGridInto(l, (vs+vf)/2, vf, swapped, chordTol);
     }
 }
 
-void SPolygon::UvGridTriangulateInto(SMesh *mesh, SSurface *srf) {
+void SPolygon::UvGridTriangulateInto(SMesh *mesh, SSurface *srf,
+                                     double chordTol)
+{
     SEdgeList orig;
     ZERO(&orig);
     MakeEdgesInto(&orig);
@@ -442,9 +448,9 @@ void SPolygon::UvGridTriangulateInto(SMesh *mesh, SSurface *srf) {
     ZERO(&lj);
     double v = 0;
     li.Add(&v);
-    srf->MakeTriangulationGridInto(&li, 0, 1, true);
+    srf->MakeTriangulationGridInto(&li, 0, 1, true, chordTol);
     lj.Add(&v);
-    srf->MakeTriangulationGridInto(&lj, 0, 1, false);
+    srf->MakeTriangulationGridInto(&lj, 0, 1, false, chordTol);
 
     // Now iterate over each quad in the grid. If it's outside the polygon,
     // or if it intersects the polygon, then we discard it. Otherwise we
@@ -509,7 +515,7 @@ void SPolygon::UvGridTriangulateInto(SMesh *mesh, SSurface *srf) {
     lj.Clear();
     hp.l.Clear();
 
-    UvTriangulateInto(mesh, srf);
+    UvTriangulateInto(mesh, srf, chordTol);
 }
 
 
@@ -19,63 +19,180 @@ const double System::RANK_MAG_TOLERANCE = 1e-4;
 // always be much less than LENGTH_EPS, and in practice should be much less.
 const double System::CONVERGE_TOLERANCE = (LENGTH_EPS/(1e2));
 
-bool System::WriteJacobian(int tag) {
-    int a, i, j;
+//-----------------------------------------------------------------------------
+// Find the column of the Jacobian that corresponds to a parameter, or -1 if
+// that parameter isn't an unknown in this subsystem. The columns are in
+// order of increasing handle, so this is a binary search.
+//-----------------------------------------------------------------------------
+static int ColumnOfParam(List<hParam> *cols, hParam hp) {
+    int first = 0, last = cols->n - 1;
+    while(first <= last) {
+        int mid = (first + last)/2;
+        uint32_t v = cols->elem[mid].v;
+        if(v > hp.v) {
+            last = mid - 1;
+        } else if(v < hp.v) {
+            first = mid + 1;
+        } else {
+            return mid;
+        }
+    }
+    return -1;
+}
 
-    j = 0;
-    for(a = 0; a < param.n; a++) {
-        if(j >= MAX_UNKNOWNS) return false;
+void System::WriteJacobian(int tag) {
+    int a, i, j, k, p;
 
-        Param *p = &(param.elem[a]);
-        if(p->tag != tag) continue;
-        mat.param[j] = p->h;
-        j++;
+    mat.param.Clear();
+    for(a = 0; a < param.n; a++) {
+        Param *pp = &(param.elem[a]);
+        if(pp->tag != tag) continue;
+        mat.param.Add(&(pp->h));
     }
-    mat.n = j;
+    mat.n = mat.param.n;
 
-    i = 0;
-    for(a = 0; a < eq.n; a++) {
-        if(i >= MAX_UNKNOWNS) return false;
+    mat.eq.Clear();
+    mat.A.row.Clear();
+    mat.A.col.Clear();
+    mat.A.reg.Clear();
+    mat.B.tape.Clear();
 
+    List<int> cols;
+    ZERO(&cols);
+    List<int> colReg;
+    ZERO(&colReg);
+    colReg.Resize(mat.n);
+
+    for(a = 0; a < eq.n; a++) {
         Equation *e = &(eq.elem[a]);
         if(e->tag != tag) continue;
 
-        mat.eq[i] = e->h;
-        Expr *f = e->e->DeepCopyWithParamsAsPointers(&param, &(SK.param));
+        mat.eq.Add(&(e->h));
+        mat.A.row.Add(&(mat.A.col.n));
+
+        Expr *f = e->e->DeepCopyWithParamsAsPointers(&param, sketchParam);
         f = f->FoldConstants();
+        i = mat.B.tape.AddRoot(f);
+
+        // Only the params that actually appear in this equation can have
+        // a nonzero partial, so that's all we need to write; and we'll
+        // find that partial in the adjoint of the instruction that loads
+        // the param.
+        ExprTape *t = &(mat.B.tape);
+        cols.Clear();
+        for(k = t->depStart.elem[i]; k < t->depStart.elem[i+1]; k++) {
+            int r = t->dep.elem[k];
+            ExprTape::Instr *in = &(t->instr.elem[r]);
+            if(in->op != Expr::PARAM_PTR) continue;
+
+            j = ColumnOfParam(&(mat.param), in->x.parp->h);
+            if(j < 0) continue;
+            cols.Add(&j);
+            colReg.elem[j] = r;
+        }
+        std::sort(cols.elem, cols.elem + cols.n);
 
-        // Hash table (61 bits) to accelerate generation of zero partials.
-        uint64_t scoreboard = f->ParamsUsed();
-        for(j = 0; j < mat.n; j++) {
-            Expr *pd;
-            if(scoreboard & ((uint64_t)1 << (mat.param[j].v % 61)) &&
-                f->DependsOn(mat.param[j]))
-            {
-                pd = f->PartialWrt(mat.param[j]);
-                pd = pd->FoldConstants();
-                pd = pd->DeepCopyWithParamsAsPointers(&param, &(SK.param));
-            } else {
-                pd = Expr::From(0.0);
+        for(k = 0; k < cols.n; k++) {
+            j = cols.elem[k];
+            mat.A.col.Add(&j);
+            mat.A.reg.Add(&(colReg.elem[j]));
+        }
+    }
+    mat.m = mat.eq.n;
+    mat.A.row.Add(&(mat.A.col.n));
+    cols.Clear();
+    colReg.Clear();
+
+    int nnz = mat.A.col.n;
+    mat.A.num.Resize(nnz);
+    mat.B.num.Resize(mat.m);
+    mat.scale.Resize(mat.n);
+    mat.X.Resize(mat.n);
+    mat.Z.Resize(mat.m);
+
+    // Index the same entries by column, with a counting sort.
+    mat.A.colStart.Resize(mat.n + 1);
+    for(j = 0; j <= mat.n; j++) {
+        mat.A.colStart.elem[j] = 0;
+    }
+    for(p = 0; p < nnz; p++) {
+        mat.A.colStart.elem[mat.A.col.elem[p] + 1]++;
+    }
+    for(j = 0; j < mat.n; j++) {
+        mat.A.colStart.elem[j+1] += mat.A.colStart.elem[j];
+    }
+    mat.A.colEntry.Resize(nnz);
+    mat.A.colRow.Resize(nnz);
+    List<int> next;
+    ZERO(&next);
+    next.Resize(mat.n);
+    for(j = 0; j < mat.n; j++) {
+        next.elem[j] = mat.A.colStart.elem[j];
+    }
+    for(i = 0; i < mat.m; i++) {
+        for(p = mat.A.row.elem[i]; p < mat.A.row.elem[i+1]; p++) {
+            k = next.elem[mat.A.col.elem[p]]++;
+            mat.A.colEntry.elem[k] = p;
+            mat.A.colRow.elem[k] = i;
+        }
+    }
+    next.Clear();
+
+    // And write the structure of A*A'; rows i and k have a nonzero there
+    // if they have any unknown in common. The diagonal is always written,
+    // even for an equation with no unknowns, so that the rank test will
+    // see that as a zero row.
+    SparseLdl *ldl = &(mat.AAt);
+    ldl->n = mat.m;
+    ldl->Ap.Resize(mat.m + 1);
+    ldl->Ai.Clear();
+    List<int> mark;
+    ZERO(&mark);
+    mark.Resize(mat.m);
+    for(i = 0; i < mat.m; i++) {
+        mark.elem[i] = -1;
+    }
+    for(i = 0; i < mat.m; i++) {
+        ldl->Ap.elem[i] = ldl->Ai.n;
+        mark.elem[i] = i;
+        ldl->Ai.Add(&i);
+        for(p = mat.A.row.elem[i]; p < mat.A.row.elem[i+1]; p++) {
+            j = mat.A.col.elem[p];
+            for(k = mat.A.colStart.elem[j]; k < mat.A.colStart.elem[j+1]; k++) {
+                int r = mat.A.colRow.elem[k];
+                if(mark.elem[r] == i) continue;
+                mark.elem[r] = i;
+                ldl->Ai.Add(&r);
             }
-            mat.A.sym[i][j] = pd;
         }
-        mat.B.sym[i] = f;
-        i++;
     }
-    mat.m = i;
+    ldl->Ap.elem[mat.m] = ldl->Ai.n;
+    ldl->Ax.Resize(ldl->Ai.n);
+    mark.Clear();
 
-    return true;
+    ldl->Analyze();
 }
 
 void System::EvalJacobian(void) {
-    int i, j;
+    int i, p;
+    ExprTape *t = &(mat.B.tape);
+    t->Eval();
     for(i = 0; i < mat.m; i++) {
-        for(j = 0; j < mat.n; j++) {
-            mat.A.num[i][j] = (mat.A.sym[i][j])->Eval();
+        t->Gradient(i);
+        for(p = mat.A.row.elem[i]; p < mat.A.row.elem[i+1]; p++) {
+            mat.A.num.elem[p] = t->adj.elem[mat.A.reg.elem[p]];
         }
     }
 }
 
+void System::EvalResiduals(void) {
+    int i;
+    mat.B.tape.Eval();
+    for(i = 0; i < mat.m; i++) {
+        mat.B.num.elem[i] = mat.B.tape.RootValue(i);
+    }
+}
+
 bool System::IsDragged(hParam p) {
     hParam *pp;
     for(pp = dragged.First(); pp; pp = dragged.NextAfter(pp)) {
@@ -84,8 +201,33 @@ bool System::IsDragged(hParam p) {
     return false;
 }
 
+//-----------------------------------------------------------------------------
+// Solve the equations of the form a - b = 0 by substitution, replacing one
+// param with the other everywhere. The params that are equal fall into
+// sets, which we find with union-find, and each set is replaced by a single
+// param; then we rewrite the equations once, at the end. A param that's
+// being dragged stays in preference to the one that it's equal to, and an
+// equation whose two params are already in the same set is redundant, so
+// we just drop it.
+//-----------------------------------------------------------------------------
+static int FindSubstitute(List<int> *parent, int i) {
+    while(parent->elem[i] != i) {
+        parent->elem[i] = parent->elem[parent->elem[i]];
+        i = parent->elem[i];
+    }
+    return i;
+}
 void System::SolveBySubstitution(void) {
     int i;
+
+    List<int> parent;
+    ZERO(&parent);
+    parent.Resize(param.n);
+    for(i = 0; i < param.n; i++) {
+        parent.elem[i] = i;
+    }
+
+    bool any = false;
     for(i = 0; i < eq.n; i++) {
         Equation *teq = &(eq.elem[i]);
         Expr *tex = teq->e;
@@ -94,180 +236,131 @@ void System::SolveBySubstitution(void) {
            tex->a->op == Expr::PARAM &&
            tex->b->op == Expr::PARAM)
         {
-            hParam a = (tex->a)->x.parh;
-            hParam b = (tex->b)->x.parh;
-            if(!(param.FindByIdNoOops(a) && param.FindByIdNoOops(b))) {
+            Param *pa = param.FindByIdNoOops((tex->a)->x.parh),
+                  *pb = param.FindByIdNoOops((tex->b)->x.parh);
+            if(!(pa && pb)) {
                 // Don't substitute unless they're both solver params;
                 // otherwise it's an equation that can be solved immediately,
                 // or an error to flag later.
                 continue;
             }
 
-            if(IsDragged(a)) {
-                // A is being dragged, so A should stay, and B should go
-                hParam t = a;
-                a = b;
-                b = t;
-            }
-
-            int j;
-            for(j = 0; j < eq.n; j++) {
-                Equation *req = &(eq.elem[j]);
-                (req->e)->Substitute(a, b); // A becomes B, B unchanged
-            }
-            for(j = 0; j < param.n; j++) {
-                Param *rp = &(param.elem[j]);
-                if(rp->substd.v == a.v) {
-                    rp->substd = b;
+            // A becomes B, B unchanged
+            int a = FindSubstitute(&parent, (int)(pa - param.elem)),
+                b = FindSubstitute(&parent, (int)(pb - param.elem));
+            if(a != b) {
+                if(IsDragged(param.elem[a].h)) {
+                    // A is being dragged, so A should stay, and B should go
+                    swap(a, b);
                 }
+                parent.elem[a] = b;
             }
-            Param *ptr = param.FindById(a);
-            ptr->tag = VAR_SUBSTITUTED;
-            ptr->substd = b;
 
             teq->tag = EQ_SUBSTITUTED;
+            any = true;
         }
     }
-}
-
-//-----------------------------------------------------------------------------
-// Calculate the rank of the Jacobian matrix, by Gram-Schimdt orthogonalization
-// in place. A row (~equation) is considered to be all zeros if its magnitude
-// is less than the tolerance RANK_MAG_TOLERANCE.
-//-----------------------------------------------------------------------------
-int System::CalculateRank(void) {
-    // Actually work with magnitudes squared, not the magnitudes
-    double rowMag[MAX_UNKNOWNS];
-    ZERO(&rowMag);
-    double tol = RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE;
 
-    int i, iprev, j;
-    int rank = 0;
+    if(any) {
+        for(i = 0; i < param.n; i++) {
+            int r = FindSubstitute(&parent, i);
+            if(r == i) continue;
 
-    for(i = 0; i < mat.m; i++) {
-        // Subtract off this row's component in the direction of any
-        // previous rows
-        for(iprev = 0; iprev < i; iprev++) {
-            if(rowMag[iprev] <= tol) continue; // ignore zero rows
-
-            double dot = 0;
-            for(j = 0; j < mat.n; j++) {
-                dot += (mat.A.num[iprev][j]) * (mat.A.num[i][j]);
-            }
-            for(j = 0; j < mat.n; j++) {
-                mat.A.num[i][j] -= (dot/rowMag[iprev])*mat.A.num[iprev][j];
-            }
+            Param *p = &(param.elem[i]);
+            p->tag = VAR_SUBSTITUTED;
+            p->substd = param.elem[r].h;
         }
-        // Our row is now normal to all previous rows; calculate the
-        // magnitude of what's left
-        double mag = 0;
-        for(j = 0; j < mat.n; j++) {
-            mag += (mat.A.num[i][j]) * (mat.A.num[i][j]);
-        }
-        if(mag > tol) {
-            rank++;
+        for(i = 0; i < eq.n; i++) {
+            (eq.elem[i].e)->Substitute(&param);
         }
-        rowMag[i] = mag;
     }
-
-    return rank;
+    parent.Clear();
 }
 
-bool System::SolveLinearSystem(double X[], double A[][MAX_UNKNOWNS],
-                               double B[], int n)
-{
-    // Gaussian elimination, with partial pivoting. It's an error if the
-    // matrix is singular, because that means two constraints are
-    // equivalent.
-    int i, j, ip, jp, imax = 0;
-    double max, temp;
-
-    for(i = 0; i < n; i++) {
-        // We are trying eliminate the term in column i, for rows i+1 and
-        // greater. First, find a pivot (between rows i and N-1).
-        max = 0;
-        for(ip = i; ip < n; ip++) {
-            if(ffabs(A[ip][i]) > max) {
-                imax = ip;
-                max = ffabs(A[ip][i]);
-            }
-        }
-        // Don't give up on a singular matrix unless it's really bad; the
-        // assumption code is responsible for identifying that condition,
-        // so we're not responsible for reporting that error.
-        if(ffabs(max) < 1e-20) return false;
-
-        // Swap row imax with row i
-        for(jp = 0; jp < n; jp++) {
-            swap(A[i][jp], A[imax][jp]);
-        }
-        swap(B[i], B[imax]);
-
-        // For rows i+1 and greater, eliminate the term in column i.
-        for(ip = i+1; ip < n; ip++) {
-            temp = A[ip][i]/A[i][i];
+//-----------------------------------------------------------------------------
+// Write A*A' into the sparse symmetric matrix that we'll factor, using the
+// structure from WriteJacobian. Column i of A*A' is the dot product of row
+// i of A with every row, but only rows with an unknown in common can give a
+// nonzero, so we accumulate those column by column of A.
+//-----------------------------------------------------------------------------
+void System::EvalAAt(void) {
+    int i, j, p, k;
+    double *w = mat.Z.elem;
+    for(i = 0; i < mat.m; i++) {
+        w[i] = 0;
+    }
 
-            for(jp = i; jp < n; jp++) {
-                A[ip][jp] -= temp*(A[i][jp]);
+    SparseLdl *ldl = &(mat.AAt);
+    for(i = 0; i < mat.m; i++) {
+        for(p = mat.A.row.elem[i]; p < mat.A.row.elem[i+1]; p++) {
+            j = mat.A.col.elem[p];
+            double v = mat.A.num.elem[p];
+            for(k = mat.A.colStart.elem[j]; k < mat.A.colStart.elem[j+1]; k++) {
+                w[mat.A.colRow.elem[k]] += v*mat.A.num.elem[mat.A.colEntry.elem[k]];
             }
-            B[ip] -= temp*B[i];
         }
-    }
-
-    // We've put the matrix in upper triangular form, so at this point we
-    // can solve by back-substitution.
-    for(i = n - 1; i >= 0; i--) {
-        if(ffabs(A[i][i]) < 1e-20) return false;
-
-        temp = B[i];
-        for(j = n - 1; j > i; j--) {
-            temp -= X[j]*A[i][j];
+        for(k = ldl->Ap.elem[i]; k < ldl->Ap.elem[i+1]; k++) {
+            int r = ldl->Ai.elem[k];
+            ldl->Ax.elem[k] = w[r];
+            w[r] = 0;
         }
-        X[i] = temp / A[i][i];
     }
+}
 
-    return true;
+//-----------------------------------------------------------------------------
+// Calculate the rank of the Jacobian matrix. This is the LDL' factorization
+// of A*A', which is Gram-Schmidt orthogonalization of the rows of A: each
+// pivot is the squared magnitude of what's left of a row after subtracting
+// its components along the previous rows. A row (~equation) is considered
+// to be all zeros if its magnitude is less than RANK_MAG_TOLERANCE.
+//-----------------------------------------------------------------------------
+int System::CalculateRank(void) {
+    // Actually work with magnitudes squared, not the magnitudes
+    double tol = RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE;
+
+    EvalAAt();
+    return mat.AAt.Factor(tol);
 }
 
 bool System::SolveLeastSquares(void) {
-    int r, c, i;
+    int r, c, p;
 
     // Scale the columns; this scale weights the parameters for the least
     // squares solve, so that we can encourage the solver to make bigger
     // changes in some parameters, and smaller in others.
     for(c = 0; c < mat.n; c++) {
-        if(IsDragged(mat.param[c])) {
+        if(IsDragged(mat.param.elem[c])) {
             // It's least squares, so this parameter doesn't need to be all
             // that big to get a large effect.
-            mat.scale[c] = 1/20.0;
+            mat.scale.elem[c] = 1/20.0;
         } else {
-            mat.scale[c] = 1;
-        }
-        for(r = 0; r < mat.m; r++) {
-            mat.A.num[r][c] *= mat.scale[c];
+            mat.scale.elem[c] = 1;
         }
     }
+    for(p = 0; p < mat.A.num.n; p++) {
+        mat.A.num.elem[p] *= mat.scale.elem[mat.A.col.elem[p]];
+    }
+
+    // Write A*A', and factor it. It's an error if the matrix is singular,
+    // because that means two constraints are equivalent; but don't give up
+    // unless it's really bad, since the rank test is responsible for
+    // reporting that.
+    EvalAAt();
+    if(mat.AAt.Factor(1e-20) != mat.m) return false;
 
-    // Write A*A'
     for(r = 0; r < mat.m; r++) {
-        for(c = 0; c < mat.m; c++) {  // yes, AAt is square
-            double sum = 0;
-            for(i = 0; i < mat.n; i++) {
-                sum += mat.A.num[r][i]*mat.A.num[c][i];
-            }
-            mat.AAt[r][c] = sum;
-        }
+        mat.Z.elem[r] = mat.B.num.elem[r];
     }
-
-    if(!SolveLinearSystem(mat.Z, mat.AAt, mat.B.num, mat.m)) return false;
+    mat.AAt.Solve(mat.Z.elem);
 
     // And multiply that by A' to get our solution.
     for(c = 0; c < mat.n; c++) {
         double sum = 0;
-        for(i = 0; i < mat.m; i++) {
-            sum += mat.A.num[i][c]*mat.Z[i];
+        for(p = mat.A.colStart.elem[c]; p < mat.A.colStart.elem[c+1]; p++) {
+            sum += mat.A.num.elem[mat.A.colEntry.elem[p]]*
+                   mat.Z.elem[mat.A.colRow.elem[p]];
         }
-        mat.X[c] = sum * mat.scale[c];
+        mat.X.elem[c] = sum * mat.scale.elem[c];
     }
     return true;
 }
@@ -280,20 +373,19 @@ bool System::NewtonSolve(int tag) {
     int i;
 
     // Evaluate the functions at our operating point.
-    for(i = 0; i < mat.m; i++) {
-        mat.B.num[i] = (mat.B.sym[i])->Eval();
-    }
+    EvalResiduals();
     do {
         // And evaluate the Jacobian at our initial operating point.
         EvalJacobian();
 
         if(!SolveLeastSquares()) break;
+        iterations++;
 
         // Take the Newton step;
         //      J(x_n) (x_{n+1} - x_n) = 0 - F(x_n)
         for(i = 0; i < mat.n; i++) {
-            Param *p = param.FindById(mat.param[i]);
-            p->val -= mat.X[i];
+            Param *p = param.FindById(mat.param.elem[i]);
+            p->val -= mat.X.elem[i];
             if(isnan(p->val)) {
                 // Very bad, and clearly not convergent
                 return false;
@@ -301,16 +393,14 @@ bool System::NewtonSolve(int tag) {
         }
 
         // Re-evalute the functions, since the params have just changed.
-        for(i = 0; i < mat.m; i++) {
-            mat.B.num[i] = (mat.B.sym[i])->Eval();
-        }
+        EvalResiduals();
         // Check for convergence
         converged = true;
         for(i = 0; i < mat.m; i++) {
-            if(isnan(mat.B.num[i])) {
+            if(isnan(mat.B.num.elem[i])) {
                 return false;
             }
-            if(ffabs(mat.B.num[i]) > CONVERGE_TOLERANCE) {
+            if(ffabs(mat.B.num.elem[i]) > CONVERGE_TOLERANCE) {
                 converged = false;
                 break;
             }
@@ -320,6 +410,441 @@ bool System::NewtonSolve(int tag) {
     return converged;
 }
 
+//-----------------------------------------------------------------------------
+// Split the equations and unknowns with tag zero into independent subsystems,
+// where two equations are in the same subsystem if they have any unknown in
+// common, directly or through other equations. The subsystems get tags
+// starting from tag, in order of their first equation, and we return the
+// next unused tag. An equation with no unknowns is a subsystem by itself
+// (and a singular one); an unknown in no equation keeps tag zero.
+//-----------------------------------------------------------------------------
+int System::TagSubsystems(int tag) {
+    int i, k;
+
+    // A union-find over the params, by their index in the table
+    List<int> up;
+    ZERO(&up);
+    up.Resize(param.n);
+    for(i = 0; i < param.n; i++) {
+        up.elem[i] = i;
+    }
+    // The param that represents each equation's subsystem, or -1
+    List<int> eqParam;
+    ZERO(&eqParam);
+    eqParam.Resize(eq.n);
+
+    List<hParam> used;
+    ZERO(&used);
+    for(i = 0; i < eq.n; i++) {
+        Equation *e = &(eq.elem[i]);
+        eqParam.elem[i] = -1;
+        if(e->tag != 0) continue;
+
+        used.Clear();
+        e->e->ParamsUsedList(&used);
+        for(k = 0; k < used.n; k++) {
+            Param *p = param.FindByIdNoOops(used.elem[k]);
+            if(!p || p->tag != 0) continue;
+
+            int r = (int)(p - param.elem);
+            while(up.elem[r] != r) {
+                r = up.elem[r] = up.elem[up.elem[r]];
+            }
+            if(eqParam.elem[i] < 0) {
+                eqParam.elem[i] = r;
+            } else {
+                up.elem[r] = eqParam.elem[i];
+            }
+        }
+    }
+    used.Clear();
+
+    // Now number the subsystems, by the root param of each.
+    List<int> paramTag;
+    ZERO(&paramTag);
+    paramTag.Resize(param.n);
+    for(i = 0; i < param.n; i++) {
+        paramTag.elem[i] = 0;
+    }
+    for(i = 0; i < eq.n; i++) {
+        Equation *e = &(eq.elem[i]);
+        if(e->tag != 0) continue;
+
+        int r = eqParam.elem[i];
+        if(r < 0) {
+            e->tag = tag++;
+            continue;
+        }
+        while(up.elem[r] != r) {
+            r = up.elem[r] = up.elem[up.elem[r]];
+        }
+        if(paramTag.elem[r] == 0) {
+            paramTag.elem[r] = tag++;
+        }
+        e->tag = paramTag.elem[r];
+    }
+    for(i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        if(p->tag != 0) continue;
+
+        int r = i;
+        while(up.elem[r] != r) {
+            r = up.elem[r];
+        }
+        p->tag = paramTag.elem[r];
+    }
+
+    up.Clear();
+    eqParam.Clear();
+    paramTag.Clear();
+    return tag;
+}
+
+//-----------------------------------------------------------------------------
+// Copy one subsystem of from into this (otherwise unused) System: its
+// equations, and every param that those use, including the ones from other
+// subsystems that are already solved and now just constants.
+//-----------------------------------------------------------------------------
+static bool HParamBefore(const hParam &a, const hParam &b) {
+    return a.v < b.v;
+}
+void System::CopySubsystemFrom(System *from, Subsystem *ss) {
+    int i, k;
+
+    eq.Clear();
+    param.Clear();
+    dragged.Clear();
+    sketchParam = from->sketchParam;
+
+    List<hParam> used, all;
+    ZERO(&used);
+    ZERO(&all);
+    for(i = ss->eqStart; i < ss->eqEnd; i++) {
+        Equation *e = &(from->eq.elem[from->subsysEq.elem[i]]);
+        eq.Add(e);
+
+        used.Clear();
+        e->e->ParamsUsedList(&used);
+        for(k = 0; k < used.n; k++) {
+            all.Add(&(used.elem[k]));
+        }
+    }
+    std::sort(all.elem, all.elem + all.n, HParamBefore);
+    for(k = 0; k < all.n; k++) {
+        if(k > 0 && all.elem[k].v == all.elem[k-1].v) continue;
+        Param *p = from->param.FindByIdNoOops(all.elem[k]);
+        if(p) param.Add(p);
+    }
+    used.Clear();
+    all.Clear();
+
+    for(i = 0; i < from->dragged.n; i++) {
+        dragged.Add(&(from->dragged.elem[i]));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Mark the unknowns that the equations don't determine, at the solution.
+// Unknown j is bound if making it a constant would leave the Jacobian short
+// of full rank, which is if its unit vector e_j lies in the span of the rows
+// of A. So we project e_j onto that span: the squared distance between the
+// two is 1 - a_j'*(A*A')^-1*a_j, where a_j is column j of A. That's one
+// solve per unknown, all against the same factorization.
+//-----------------------------------------------------------------------------
+void System::FindFree(void) {
+    int i, j, p;
+
+    EvalJacobian();
+    // If the Jacobian lost rank at the solution, then removing a column
+    // can't restore it, so nothing is free.
+    if(CalculateRank() != mat.m) return;
+
+    double *z = mat.Z.elem;
+    for(j = 0; j < mat.n; j++) {
+        for(i = 0; i < mat.m; i++) {
+            z[i] = 0;
+        }
+        for(p = mat.A.colStart.elem[j]; p < mat.A.colStart.elem[j+1]; p++) {
+            z[mat.A.colRow.elem[p]] = mat.A.num.elem[mat.A.colEntry.elem[p]];
+        }
+        mat.AAt.Solve(z);
+
+        double h = 0;
+        for(p = mat.A.colStart.elem[j]; p < mat.A.colStart.elem[j+1]; p++) {
+            h += mat.A.num.elem[mat.A.colEntry.elem[p]]*
+                 z[mat.A.colRow.elem[p]];
+        }
+        if(1 - h > RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE) {
+            param.FindById(mat.param.elem[j])->free = true;
+        }
+    }
+    for(i = 0; i < mat.m; i++) {
+        z[i] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Solve subsystem i, in its own System. If again, then that System still
+// holds this subsystem's Jacobian from the last solve, so we need only copy
+// in the new initial guesses.
+//-----------------------------------------------------------------------------
+void System::SolveSubsystem(int i, bool andFindFree, bool again) {
+    Subsystem *ss = &(subsys.elem[i]);
+    System *sys = ss->sys;
+    int tag = ss->tag, k;
+
+    ss->iterations = 0;
+    if(again) {
+        for(k = 0; k < sys->param.n; k++) {
+            Param *p = &(sys->param.elem[k]);
+            p->val = param.FindById(p->h)->val;
+        }
+    } else {
+        sys->CopySubsystemFrom(this, ss);
+        sys->WriteJacobian(tag);
+    }
+
+    // Do a rank test; that tells us if the subsystem is inconsistently
+    // constrained. Don't for an equation that we're solving alone, since
+    // the rank test for the system that it came from will catch that.
+    if(!ss->alone) {
+        sys->EvalJacobian();
+        if(sys->CalculateRank() != sys->mat.m) {
+            ss->result = SINGULAR_JACOBIAN;
+            return;
+        }
+    }
+    ss->dof = sys->mat.n - sys->mat.m;
+
+    sys->iterations = 0;
+    bool converged = sys->NewtonSolve(tag);
+    ss->iterations = sys->iterations;
+    if(!converged) {
+        ss->result = DIDNT_CONVERGE;
+        return;
+    }
+
+    // If requested, find all the free (unbound) variables. Only the other
+    // unknowns in this subsystem can matter for that.
+    for(k = 0; k < sys->param.n; k++) {
+        Param *p = &(sys->param.elem[k]);
+        if(p->tag != tag) continue;
+
+        p->free = false;
+    }
+    if(andFindFree && !ss->alone) {
+        sys->FindFree();
+    }
+    // The equations are on the temporary heap, so don't keep them.
+    sys->eq.Clear();
+
+    // And write the solution back. The subsystems have no params in
+    // common, so this is safe even with other threads doing the same.
+    for(k = 0; k < sys->param.n; k++) {
+        Param *p = &(sys->param.elem[k]);
+        if(p->tag != tag) continue;
+
+        Param *pp = param.FindById(p->h);
+        pp->val = p->val;
+        pp->free = p->free;
+    }
+    ss->result = SOLVED_OKAY;
+}
+
+//-----------------------------------------------------------------------------
+// The subsystems are independent, so they can be solved in parallel.
+//-----------------------------------------------------------------------------
+typedef struct {
+    System     *sys;
+    int         start;
+    bool        andFindFree;
+    bool        again;
+} SolveJob;
+
+static void SolveSubsystemOf(void *data, int i) {
+    SolveJob *job = (SolveJob *)data;
+    job->sys->SolveSubsystem(job->start + i, job->andFindFree, job->again);
+}
+
+//-----------------------------------------------------------------------------
+// Set up the subsystems with tags from first to last, where those before
+// alone are single equations that get solved before all the others. Each
+// gets a System of its own to be solved in, kept from one solve to the next.
+//-----------------------------------------------------------------------------
+void System::WriteSubsystems(int first, int alone, int last) {
+    int i, t;
+
+    // Sort the equations by subsystem, so that each can be copied out
+    // without looking at any of the others.
+    subsys.Clear();
+    for(t = first; t < last; t++) {
+        Subsystem ss;
+        ZERO(&ss);
+        ss.tag = t;
+        ss.alone = (t < alone);
+        subsys.Add(&ss);
+    }
+    for(i = 0; i < eq.n; i++) {
+        t = eq.elem[i].tag;
+        if(t < first || t >= last) continue;
+        subsys.elem[t - first].eqEnd++;
+    }
+    int start = 0;
+    for(i = 0; i < subsys.n; i++) {
+        Subsystem *ss = &(subsys.elem[i]);
+        ss->eqStart = start;
+        start += ss->eqEnd;
+        ss->eqEnd = ss->eqStart;
+    }
+    subsysEq.Resize(start);
+    for(i = 0; i < eq.n; i++) {
+        t = eq.elem[i].tag;
+        if(t < first || t >= last) continue;
+        subsysEq.elem[(subsys.elem[t - first].eqEnd)++] = i;
+    }
+
+    while(subsysSys.n < subsys.n) {
+        System *sys = (System *)MemAlloc(sizeof(*sys));
+        memset(sys, 0, sizeof(*sys));
+        subsysSys.Add(&sys);
+    }
+    for(i = 0; i < subsys.n; i++) {
+        subsys.elem[i].sys = subsysSys.elem[i];
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Solve the subsystems from start to finish, in parallel if that's worth it.
+// Returns the first one that didn't solve, or -1 if all did.
+//-----------------------------------------------------------------------------
+int System::SolveSubsystems(int start, int finish, bool andFindFree,
+                            bool again)
+{
+    int i, eqs = 0;
+    for(i = start; i < finish; i++) {
+        eqs += subsys.elem[i].eqEnd - subsys.elem[i].eqStart;
+    }
+
+    // Don't bother with threads unless there's enough work to share.
+    if(finish - start >= 2 && eqs >= PARALLEL_MIN_EQUATIONS) {
+        SolveJob job = { this, start, andFindFree, again };
+        ParallelFor(finish - start, SolveSubsystemOf, &job);
+    } else {
+        for(i = start; i < finish; i++) {
+            SolveSubsystem(i, andFindFree, again);
+        }
+    }
+
+    for(i = start; i < finish; i++) {
+        iterations += subsys.elem[i].iterations;
+    }
+    for(i = start; i < finish; i++) {
+        if(subsys.elem[i].result != SOLVED_OKAY) return i;
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// A hash of everything that goes in to the subsystems' Jacobians: the
+// equations, the unknowns, and what's dragged. If that's the same as last
+// time, then we can reuse those Jacobians. Returns zero if the system can't
+// be reused at all.
+//-----------------------------------------------------------------------------
+uint64_t System::HashExpr(Expr *e, uint64_t h) {
+    h = HashMix(h, (uint64_t)e->op);
+    switch(e->op) {
+        case Expr::PARAM: {
+            h = HashMix(h, e->x.parh.v);
+            if(param.FindByIdNoOops(e->x.parh)) break;
+
+            // Not one of our unknowns, so its value is built in to the
+            // Jacobian as a constant. If it's not even known, then it can't
+            // be a constant, and we'd be pointing into SK; so no reuse.
+            Param *p = sketchParam->FindByIdNoOops(e->x.parh);
+            if(!p || !p->known) return 0;
+            uint64_t u;
+            memcpy(&u, &(p->val), sizeof(u));
+            h = HashMix(h, u);
+            break;
+        }
+        case Expr::CONSTANT: {
+            uint64_t u;
+            memcpy(&u, &(e->x.v), sizeof(u));
+            h = HashMix(h, u);
+            break;
+        }
+        case Expr::PARAM_PTR:
+            return 0;
+
+        default: {
+            int c = e->Children();
+            if(c >= 1) {
+                h = HashExpr(e->a, h);
+                if(h == 0) return 0;
+            }
+            if(c >= 2) {
+                h = HashExpr(e->b, h);
+                if(h == 0) return 0;
+            }
+            break;
+        }
+    }
+    return h ? h : 1;
+}
+uint64_t System::HashSystem(Group *g) {
+    int i;
+    uint64_t h = HashMix(1, g->h.v);
+    for(i = 0; i < param.n; i++) {
+        h = HashMix(h, param.elem[i].h.v);
+    }
+    for(i = 0; i < dragged.n; i++) {
+        h = HashMix(h, dragged.elem[i].v);
+    }
+    for(i = 0; i < eq.n; i++) {
+        h = HashMix(h, eq.elem[i].h.v);
+        h = HashExpr(eq.elem[i].e, h);
+        if(h == 0) return 0;
+    }
+    return h ? h : 1;
+}
+
+//-----------------------------------------------------------------------------
+// Solve using the substitutions and subsystems, and their Jacobians, from
+// the last solve; that's valid when we're dragging, since only the initial
+// guesses change from frame to frame. Returns false, with the params as we
+// found them, if that fails; then we'll solve from scratch, to report why.
+//-----------------------------------------------------------------------------
+bool System::SolveAgain(void) {
+    int i;
+    List<double> vals;
+    ZERO(&vals);
+    vals.Resize(param.n);
+    for(i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        vals.elem[i] = p->val;
+        p->tag = drag.paramTag.elem[i];
+        p->substd = drag.paramSubstd.elem[i];
+    }
+
+    bool okay = SolveSubsystems(0, drag.alone, false, true) < 0 &&
+                SolveSubsystems(drag.alone, subsys.n, false, true) < 0;
+
+    if(okay) {
+        // The free params aren't found during a drag.
+        for(i = 0; i < param.n; i++) {
+            param.elem[i].free = false;
+        }
+    } else {
+        for(i = 0; i < param.n; i++) {
+            Param *p = &(param.elem[i]);
+            p->val = vals.elem[i];
+            p->tag = 0;
+        }
+    }
+    vals.Clear();
+    return okay;
+}
+
 void System::WriteEquationsExceptFor(hConstraint hc, Group *g) {
     int i;
     // Generate all the equations from constraints in this group
@@ -356,9 +881,59 @@ void System::WriteEquationsExceptFor(hConstraint hc, Group *g) {
     g->GenerateEquations(&eq);
 }
 
+//-----------------------------------------------------------------------------
+// Find the constraints that we could remove to make the Jacobian full rank.
+// The rows of a rank-deficient Jacobian satisfy some linear dependencies,
+// and each zero pivot of the factorization gives us one of those. Removing
+// a constraint's rows fixes things exactly when every dependency involves
+// those rows, so when the dependencies, restricted to those rows, are still
+// linearly independent. So we factor once, and then test each constraint
+// against the (few) dependencies.
+//-----------------------------------------------------------------------------
+static bool HEquationBefore(const hEquation &a, const hEquation &b) {
+    return a.v < b.v;
+}
 void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad) {
-    int a, i;
+    int a, i, j, k, r;
 
+    // Write every equation, without solving any by substitution, since
+    // that would remove the rows of the point-coincident constraints (and
+    // any others of the form a - b = 0) that we want to test.
+    param.ClearTags();
+    eq.Clear();
+    WriteEquationsExceptFor(Constraint::NO_CONSTRAINT, g);
+    eq.ClearTags();
+
+    WriteJacobian(0);
+    EvalJacobian();
+    int deps = mat.m - CalculateRank();
+    if(deps <= 0) return;
+
+    // Get the dependencies, and make them orthonormal, so that the test
+    // below measures how much each constraint is involved in them.
+    List<double> dep;
+    ZERO(&dep);
+    dep.Resize(deps*mat.m);
+    j = 0;
+    for(k = 0; k < mat.m; k++) {
+        if(!EXACT(mat.AAt.D.elem[k] == 0)) continue;
+        double *v = &(dep.elem[j*mat.m]);
+        mat.AAt.NullVector(k, v);
+        for(a = 0; a < j; a++) {
+            double *u = &(dep.elem[a*mat.m]);
+            double dot = 0;
+            for(r = 0; r < mat.m; r++) dot += u[r]*v[r];
+            for(r = 0; r < mat.m; r++) v[r] -= dot*u[r];
+        }
+        double mag = 0;
+        for(r = 0; r < mat.m; r++) mag += v[r]*v[r];
+        mag = sqrt(mag);
+        for(r = 0; r < mat.m; r++) v[r] /= mag;
+        j++;
+    }
+
+    List<double> rows;
+    ZERO(&rows);
     for(a = 0; a < 2; a++) {
         for(i = 0; i < SK.constraint.n; i++) {
             ConstraintBase *c = &(SK.constraint.elem[i]);
@@ -372,33 +947,65 @@ void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad) {
                 continue;
             }
 
-            param.ClearTags();
-            eq.Clear();
-            WriteEquationsExceptFor(c->h, g);
-            eq.ClearTags();
-
-            // It's a major speedup to solve the easy ones by substitution here,
-            // and that doesn't break anything.
-            SolveBySubstitution();
-
-            WriteJacobian(0);
-            EvalJacobian();
-
-            int rank = CalculateRank();
-            if(rank == mat.m) {
-                // We fixed it by removing this constraint
+            // The equations are in order of handle, so this constraint's
+            // rows are consecutive.
+            hEquation he = c->h.equation(0);
+            int start = std::lower_bound(mat.eq.elem, mat.eq.elem + mat.m, he,
+                                         HEquationBefore) - mat.eq.elem;
+            int n;
+            for(n = 0; start + n < mat.m; n++) {
+                hEquation hr = mat.eq.elem[start + n];
+                if(!hr.isFromConstraint() || hr.constraint().v != c->h.v) {
+                    break;
+                }
+            }
+            if(n < deps) continue;
+
+            // Gram-Schmidt on the dependencies, restricted to these rows;
+            // we fixed it by removing this constraint if none of them
+            // vanishes.
+            rows.Resize(deps*n);
+            for(j = 0; j < deps; j++) {
+                for(r = 0; r < n; r++) {
+                    rows.elem[j*n + r] = dep.elem[j*mat.m + start + r];
+                }
+            }
+            bool fixed = true;
+            for(j = 0; j < deps && fixed; j++) {
+                double *v = &(rows.elem[j*n]);
+                for(k = 0; k < j; k++) {
+                    double *u = &(rows.elem[k*n]);
+                    double dot = 0;
+                    for(r = 0; r < n; r++) dot += u[r]*v[r];
+                    for(r = 0; r < n; r++) v[r] -= dot*u[r];
+                }
+                double mag = 0;
+                for(r = 0; r < n; r++) mag += v[r]*v[r];
+                mag = sqrt(mag);
+                if(mag < RANK_MAG_TOLERANCE) {
+                    fixed = false;
+                    break;
+                }
+                for(r = 0; r < n; r++) v[r] /= mag;
+            }
+            if(fixed) {
                 bad->Add(&(c->h));
             }
         }
     }
+    rows.Clear();
+    dep.Clear();
 }
 
 int System::Solve(Group *g, int *dof, List<hConstraint> *bad,
                   bool andFindBad, bool andFindFree)
 {
+    sketchParam = &(SK.param);
     WriteEquationsExceptFor(Constraint::NO_CONSTRAINT, g);
 
-    int i, j = 0;
+    int i, alone, last, dofs, failed;
+    uint64_t key;
+    iterations = 0;
 /*
     dbp("%d equations", eq.n);
     for(i = 0; i < eq.n; i++) {
@@ -413,13 +1020,25 @@ int System::Solve(Group *g, int *dof, List<hConstraint> *bad,
     param.ClearTags();
     eq.ClearTags();
 
+    // While dragging, we solve the same equations over and over, from new
+    // initial guesses. So if nothing but the numbers has changed since the
+    // last solve, then we can skip straight to the Newton's method.
+    key = (dragged.n > 0 && !andFindFree) ? HashSystem(g) : 0;
+    if(key != 0 && drag.valid && drag.key == key) {
+        if(SolveAgain()) {
+            if(dof) *dof = drag.dof;
+            goto solved;
+        }
+    }
+    drag.valid = false;
+
     SolveBySubstitution();
 
     // Before solving the big system, see if we can find any equations that
     // are soluble alone. This can be a huge speedup. We don't know whether
     // the system is consistent yet, but if it isn't then we'll catch that
     // later.
-    int alone = 1;
+    alone = 1;
     for(i = 0; i < eq.n; i++) {
         Equation *e = &(eq.elem[i]);
         if(e->tag != 0) continue;
@@ -433,60 +1052,85 @@ int System::Solve(Group *g, int *dof, List<hConstraint> *bad,
 
         e->tag = alone;
         p->tag = alone;
-        WriteJacobian(alone);
-        if(!NewtonSolve(alone)) {
-            // Failed to converge, bail out early
-            goto didnt_converge;
-        }
         alone++;
     }
 
-    // Now write the Jacobian for what's left, and do a rank test; that
-    // tells us if the system is inconsistently constrained.
-    if(!WriteJacobian(0)) {
-        return System::TOO_MANY_UNKNOWNS;
+    // What's left falls apart into subsystems that share no unknowns, and
+    // those can be solved independently. This is exact, not a heuristic:
+    // the Jacobian is block diagonal, so its rank and the least squares
+    // step are the same whether we solve the blocks together or apart.
+    last = TagSubsystems(alone);
+    WriteSubsystems(1, alone, last);
+
+    // So solve the equations that are alone first, since the others might
+    // use their results. Each of those is a subsystem too, so they can go
+    // in parallel as well.
+    failed = SolveSubsystems(0, alone - 1, andFindFree, false);
+    if(failed >= 0) {
+        // Failed to converge, bail out early. Solve it again here, so that
+        // we can see which equations are unsatisfied; the params weren't
+        // written back, so it fails exactly the same way.
+        WriteJacobian(subsys.elem[failed].tag);
+        NewtonSolve(subsys.elem[failed].tag);
+        goto didnt_converge;
     }
 
-    EvalJacobian();
+    // And then the others; that's a rank test, which tells us if it's
+    // inconsistently constrained, and then the solve.
+    failed = SolveSubsystems(alone - 1, subsys.n, andFindFree, false);
 
-    int rank; rank = CalculateRank();
-    if(rank != mat.m) {
-        if(andFindBad) {
-            FindWhichToRemoveToFixJacobian(g, bad);
+    dofs = 0;
+    for(i = alone - 1; i < subsys.n; i++) {
+        if(subsys.elem[i].result == SINGULAR_JACOBIAN) {
+            if(andFindBad) {
+                FindWhichToRemoveToFixJacobian(g, bad);
+            }
+            return System::SINGULAR_JACOBIAN;
         }
-        return System::SINGULAR_JACOBIAN;
+        dofs += subsys.elem[i].dof;
+    }
+    // Any unknowns still with tag zero appear in no equation at all, so
+    // each of those is one more degree of freedom.
+    for(i = 0; i < param.n; i++) {
+        if(param.elem[i].tag == 0) dofs++;
     }
     // This is not the full Jacobian, but any substitutions or single-eq
     // solves removed one equation and one unknown, therefore no effect
     // on the number of DOF.
-    if(dof) *dof = mat.n - mat.m;
+    if(dof) *dof = dofs;
 
-    // And do the leftovers as one big system
-    if(!NewtonSolve(0)) {
+    if(failed >= 0) {
+        WriteJacobian(subsys.elem[failed].tag);
+        NewtonSolve(subsys.elem[failed].tag);
         goto didnt_converge;
     }
 
-    // If requested, find all the free (unbound) variables. This might be
-    // more than the number of degrees of freedom. Don't always do this,
-    // because the display would get annoying and it's slow.
+    // The subsystems found their own free variables. Anything that
+    // appears in no equation is free too. Don't always do this, because
+    // the display would get annoying and it's slow.
     for(i = 0; i < param.n; i++) {
         Param *p = &(param.elem[i]);
-        p->free = false;
+        if(p->tag >= alone && p->tag < last) continue;
 
-        if(andFindFree) {
-            if(p->tag == 0) {
-                p->tag = VAR_DOF_TEST;
-                WriteJacobian(0);
-                EvalJacobian();
-                rank = CalculateRank();
-                if(rank == mat.m) {
-                    p->free = true;
-                }
-                p->tag = 0;
-            }
+        p->free = (andFindFree && p->tag == 0);
+    }
+
+    // Remember all that, in case we're dragging and the next solve is the
+    // same but for the numbers.
+    if(key != 0) {
+        drag.valid = true;
+        drag.key = key;
+        drag.alone = alone - 1;
+        drag.dof = dofs;
+        drag.paramTag.Resize(param.n);
+        drag.paramSubstd.Resize(param.n);
+        for(i = 0; i < param.n; i++) {
+            drag.paramTag.elem[i] = param.elem[i].tag;
+            drag.paramSubstd.elem[i] = param.elem[i].substd;
         }
     }
 
+solved:
     // System solved correctly, so write the new values back in to the
     // main parameter table.
     for(i = 0; i < param.n; i++) {
@@ -506,12 +1150,13 @@ int System::Solve(Group *g, int *dof, List<hConstraint> *bad,
 
 didnt_converge:
     SK.constraint.ClearTags();
-    for(i = 0; i < eq.n; i++) {
-        if(ffabs(mat.B.num[i]) > CONVERGE_TOLERANCE || isnan(mat.B.num[i])) {
+    for(i = 0; i < mat.m; i++) {
+        double v = mat.B.num.elem[i];
+        if(ffabs(v) > CONVERGE_TOLERANCE || isnan(v)) {
             // This constraint is unsatisfied.
-            if(!mat.eq[i].isFromConstraint()) continue;
+            if(!mat.eq.elem[i].isFromConstraint()) continue;
 
-            hConstraint hc = mat.eq[i].constraint();
+            hConstraint hc = mat.eq.elem[i].constraint();
             ConstraintBase *c = SK.constraint.FindByIdNoOops(hc);
             if(!c) continue;
             // Don't double-show constraints that generated multiple
@@ -531,4 +1176,31 @@ void System::Clear(void) {
     param.Clear();
     eq.Clear();
     dragged.Clear();
+
+    mat.eq.Clear();
+    mat.param.Clear();
+    mat.A.row.Clear();
+    mat.A.col.Clear();
+    mat.A.num.Clear();
+    mat.A.reg.Clear();
+    mat.A.colStart.Clear();
+    mat.A.colEntry.Clear();
+    mat.A.colRow.Clear();
+    mat.scale.Clear();
+    mat.AAt.Clear();
+    mat.Z.Clear();
+    mat.X.Clear();
+    mat.B.num.Clear();
+    mat.B.tape.Clear();
+
+    subsys.Clear();
+    subsysEq.Clear();
+    for(int i = 0; i < subsysSys.n; i++) {
+        subsysSys.elem[i]->Clear();
+        MemFree(subsysSys.elem[i]);
+    }
+    subsysSys.Clear();
+    drag.valid = false;
+    drag.paramTag.Clear();
+    drag.paramSubstd.Clear();
 }
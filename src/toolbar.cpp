@@ -244,6 +244,8 @@ bool GraphicsWindow::ToolbarDrawOrHitTest(int mx, int my,
 
 void GraphicsWindow::TimerCallback(void) {
     SS.GW.toolbarTooltipped = SS.GW.toolbarHovered;
+    // And pick up anything that's been regenerated in the background.
+    SS.PublishGenerated();
     PaintGraphics();
 }
 
@@ -53,6 +53,7 @@ void SolveSpaceUI::PushFromCurrentOnto(UndoStack *uk) {
         // And then clean up all the stuff that needs to be a deep copy,
         // and zero out all the dynamic stuff that will get regenerated.
         dest.clean = false;
+        dest.cleanMesh = false;
         ZERO(&(dest.solved));
         ZERO(&(dest.polyLoops));
         ZERO(&(dest.bezierLoops));
@@ -62,8 +63,10 @@ void SolveSpaceUI::PushFromCurrentOnto(UndoStack *uk) {
         ZERO(&(dest.runningMesh));
         ZERO(&(dest.thisShell));
         ZERO(&(dest.runningShell));
+        dest.runningShellKey = 0;
         ZERO(&(dest.displayMesh));
         ZERO(&(dest.displayEdges));
+        ZERO(&(dest.displayLod));
 
         ZERO(&(dest.remap));
         src->remap.DeepCopyInto(&(dest.remap));
@@ -100,7 +103,9 @@ void SolveSpaceUI::PopOntoCurrentFrom(UndoStack *uk) {
 
     UndoState *ut = &(uk->d[uk->write]);
 
-    // Free everything in the main copy of the program before replacing it
+    // Free everything in the main copy of the program before replacing it;
+    // and anything still being regenerated from it is out of date now.
+    CancelGenerate();
     Group *g;
     for(g = SK.group.First(); g; g = SK.group.NextAfter(g)) {
         g->Clear();
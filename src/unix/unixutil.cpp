@@ -44,57 +44,6 @@ int64_t GetUnixTime(void)
     return (int64_t)ret;
 }
 
-//-----------------------------------------------------------------------------
-// A separate heap, on which we allocate expressions. Maybe a bit faster,
-// since fragmentation is less of a concern, and it also makes it possible
-// to be sloppy with our memory management, and just free everything at once
-// at the end.
-//-----------------------------------------------------------------------------
-
-typedef struct _AllocTempHeader AllocTempHeader;
-
-typedef struct _AllocTempHeader {
-    AllocTempHeader *prev;
-    AllocTempHeader *next;
-} AllocTempHeader;
-
-static AllocTempHeader *Head = NULL;
-
-void *AllocTemporary(size_t n)
-{
-    AllocTempHeader *h =
-        (AllocTempHeader *)malloc(n + sizeof(AllocTempHeader));
-    h->prev = NULL;
-    h->next = Head;
-    if(Head) Head->prev = h;
-    Head = h;
-    memset(&h[1], 0, n);
-    return (void *)&h[1];
-}
-
-void FreeTemporary(void *p)
-{
-    AllocTempHeader *h = (AllocTempHeader *)p - 1;
-    if(h->prev) {
-        h->prev->next = h->next;
-    } else {
-        Head = h->next;
-    }
-    if(h->next) h->next->prev = h->prev;
-    free(h);
-}
-
-void FreeAllTemporary(void)
-{
-    AllocTempHeader *h = Head;
-    while(h) {
-        AllocTempHeader *f = h;
-        h = h->next;
-        free(f);
-    }
-    Head = NULL;
-}
-
 void *MemRealloc(void *p, size_t n) {
     if(!p) {
         return MemAlloc(n);
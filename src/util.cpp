@@ -5,6 +5,10 @@
 // Copyright 2008-2013 Jonathan Westhues.
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 void SolveSpace::MakePathRelative(const char *basep, char *pathp)
 {
@@ -259,6 +263,268 @@ void BandedMatrix::Solve(void) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Factor a sparse symmetric matrix as L*D*L'. This is the up-looking
+// algorithm (as in Tim Davis's LDL), with the elimination tree used to find
+// the nonzero pattern of each row of L. The ordering is a greedy minimum
+// degree ordering; that's not as good as AMD, but our matrices come from
+// sketches where each constraint touches only a few unknowns, so the fill
+// is small anyway.
+//-----------------------------------------------------------------------------
+typedef struct {
+    int     degree;
+    int     node;
+} MinDegreeItem;
+
+static bool MinDegreeAfter(const MinDegreeItem &a, const MinDegreeItem &b) {
+    // Order the heap by fewest neighbors, and then by lowest index, so
+    // that the ordering is deterministic.
+    if(a.degree != b.degree) return a.degree > b.degree;
+    return a.node > b.node;
+}
+
+void SparseLdl::Analyze(void) {
+    int i, j, k, p, q;
+
+    // Build the graph of the matrix, without the diagonal.
+    List<int> *adj = (List<int> *)MemAlloc(max(n, 1)*sizeof(List<int>));
+    memset(adj, 0, max(n, 1)*sizeof(List<int>));
+    for(j = 0; j < n; j++) {
+        for(p = Ap.elem[j]; p < Ap.elem[j+1]; p++) {
+            i = Ai.elem[p];
+            if(i != j) adj[j].Add(&i);
+        }
+    }
+
+    // Choose the ordering. Eliminating a node makes a clique of all its
+    // neighbors, so that's where the fill in L comes from.
+    perm.Resize(n);
+    permInv.Resize(n);
+    flag.Resize(n);
+    for(j = 0; j < n; j++) {
+        permInv.elem[j] = -1;
+        flag.elem[j] = -1;
+    }
+    List<MinDegreeItem> heap;
+    ZERO(&heap);
+    for(j = 0; j < n; j++) {
+        MinDegreeItem mdi = { adj[j].n, j };
+        heap.Add(&mdi);
+    }
+    std::make_heap(heap.elem, heap.elem + heap.n, MinDegreeAfter);
+
+    int stamp = 0;
+    k = 0;
+    while(k < n) {
+        std::pop_heap(heap.elem, heap.elem + heap.n, MinDegreeAfter);
+        MinDegreeItem mdi = heap.elem[heap.n - 1];
+        heap.RemoveLast(1);
+
+        int v = mdi.node;
+        // Skip entries that are stale, since we don't remove those when
+        // a node's degree changes.
+        if(permInv.elem[v] >= 0 || mdi.degree != adj[v].n) continue;
+
+        perm.elem[k] = v;
+        permInv.elem[v] = k;
+        k++;
+
+        for(p = 0; p < adj[v].n; p++) {
+            int u = adj[v].elem[p];
+            List<int> *au = &(adj[u]);
+            stamp++;
+            flag.elem[u] = stamp;
+            int dest = 0;
+            for(q = 0; q < au->n; q++) {
+                int w = au->elem[q];
+                if(w == v) continue;
+                au->elem[dest++] = w;
+                flag.elem[w] = stamp;
+            }
+            au->n = dest;
+            for(q = 0; q < adj[v].n; q++) {
+                int w = adj[v].elem[q];
+                if(flag.elem[w] == stamp) continue;
+                au->Add(&w);
+                flag.elem[w] = stamp;
+            }
+            MinDegreeItem mdu = { au->n, u };
+            heap.Add(&mdu);
+            std::push_heap(heap.elem, heap.elem + heap.n, MinDegreeAfter);
+        }
+        adj[v].Clear();
+    }
+    heap.Clear();
+    for(j = 0; j < n; j++) {
+        adj[j].Clear();
+    }
+    MemFree(adj);
+
+    // Now find the elimination tree, and the number of nonzeros in each
+    // column of L.
+    parent.Resize(n);
+    Lnz.Resize(n);
+    for(k = 0; k < n; k++) {
+        parent.elem[k] = -1;
+        flag.elem[k] = k;
+        Lnz.elem[k] = 0;
+        int kk = perm.elem[k];
+        for(p = Ap.elem[kk]; p < Ap.elem[kk+1]; p++) {
+            i = permInv.elem[Ai.elem[p]];
+            if(i >= k) continue;
+            for(; flag.elem[i] != k; i = parent.elem[i]) {
+                if(parent.elem[i] == -1) parent.elem[i] = k;
+                Lnz.elem[i]++;
+                flag.elem[i] = k;
+            }
+        }
+    }
+    Lp.Resize(n + 1);
+    Lp.elem[0] = 0;
+    for(k = 0; k < n; k++) {
+        Lp.elem[k+1] = Lp.elem[k] + Lnz.elem[k];
+    }
+    Li.Resize(Lp.elem[n]);
+    Lx.Resize(Lp.elem[n]);
+    D.Resize(n);
+    pattern.Resize(n);
+    y.Resize(n);
+    for(k = 0; k < n; k++) {
+        y.elem[k] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Compute the numerical factorization, with the structure from Analyze().
+// Any pivot less than or equal to zeroTol is taken to be exactly zero, and
+// that row is then ignored, like a zero row in Gram-Schmidt. Returns the
+// number of nonzero pivots, which is the rank.
+//-----------------------------------------------------------------------------
+int SparseLdl::Factor(double zeroTol) {
+    int i, k, p, p2, len, top;
+    int rank = 0;
+
+    for(k = 0; k < n; k++) {
+        // Scatter row k of the permuted matrix into y, and find the pattern
+        // of row k of L by walking up the elimination tree.
+        y.elem[k] = 0;
+        top = n;
+        flag.elem[k] = k;
+        Lnz.elem[k] = 0;
+        int kk = perm.elem[k];
+        for(p = Ap.elem[kk]; p < Ap.elem[kk+1]; p++) {
+            i = permInv.elem[Ai.elem[p]];
+            if(i > k) continue;
+            y.elem[i] += Ax.elem[p];
+            for(len = 0; flag.elem[i] != k; i = parent.elem[i]) {
+                pattern.elem[len++] = i;
+                flag.elem[i] = k;
+            }
+            while(len > 0) {
+                pattern.elem[--top] = pattern.elem[--len];
+            }
+        }
+
+        // Then solve for row k of L, and the pivot.
+        double d = y.elem[k];
+        y.elem[k] = 0;
+        for(; top < n; top++) {
+            i = pattern.elem[top];
+            double yi = y.elem[i];
+            y.elem[i] = 0;
+            p2 = Lp.elem[i] + Lnz.elem[i];
+            for(p = Lp.elem[i]; p < p2; p++) {
+                y.elem[Li.elem[p]] -= Lx.elem[p]*yi;
+            }
+            double lki = EXACT(D.elem[i] == 0) ? 0 : yi/D.elem[i];
+            d -= lki*yi;
+            Li.elem[p2] = k;
+            Lx.elem[p2] = lki;
+            Lnz.elem[i]++;
+        }
+
+        if(d > zeroTol) {
+            D.elem[k] = d;
+            rank++;
+        } else {
+            D.elem[k] = 0;
+        }
+    }
+    return rank;
+}
+
+//-----------------------------------------------------------------------------
+// Solve (L*D*L')*x = b, in place; the components that correspond to zero
+// pivots come out as zero.
+//-----------------------------------------------------------------------------
+void SparseLdl::Solve(double *x) {
+    int j, p;
+
+    for(j = 0; j < n; j++) {
+        y.elem[j] = x[perm.elem[j]];
+    }
+    for(j = 0; j < n; j++) {
+        for(p = Lp.elem[j]; p < Lp.elem[j+1]; p++) {
+            y.elem[Li.elem[p]] -= Lx.elem[p]*y.elem[j];
+        }
+    }
+    for(j = 0; j < n; j++) {
+        y.elem[j] = EXACT(D.elem[j] == 0) ? 0 : y.elem[j]/D.elem[j];
+    }
+    for(j = n - 1; j >= 0; j--) {
+        for(p = Lp.elem[j]; p < Lp.elem[j+1]; p++) {
+            y.elem[j] -= Lx.elem[p]*y.elem[Li.elem[p]];
+        }
+    }
+    for(j = 0; j < n; j++) {
+        x[perm.elem[j]] = y.elem[j];
+        // Factor() expects the workspace to be left zeroed.
+        y.elem[j] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Find a vector in the null space of the matrix, for the zero pivot at k in
+// the permuted order: since column k of L is zero, L'*x = e_k gives
+// L*D*L'*x = L*D*e_k = 0. In terms of Gram-Schmidt, that's the combination
+// of earlier rows that row k turned out to be, with coefficient one on row
+// k itself.
+//-----------------------------------------------------------------------------
+void SparseLdl::NullVector(int k, double *x) {
+    int j, p;
+
+    y.elem[k] = 1;
+    for(j = k - 1; j >= 0; j--) {
+        double sum = 0;
+        for(p = Lp.elem[j]; p < Lp.elem[j+1]; p++) {
+            sum += Lx.elem[p]*y.elem[Li.elem[p]];
+        }
+        y.elem[j] = -sum;
+    }
+    for(j = 0; j < n; j++) {
+        x[perm.elem[j]] = y.elem[j];
+        y.elem[j] = 0;
+    }
+}
+
+void SparseLdl::Clear(void) {
+    Ap.Clear();
+    Ai.Clear();
+    Ax.Clear();
+    perm.Clear();
+    permInv.Clear();
+    parent.Clear();
+    Lp.Clear();
+    Li.Clear();
+    Lx.Clear();
+    D.Clear();
+    Lnz.Clear();
+    flag.Clear();
+    pattern.Clear();
+    y.Clear();
+    n = 0;
+}
+
 const Quaternion Quaternion::IDENTITY = { 1, 0, 0, 0 };
 
 Quaternion Quaternion::From(double w, double vx, double vy, double vz) {
@@ -1082,3 +1348,257 @@ bool Point2d::Equals(Point2d v, double tol) {
     return (this->Minus(v)).MagSquared() < tol*tol;
 }
 
+
+//-----------------------------------------------------------------------------
+// The arena for small temporary objects, like the nodes of the BSPs and
+// kd-trees and expressions, which get allocated by the thousand and then
+// freed all at once. Each is carved out of the current chunk by bumping a
+// pointer, with no header of its own; and resetting the arena frees every
+// chunk but the first, which gets reused. Like the rest of the temporary
+// heap, each thread has its own.
+//-----------------------------------------------------------------------------
+typedef struct _TempChunk TempChunk;
+
+typedef struct _TempChunk {
+    TempChunk   *next;
+    size_t      size;
+    size_t      used;
+} TempChunk;
+
+static const size_t TEMP_CHUNK_SIZE = 256*1024;
+static thread_local TempChunk *TempArena = NULL;
+// Allocations too big to be worth packing each get a chunk of their own,
+// kept on this list; those are all freed when we reset.
+static thread_local TempChunk *TempLarge = NULL;
+
+static TempChunk *AllocTempChunk(size_t size) {
+    TempChunk *c = (TempChunk *)MemAlloc(sizeof(TempChunk) + size);
+    c->next = NULL;
+    c->size = size;
+    c->used = 0;
+    return c;
+}
+
+void *SolveSpace::AllocTemporaryNode(size_t n) {
+    // Keep everything aligned for any type that we might put there.
+    const size_t ALIGN = 16;
+    n = (n + ALIGN - 1) & ~(ALIGN - 1);
+
+    uint8_t *p;
+    if(n > TEMP_CHUNK_SIZE/8) {
+        TempChunk *c = AllocTempChunk(n);
+        c->next = TempLarge;
+        TempLarge = c;
+        c->used = n;
+        p = (uint8_t *)&c[1];
+    } else {
+        if(!TempArena) TempArena = AllocTempChunk(TEMP_CHUNK_SIZE);
+        if(TempArena->used + n > TempArena->size) {
+            TempChunk *c = AllocTempChunk(TEMP_CHUNK_SIZE);
+            c->next = TempArena;
+            TempArena = c;
+        }
+        p = (uint8_t *)&TempArena[1] + TempArena->used;
+        TempArena->used += n;
+    }
+    memset(p, 0, n);
+    return p;
+}
+
+static void FreeAllTemporaryNodes(void) {
+    TempChunk *c = TempLarge;
+    while(c) {
+        TempChunk *f = c;
+        c = c->next;
+        MemFree(f);
+    }
+    TempLarge = NULL;
+
+    // Keep the first chunk, which is at the end of the list since new chunks
+    // go on the front, so that the next regeneration can reuse it.
+    c = TempArena;
+    while(c && c->next) {
+        TempChunk *f = c;
+        c = c->next;
+        MemFree(f);
+    }
+    if(c) c->used = 0;
+    TempArena = c;
+}
+
+//-----------------------------------------------------------------------------
+// A separate heap, on which we allocate everything temporary that's not small
+// enough for the arena. This makes it possible to be sloppy with our memory
+// management, and just free everything at once at the end. Each thread has
+// its own, so that work can be done on several threads at once;
+// FreeAllTemporary() frees only the calling thread's, so it's cheap for a
+// worker to call after each batch.
+//-----------------------------------------------------------------------------
+typedef struct _AllocTempHeader AllocTempHeader;
+
+typedef struct _AllocTempHeader {
+    AllocTempHeader *prev;
+    AllocTempHeader *next;
+} AllocTempHeader;
+
+static thread_local AllocTempHeader *Head = NULL;
+
+void *SolveSpace::AllocTemporary(size_t n) {
+    AllocTempHeader *h =
+        (AllocTempHeader *)malloc(n + sizeof(AllocTempHeader));
+    if(!h) oops();
+    h->prev = NULL;
+    h->next = Head;
+    if(Head) Head->prev = h;
+    Head = h;
+    memset(&h[1], 0, n);
+    return (void *)&h[1];
+}
+
+void SolveSpace::FreeTemporary(void *p) {
+    AllocTempHeader *h = (AllocTempHeader *)p - 1;
+    if(h->prev) {
+        h->prev->next = h->next;
+    } else {
+        Head = h->next;
+    }
+    if(h->next) h->next->prev = h->prev;
+    free(h);
+}
+
+void SolveSpace::FreeAllTemporary(void) {
+    AllocTempHeader *h = Head;
+    while(h) {
+        AllocTempHeader *f = h;
+        h = h->next;
+        free(f);
+    }
+    Head = NULL;
+    FreeAllTemporaryNodes();
+}
+
+//-----------------------------------------------------------------------------
+// A Boolean on the worker thread must use the tolerances that its job was
+// made with, and not read the view scale while the UI changes it. So it
+// overrides them on its own thread, and the pool passes that on.
+//-----------------------------------------------------------------------------
+static thread_local double ChordTolOverride = 0;
+static thread_local int    MaxSegmentsOverride = 0;
+
+void SolveSpace::OverrideTolerances(double chordTolMm, int maxSegs) {
+    ChordTolOverride = chordTolMm;
+    MaxSegmentsOverride = maxSegs;
+}
+
+void SolveSpace::GetToleranceOverride(double *chordTolMm, int *maxSegs) {
+    *chordTolMm = ChordTolOverride;
+    *maxSegs = MaxSegmentsOverride;
+}
+
+//-----------------------------------------------------------------------------
+// A pool of threads, for work that splits into independent pieces. The
+// calling thread works too. Only one caller can use the pool at a time; if
+// it's busy (or if we're already on one of its threads), then we just do
+// everything on the calling thread.
+//-----------------------------------------------------------------------------
+class WorkPool {
+public:
+    enum {
+        MAX_THREADS = 16
+    };
+
+    std::mutex              busy;
+
+    std::mutex              lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    int                     threads;
+    unsigned                batch;
+    int                     working;
+
+    std::atomic<int>        next;
+    int                     end;
+    ParallelFn             *fn;
+    void                   *data;
+    // The caller's tolerances, for the workers to use too.
+    double                  chordTolMm;
+    int                     maxSegs;
+
+    void Work(void) {
+        for(;;) {
+            int i = next++;
+            if(i >= end) break;
+            fn(data, i);
+        }
+    }
+
+    void Worker(void) {
+        unsigned seen = 0;
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> l(lock);
+                while(batch == seen) wake.wait(l);
+                seen = batch;
+            }
+            OverrideTolerances(chordTolMm, maxSegs);
+            Work();
+            OverrideTolerances(0, 0);
+            FreeAllTemporary();
+            {
+                std::unique_lock<std::mutex> l(lock);
+                working--;
+                if(working == 0) done.notify_one();
+            }
+        }
+    }
+
+    void Run(int n, ParallelFn *f, void *d) {
+        {
+            std::unique_lock<std::mutex> l(lock);
+            next = 0;
+            end = n;
+            fn = f;
+            data = d;
+            GetToleranceOverride(&chordTolMm, &maxSegs);
+            working = threads;
+            batch++;
+        }
+        wake.notify_all();
+        Work();
+        {
+            std::unique_lock<std::mutex> l(lock);
+            while(working > 0) done.wait(l);
+        }
+    }
+};
+static WorkPool *Pool = NULL;
+static std::mutex PoolCreate;
+
+void SolveSpace::ParallelFor(int n, ParallelFn *fn, void *data) {
+    if(n >= 2) {
+        {
+            std::lock_guard<std::mutex> l(PoolCreate);
+            if(!Pool) {
+                Pool = new WorkPool;
+                Pool->threads = (int)std::thread::hardware_concurrency() - 1;
+                Pool->threads = max(0, min(Pool->threads,
+                                           (int)WorkPool::MAX_THREADS));
+                Pool->batch = 0;
+                int i;
+                for(i = 0; i < Pool->threads; i++) {
+                    std::thread(&WorkPool::Worker, Pool).detach();
+                }
+            }
+        }
+        if(Pool->threads > 0 && Pool->busy.try_lock()) {
+            Pool->Run(n, fn, data);
+            Pool->busy.unlock();
+            return;
+        }
+    }
+
+    int i;
+    for(i = 0; i < n; i++) {
+        fn(data, i);
+    }
+}
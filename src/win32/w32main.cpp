@@ -1240,7 +1240,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     glClear(GL_COLOR_BUFFER_BIT);
     SwapBuffers(GetDC(GraphicsWnd));
 
-    // Create the heaps for all dynamic memory (AllocTemporary, MemAlloc)
+    // Create the heap for long-lived dynamic memory (MemAlloc)
     InitHeaps();
 
     // A filename may have been specified on the command line; if so, then
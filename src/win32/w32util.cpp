@@ -1,15 +1,14 @@
 //-----------------------------------------------------------------------------
-// Utility functions that depend on Win32. Notably, our memory allocation;
-// we use two separate allocators, one for long-lived stuff and one for
-// stuff that gets freed after every regeneration of the model, to save us
-// the trouble of freeing the latter explicitly.
+// Utility functions that depend on Win32. Notably, our memory allocation
+// for long-lived stuff; the temporary heap, for stuff that gets freed after
+// every regeneration of the model, is platform-independent and in util.cpp.
 //
 // Copyright 2008-2013 Jonathan Westhues.
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
 
 namespace SolveSpace {
-static HANDLE PermHeap, TempHeap;
+static HANDLE PermHeap;
 
 void dbp(const char *str, ...)
 {
@@ -29,57 +28,31 @@ void GetAbsoluteFilename(char *file)
     strcpy(file, absoluteFile);
 }
 
-//-----------------------------------------------------------------------------
-// A separate heap, on which we allocate expressions. Maybe a bit faster,
-// since no fragmentation issues whatsoever, and it also makes it possible
-// to be sloppy with our memory management, and just free everything at once
-// at the end.
-//-----------------------------------------------------------------------------
-void *AllocTemporary(size_t n)
-{
-    void *v = HeapAlloc(TempHeap, HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY, n);
-    if(!v) oops();
-    return v;
-}
-void FreeTemporary(void *p) {
-    HeapFree(TempHeap, HEAP_NO_SERIALIZE, p);
-}
-void FreeAllTemporary(void)
-{
-    if(TempHeap) HeapDestroy(TempHeap);
-    TempHeap = HeapCreate(HEAP_NO_SERIALIZE, 1024*1024*20, 0);
-    // This is a good place to validate, because it gets called fairly
-    // often.
-    vl();
-}
-
 void *MemRealloc(void *p, size_t n) {
     if(!p) {
         return MemAlloc(n);
     }
 
-    p = HeapReAlloc(PermHeap, HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY, p, n);
+    p = HeapReAlloc(PermHeap, HEAP_ZERO_MEMORY, p, n);
     if(!p) oops();
     return p;
 }
 void *MemAlloc(size_t n) {
-    void *p = HeapAlloc(PermHeap, HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY, n);
+    void *p = HeapAlloc(PermHeap, HEAP_ZERO_MEMORY, n);
     if(!p) oops();
     return p;
 }
 void MemFree(void *p) {
-    HeapFree(PermHeap, HEAP_NO_SERIALIZE, p);
+    HeapFree(PermHeap, 0, p);
 }
 
 void vl(void) {
-    if(!HeapValidate(TempHeap, HEAP_NO_SERIALIZE, NULL)) oops();
-    if(!HeapValidate(PermHeap, HEAP_NO_SERIALIZE, NULL)) oops();
+    if(!HeapValidate(PermHeap, 0, NULL)) oops();
 }
 
 void InitHeaps(void) {
     // Create the heap used for long-lived stuff (that gets freed piecewise).
-    PermHeap = HeapCreate(HEAP_NO_SERIALIZE, 1024*1024*20, 0);
-    // Create the heap that we use to store Exprs and other temp stuff.
-    FreeAllTemporary();
+    // This one is shared by all threads, so it must be serialized.
+    PermHeap = HeapCreate(0, 1024*1024*20, 0);
 }
 }
\ No newline at end of file